@@ -11,6 +11,7 @@ namespace UniDx {
 
 class Collider;
 struct Collision;
+struct ControllerColliderHit;
 
 /// @brief GameObjectの挙動を記述する基底コンポーネント。UnityのMonoBehaviour相当
 class Behaviour : public Component
@@ -25,6 +26,7 @@ public:
     virtual void OnCollisionEnter(const Collision& collision) {}
     virtual void OnCollisionStay(const Collision& collision) {}
     virtual void OnCollisionExit(const Collision& collision) {}
+    virtual void OnControllerColliderHit(const ControllerColliderHit& hit) {}
 
     virtual ~Behaviour() = default;
 };
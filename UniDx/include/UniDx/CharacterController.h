@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "Component.h"
+#include "Collision.h"
+
+
+namespace UniDx
+{
+
+class Collider;
+
+// CharacterController::Move() でどこがぶつかったか
+enum CollisionFlags : uint8_t
+{
+    CollisionFlags_None = 0,
+    CollisionFlags_Sides = 1,   // 横
+    CollisionFlags_Above = 2,   // 上
+    CollisionFlags_Below = 4,   // 下（足もと）
+};
+
+
+// --------------------
+// CharacterControllerクラス
+// --------------------
+// 縦向きのカプセルを Physics::CapsuleCast() で動かし、ぶつかった面に沿って滑らせる
+// Physics には登録しないので、ソルバやナローフェーズの負担にならない
+// そのかわりこれだけでは Rigidbody やトリガーからは見えない。見えるようにするには、
+// 同じ GameObject に isKinematic の Rigidbody とカプセルに収まるコライダーを付ける
+// （Move() は自分のコライダーには当たらず、Rigidbody は動かされた Transform に合わせて相手を押す）
+class CharacterController : public Component
+{
+public:
+    Vector3 center = Vector3::zero;     // カプセルの中心（transform の位置からのずれ。回転と拡大は反映しない）
+    float height = 2.0f;                // カプセルの高さ（半球を含む）
+    float radius = 0.5f;                // カプセルの半径
+    float slopeLimit = 45.0f;           // 登れる坂の角度°
+    float stepOffset = 0.3f;            // 登れる段差の高さ
+    float skinWidth = 0.02f;            // 判定の余裕。これより小さいめり込みは押し出さずに動ける
+    float minMoveDistance = 0.001f;     // これより短い移動は無視する
+
+    // 衝突レイヤー（0～31）。Physics::IgnoreLayerCollision() で衝突しないレイヤーのコライダーは無視する
+    int layer = 0;
+
+    CharacterController() {}
+    CharacterController(Vector3 c, float h, float r) : center(c), height(h), radius(r) {}
+
+    // motion だけ動かす。重力はかけない
+    // ぶつかった面に沿って滑り、stepOffset 以下の段差は登る
+    uint8_t Move(Vector3 motion);
+
+    // 水平の速度 speed で Time::deltaTime だけ動かす。重力は内部でかける
+    bool SimpleMove(Vector3 speed);
+
+    // 直前の Move() で足もとが地面に着いたか
+    bool isGrounded() const { return (collisionFlags & CollisionFlags_Below) != 0; }
+
+    // 直前の Move() でぶつかったところ
+    uint8_t getCollisionFlags() const { return collisionFlags; }
+
+    // 直前の Move() で実際に動いた速度
+    Vector3 getVelocity() const { return velocity; }
+
+protected:
+    virtual void CloneTo(Component& destination) const override
+    {
+        auto& dst = static_cast<CharacterController&>(destination);
+        dst.collisionFlags = CollisionFlags_None;
+        dst.velocity = Vector3::zero;
+        dst.fallSpeed = 0.0f;
+        dst.groundNormal = Vector3::zero;
+        dst.groundHeight = 0.0f;
+        dst.hits.clear();
+    }
+
+private:
+    uint8_t collisionFlags = CollisionFlags_None;
+    Vector3 velocity = Vector3::zero;
+    float fallSpeed = 0.0f;     // SimpleMove() で重力から積んだ落下の速さ
+    Vector3 groundNormal = Vector3::zero;   // 足もとへ下ろしたときに着いた面の法線。着かなければ zero
+    float groundHeight = 0.0f;              // 足もとへ下ろしたときに着いた点の高さ
+    std::vector<ControllerColliderHit> hits;    // Move() の間にぶつかったもの。終わってからコールバックする
+
+    // 滑らせ方
+    enum class Pass
+    {
+        Up,     // 段差を登るために持ち上げる。滑らない
+        Side,   // 横の移動。急な面は壁として扱い、登らない
+        Down,   // 足もとへ下ろす。登れる坂に着いたら止まる
+    };
+
+    Vector3 slide(Vector3 position, Vector3 motion, Pass pass, uint8_t& flags);
+    bool cast(Vector3 position, Vector3 direction, float distance, RaycastHit& hit) const;
+    Vector3 groundNormalAt(const RaycastHit& hit) const;
+    bool canCollide(const Collider* col) const;
+    uint8_t classify(Vector3 normal) const;
+    bool isWalkable(Vector3 normal) const;
+};
+
+} // namespace UniDx
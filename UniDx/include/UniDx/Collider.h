@@ -1,5 +1,10 @@
 ﻿#pragma once
 
+#include <vector>
+#include <memory>
+#include <span>
+#include <cstdint>
+
 #include "Component.h"
 #include "Bounds.h"
 #include "Physics.h"
@@ -10,6 +15,10 @@ namespace UniDx
     class Rigidbody;
     class SphereCollider;
     class AABBCollider;
+    class TilemapCollider;
+    class MeshCollider;
+    class MeshBVH;
+    class Mesh;
 
     /// @brief すべてのコライダーの基盤となるクラス
     class Collider : public Component
@@ -18,8 +27,15 @@ namespace UniDx
         Rigidbody* attachedRigidbody = nullptr;
         bool isTrigger = false;
 
+        // Physics に登録したShapeのハンドル。Physics が設定する
+        PhysicsHandle physicsHandle;
+
+        // 衝突レイヤー（0～31）。Physics::IgnoreLayerCollision() で衝突する組み合わせを決める
+        int layer = 0;
+
         // 物理マテリアル
         float bounciness = 0.75f;
+        float friction = 0.6f;  // 摩擦係数。Physics::simulate() で使う
 
         virtual void OnEnable() override
         {
@@ -35,25 +51,50 @@ namespace UniDx
         // ワールド空間における空間境界を取得
         virtual Bounds getBounds() const = 0;
 
+        // ナローフェーズでまとめて判定するときの形状の種類
+        virtual ShapeType getShapeType() const { return ShapeType::Other; }
+
         // レイキャストチェック
         // 始点が内部のときは false を返す
         virtual bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr) = 0;
 
+        // 半径 radius の球を origin から direction へ動かしたときに最初に当たる位置を調べる
+        // 始点で重なっているときは false を返す
+        virtual bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr) = 0;
+
         // トリガーチェック
         virtual bool intersects(Collider* other) = 0;
         virtual bool intersects(SphereCollider* other) = 0;
         virtual bool intersects(AABBCollider* other) = 0;
+        virtual bool intersects(TilemapCollider* other) = 0;
+        virtual bool intersects(MeshCollider* other) = 0;
+
+        // 球・箱との重なりチェック（Physics::OverlapSphere, OverlapBox で使う）
+        virtual bool intersectsSphere(Vector3 sphereCenter, float sphereRadius) = 0;
+        virtual bool intersectsBox(const Bounds& box) = 0;
 
         // 衝突チェック
-        // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor) = 0;
-        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor) = 0;
-        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor) = 0;
+        // 衝突していれば attachedRigidbody の補正を corrections に記録する
+        // 複数スレッドから同時に呼ばれるので、コライダーや PhysicsActor は書き換えない
+        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) = 0;
+        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) = 0;
+        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) = 0;
+        virtual bool checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) = 0;
+        virtual bool checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) = 0;
+
+        // 接触点の生成（Physics::simulate() で使う）
+        // 離れている距離が margin 以下なら m に接触点を書き込んで true を返す。法線は this から other へ向く
+        virtual bool generateContacts(Collider* other, float margin, ContactManifold& m) = 0;
+        virtual bool generateContacts(SphereCollider* other, float margin, ContactManifold& m) = 0;
+        virtual bool generateContacts(AABBCollider* other, float margin, ContactManifold& m) = 0;
+        virtual bool generateContacts(TilemapCollider* other, float margin, ContactManifold& m) = 0;
+        virtual bool generateContacts(MeshCollider* other, float margin, ContactManifold& m) = 0;
 
     protected:
         virtual void CloneTo(Component& destination) const override
         {
             static_cast<Collider&>(destination).attachedRigidbody = nullptr;
+            static_cast<Collider&>(destination).physicsHandle = PhysicsHandle();
         }
 
     private:
@@ -73,20 +114,42 @@ namespace UniDx
         // ワールド空間における空間境界を取得
         virtual Bounds getBounds() const override;
 
+        // ナローフェーズでまとめて判定するときの形状の種類
+        virtual ShapeType getShapeType() const override { return ShapeType::AABB; }
+
         // レイキャストチェック
         // 始点が内部のときは false を返す
         virtual bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
 
+        // スフィアキャストチェック
+        // 始点で重なっているときは false を返す
+        virtual bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
         // トリガーチェック
         virtual bool intersects(Collider* other) { return other->intersects(this); };
         virtual bool intersects(SphereCollider* other);
         virtual bool intersects(AABBCollider* other);
+        virtual bool intersects(TilemapCollider* other);
+        virtual bool intersects(MeshCollider* other);
+
+        // 球・箱との重なりチェック
+        virtual bool intersectsSphere(Vector3 sphereCenter, float sphereRadius);
+        virtual bool intersectsBox(const Bounds& box);
 
         // 衝突チェック
-        // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor) { return other->checkIntersect(this, otherActor, myActor); }
-        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor);
-        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor);
+        // 衝突していれば attachedRigidbody の補正を corrections に記録する
+        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return other->checkIntersect(this, otherActor, myActor, corrections); }
+        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+
+        // 接触点の生成。法線は this から other へ向く
+        virtual bool generateContacts(Collider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(SphereCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(AABBCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(TilemapCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(MeshCollider* other, float margin, ContactManifold& m);
     };
 
 
@@ -102,20 +165,195 @@ namespace UniDx
         // ワールド空間における空間境界を取得
         virtual Bounds getBounds() const override;
 
+        // ナローフェーズでまとめて判定するときの形状の種類
+        virtual ShapeType getShapeType() const override { return ShapeType::Sphere; }
+
         // レイキャストチェック
         // 始点が内部のときは false を返す
         virtual bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
 
+        // スフィアキャストチェック
+        // 始点で重なっているときは false を返す
+        virtual bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
         // トリガーチェック
         virtual bool intersects(Collider* other) { return other->intersects(this); };
         virtual bool intersects(SphereCollider* other);
         virtual bool intersects(AABBCollider* other);
+        virtual bool intersects(TilemapCollider* other);
+        virtual bool intersects(MeshCollider* other);
+
+        // 球・箱との重なりチェック
+        virtual bool intersectsSphere(Vector3 sphereCenter, float sphereRadius);
+        virtual bool intersectsBox(const Bounds& box);
 
         // 衝突チェック
-        // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor) { return other->checkIntersect(this, otherActor, myActor); }
-        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor);
-        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor);
+        // 衝突していれば attachedRigidbody の補正を corrections に記録する
+        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return other->checkIntersect(this, otherActor, myActor, corrections); }
+        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+
+        // 接触点の生成。法線は this から other へ向く
+        virtual bool generateContacts(Collider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(SphereCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(AABBCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(TilemapCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(MeshCollider* other, float margin, ContactManifold& m);
+    };
+
+
+    /// @brief XZ 平面の格子に並べたタイルのコライダー。埋まっているセルを高さ cellSize.y の箱として扱う
+    /// 格子全体で Physics の Shape 1つになるので、マップが広くなってもブロードフェーズで扱う数は増えない
+    /// セルは番号から直接引き、レイは格子をたどって調べる。AABBCollider と同じく回転の影響を受けない
+    class TilemapCollider : public Collider
+    {
+    public:
+        Vector3 center;     // セル (0, 0) の最小の角（ローカル座標）
+        Vector3 cellSize;   // セル1つの大きさ。y はタイルの高さ
+
+        TilemapCollider(Vector3 c = Vector3::zero, Vector3 cell = Vector3(1, 1, 1)) : center(c), cellSize(cell) {}
+
+        // 格子の大きさを変えて、すべてのセルを solid の状態にする
+        // 大きさは空間境界を変えるので、Physics に登録する前に決めておく
+        void resize(int width, int depth, bool solid = false);
+        int getWidth() const { return width; }
+        int getDepth() const { return depth; }
+
+        // セル (x, z) が埋まっているか。範囲外は空として扱う
+        void setTile(int x, int z, bool solid);
+        bool isSolid(int x, int z) const;
+
+        // セル (x, z) のワールド空間における空間境界
+        Bounds getTileBounds(int x, int z) const;
+
+        // ワールド空間における空間境界を取得（格子全体）
+        virtual Bounds getBounds() const override;
+
+        // レイキャストチェック
+        // セルを1つずつ AABBCollider にしたときと同じく、始点を含むセルには当たらない
+        virtual bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
+        // スフィアキャストチェック
+        // 始点で重なっているときは false を返す
+        virtual bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
+        // トリガーチェック
+        virtual bool intersects(Collider* other) { return other->intersects(this); };
+        virtual bool intersects(SphereCollider* other);
+        virtual bool intersects(AABBCollider* other);
+        virtual bool intersects(TilemapCollider* other) { return false; }
+        virtual bool intersects(MeshCollider* other) { return false; }
+
+        // 球・箱との重なりチェック
+        virtual bool intersectsSphere(Vector3 sphereCenter, float sphereRadius);
+        virtual bool intersectsBox(const Bounds& box);
+
+        // 衝突チェック
+        // 衝突していれば attachedRigidbody の補正を corrections に記録する
+        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return other->checkIntersect(this, otherActor, myActor, corrections); }
+        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+        virtual bool checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+        virtual bool checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+
+        // 接触点の生成。法線は this から other へ向く
+        virtual bool generateContacts(Collider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(SphereCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(AABBCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(TilemapCollider* other, float margin, ContactManifold& m) { return false; }
+        virtual bool generateContacts(MeshCollider* other, float margin, ContactManifold& m) { return false; }
+
+    private:
+        int width = 0;
+        int depth = 0;
+        std::vector<uint8_t> tiles;     // x + z * width の順。0 以外が埋まっている
+
+        // ワールド空間での格子の最小の角とセルの大きさ
+        void getGrid(Vector3& gridMin, Vector3& cell) const;
+
+        // range と重なる埋まったセルごとに f(セルの空間境界) を呼ぶ
+        // f が true を返したらそこで打ち切って true を返す
+        template<typename F>
+        bool forEachSolidTile(const Bounds& range, F&& f) const;
+    };
+
+
+    /// @brief 三角形メッシュのコライダー。地形などの動かないモデルに使う
+    /// メッシュの位置とインデックスから SAH で分割した BVH をローカル座標で作り、レイキャストと球との接触を判定する
+    /// 作った BVH はファイルに書き出せるので、次からは読み込むだけで使える（Bake()）
+    /// 箱との接触の応答は計算しない。SkinnedSubMesh はバインドポーズの形で判定する
+    class MeshCollider : public Collider
+    {
+    public:
+        MeshCollider() = default;
+
+        // メッシュのすべてのサブメッシュ（三角形リスト）から BVH を作る
+        void SetMesh(const Mesh& mesh);
+
+        // 位置とインデックス（三角形リスト）から BVH を作る。indices が空なら位置を3つずつ三角形にする
+        void SetMesh(std::span<const Vector3> positions, std::span<const uint32_t> indices);
+
+        // cachePath に書き出した BVH が mesh と同じデータから作ったものなら読み込み、違えば作り直して書き出す
+        // cachePath はモデルの隣に置く（例: u8"resource/stage.glb.bvh"）
+        bool Bake(const Mesh& mesh, const u8string& cachePath);
+
+        // BVH をファイルに書き出す・読み込む
+        bool SaveBVH(const u8string& path) const;
+        bool LoadBVH(const u8string& path);
+
+        // BVH の三角形数。まだ作っていなければ0
+        int GetTriangleCount() const;
+
+        virtual void OnEnable() override;
+
+        // ワールド空間における空間境界を取得
+        virtual Bounds getBounds() const override;
+
+        // レイキャストチェック。三角形の裏面にも当たる
+        virtual bool Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
+        // スフィアキャストチェック
+        // 始点で重なっているときは false を返す
+        virtual bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo = nullptr);
+
+        // トリガーチェック
+        virtual bool intersects(Collider* other) { return other->intersects(this); };
+        virtual bool intersects(SphereCollider* other);
+        virtual bool intersects(AABBCollider* other);
+        virtual bool intersects(TilemapCollider* other) { return false; }
+        virtual bool intersects(MeshCollider* other) { return false; }
+
+        // 球・箱との重なりチェック
+        virtual bool intersectsSphere(Vector3 sphereCenter, float sphereRadius);
+        virtual bool intersectsBox(const Bounds& box);
+
+        // 衝突チェック
+        // 衝突していれば attachedRigidbody の補正を corrections に記録する
+        virtual bool checkIntersect(Collider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return other->checkIntersect(this, otherActor, myActor, corrections); }
+        virtual bool checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+        virtual bool checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+        virtual bool checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+        virtual bool checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections) { return false; }
+
+        // 接触点の生成。法線は this から other へ向く
+        virtual bool generateContacts(Collider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(SphereCollider* other, float margin, ContactManifold& m);
+        virtual bool generateContacts(AABBCollider* other, float margin, ContactManifold& m) { return false; }
+        virtual bool generateContacts(TilemapCollider* other, float margin, ContactManifold& m) { return false; }
+        virtual bool generateContacts(MeshCollider* other, float margin, ContactManifold& m) { return false; }
+
+    private:
+        std::shared_ptr<MeshBVH> bvh;   // 作った後は書き換えないので、Instantiate したものと共有する
+
+        // ワールド空間の bounds を覆うローカル座標の箱
+        Bounds toLocalBounds(const Bounds& bounds) const;
+
+        // bounds と重なる三角形ごとに f(ワールド座標の頂点 a, b, c) を呼ぶ
+        // f が true を返したらそこで打ち切って true を返す
+        template<typename F>
+        bool forEachTriangle(const Bounds& bounds, F&& f) const;
     };
 
 
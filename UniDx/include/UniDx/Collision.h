@@ -8,6 +8,7 @@ namespace UniDx
 
 class Collider;
 class Component;
+class CharacterController;
 
 
 // --------------------
@@ -42,4 +43,34 @@ struct RaycastHit
     float distance = 0.0f;
 };
 
+
+// --------------------
+// CharacterController::Move() でぶつかった相手の情報
+// --------------------
+struct ControllerColliderHit
+{
+    CharacterController* controller = nullptr;
+    Collider* collider = nullptr;
+    Vector3 point = Vector3::zero;
+    Vector3 normal = Vector3::zero;
+    Vector3 moveDirection = Vector3::zero;  // ぶつかったときに動かしていた向き
+    float moveLength = 0.0f;                // ぶつかる前に動かそうとしていた残りの距離
+};
+
+
+// --------------------
+// レイ
+// --------------------
+// direction は正規化しない。距離は direction の長さを単位とする
+struct Ray
+{
+    Vector3 origin = Vector3::zero;
+    Vector3 direction = Vector3::forward;
+
+    Ray() {}
+    Ray(Vector3 o, Vector3 d) : origin(o), direction(d) {}
+
+    Vector3 GetPoint(float distance) const { return origin + direction * distance; }
+};
+
 } // namespace UniDx
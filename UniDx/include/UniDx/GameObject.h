@@ -12,6 +12,7 @@
 #include "Object.h"
 #include "Collision.h"
 #include "Scene.h"
+#include "ParallelCommandBuffer.h"
 
 namespace UniDx {
 
@@ -98,8 +99,19 @@ public:
 
     /// @brief コンポーネントを生成してアタッチする
     /// GameObjectがアクティブシーンに接続済みなら、その場で Awake() / OnEnable() が呼ばれる
+    /// ParallelUpdate() の中では生成だけ行い、アタッチは並列のフェーズが終わってから
     template<typename T, typename... Args>
     T* AddComponent(Args&&... args) {
+        if (ParallelCommandBuffer::isRecording()) {
+            static_assert(std::is_base_of_v<Component, T>, "T must be a Component");
+            auto comp = std::make_unique<T>(std::forward<Args>(args)...);
+            comp->template registerCopyConstructor<T>();
+            comp->gameObject = this;
+            T* ptr = comp.get();
+            ParallelCommandBuffer::addComponent(this, std::move(comp));
+            return ptr;
+        }
+
         T* ptr = attachComponent<T>(std::forward<Args>(args)...);
 
         // アクティブシーンに接続済みなら、その場でAwake()/OnEnable()を呼ぶ
@@ -137,6 +149,7 @@ public:
     virtual void onCollisionEnter(const Collision& collision);
     virtual void onCollisionStay(const Collision& collision);
     virtual void onCollisionExit(const Collision& collision);
+    virtual void onControllerColliderHit(const ControllerColliderHit& hit);
 
 protected:
     /// @brief コンポーネントを生成してアタッチするだけで Awake() は呼ばない
@@ -164,6 +177,7 @@ private:
     void cloneTo(GameObject& destination) const;
 
     friend void Destroy(GameObject*);
+    friend class ParallelCommandBuffer;
     friend GameObject* Instantiate(const GameObject& original, Transform* parent);
 };
 
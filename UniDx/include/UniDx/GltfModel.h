@@ -20,6 +20,9 @@ public:
 
     const std::unordered_map<int, std::shared_ptr<Material>>& GetMaterials() { return materials; }
 
+    // 読み込んだメッシュ（model->meshesの順）。MeshCollider::Bake() に渡して BVH を作れる
+    const std::vector< std::shared_ptr<Mesh> >& GetMeshes() const { return meshes; }
+
     /**
      * @brief glTF形式のモデルファイルを読み込む（モデルファイル、シェーダを指定）
      * glb 内包テクスチャが存在する場合は、baseColorTexture を生成してマテリアルに設定する
@@ -0,0 +1,139 @@
+﻿#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "Singleton.h"
+
+
+namespace UniDx
+{
+
+class JobCounter;
+
+
+// --------------------
+// JobSystem
+// --------------------
+// コアごとのワーカースレッドでジョブを実行する
+// スレッドごとに work-stealing の両端キューを持ち、自分のキューが空になったらほかのキューから盗む
+// メインスレッドもキューを持ち、wait() で待つ間はジョブを実行して手伝う
+class JobSystem : public Singleton<JobSystem>
+{
+public:
+    typedef std::function<void()> JobFunc;
+
+    // create() で作るワーカースレッドの数。0 以下ならコア数 - 1
+    static inline int workerThreadCount = 0;
+
+    JobSystem();
+    ~JobSystem();
+
+    // job を実行する。終わったら counter を1減らす
+    // dependency を渡すと、dependency が 0 になってから始める
+    void run(JobFunc job, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+
+    // counter が 0 になるまで、ジョブを実行しながら待つ
+    void wait(JobCounter& counter);
+
+    // f(i) を [begin, end) のすべての i について、batchSize 個ずつのジョブに分けて実行し、終わるまで待つ
+    // batchSize が 0 以下ならスレッド数から決める
+    // JobSystem を作っていなければ、呼んだスレッドで順に実行する
+    template<typename F>
+    static void parallelFor(int begin, int end, int batchSize, F&& f);
+
+    int getWorkerCount() const { return int(threads.size()); }
+
+private:
+    struct Job
+    {
+        JobFunc func;
+        JobCounter* counter;
+    };
+    struct Queue;
+    friend class JobCounter;
+
+    std::vector<std::unique_ptr<Queue>> queues; // 0 はメインスレッド、1 からワーカースレッド
+    std::vector<std::thread> threads;
+
+    // キューを持たないスレッドから積んだジョブ
+    std::mutex injectMutex;
+    std::deque<Job*> injected;
+
+    std::atomic<int> pendingJobs = 0;       // キューに入っているジョブの数
+    std::atomic<int> sleepingWorkers = 0;
+    std::atomic<bool> quit = false;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    void push(Job* job);
+    Job* take();
+    bool runOne();
+    void execute(Job* job);
+    void finish(JobCounter* counter);
+    void workerMain(int index);
+};
+
+
+// --------------------
+// JobCounter
+// --------------------
+// 終わっていないジョブの数。JobSystem::run() で増え、ジョブが終わると減る
+// JobSystem::wait() から戻るまで破棄しない。dependency に渡したときは、待っているジョブが始まるまで破棄しない
+class JobCounter
+{
+public:
+    JobCounter() {}
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    bool isDone() const { return count.load(std::memory_order_acquire) == 0; }
+    int getCount() const { return count.load(std::memory_order_acquire); }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> count = 0;
+    std::mutex mutex;
+    std::vector<JobSystem::Job*> waiting;   // これが 0 になるのを待っているジョブ
+};
+
+
+template<typename F>
+void JobSystem::parallelFor(int begin, int end, int batchSize, F&& f)
+{
+    if (begin >= end) return;
+
+    JobSystem* jobs = getInstance();
+    const int count = end - begin;
+    const int threadCount = jobs != nullptr ? jobs->getWorkerCount() + 1 : 1;
+    if (batchSize <= 0)
+    {
+        // スレッドあたり4つほどに分けて、重さのばらつきを盗んでならす
+        batchSize = std::max(1, count / (threadCount * 4));
+    }
+    if (threadCount == 1 || count <= batchSize)
+    {
+        for (int i = begin; i < end; ++i) f(i);
+        return;
+    }
+
+    // 最初の範囲は呼んだスレッドで実行し、残りをジョブにする
+    JobCounter counter;
+    for (int b = begin + batchSize; b < end; b += batchSize)
+    {
+        const int e = std::min(b + batchSize, end);
+        jobs->run([&f, b, e]() { for (int i = b; i < e; ++i) f(i); }, &counter);
+    }
+    for (int i = begin; i < begin + batchSize; ++i) f(i);
+    jobs->wait(counter);
+}
+
+}
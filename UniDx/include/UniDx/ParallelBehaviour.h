@@ -0,0 +1,38 @@
+﻿/**
+ * @file ParallelBehaviour.h
+ * @brief ワーカースレッドで並列に更新できる Behaviour
+ */
+#pragma once
+
+#include <atomic>
+
+#include "Behaviour.h"
+
+namespace UniDx {
+
+/// @brief ParallelUpdate() をワーカースレッドで並列に呼ぶ Behaviour
+/// 全オブジェクトの ParallelUpdate() をまとめて並列に呼んでから、いつもの Update() を直列に呼ぶ
+/// ParallelUpdate() では共有の状態は読むだけにして、書き込むのは自分のメンバだけにすること
+/// AddComponent()、Destroy()、Instantiate()、SetParent() は ParallelCommandBuffer に積まれ、並列のフェーズが終わってから行われる
+/// そのため AddComponent() で返るコンポーネントは、フェーズが終わるまで GetComponent() では見つからない
+/// Transform と Physics のクエリはフェーズの前に更新してあるので、読むだけなら並列に呼んでよい
+/// Transform への書き込みは同じ Transform を読むほかのスレッドと競合するので、結果はメンバに置いて Update() で書き込むこと
+/// Physics::SyncTransforms() はフェーズの中では呼べない
+class ParallelBehaviour : public Behaviour
+{
+public:
+    ParallelBehaviour() { instanceCount_++; }
+    ParallelBehaviour(const ParallelBehaviour& source) : Behaviour(source) { instanceCount_++; }
+    virtual ~ParallelBehaviour() { instanceCount_--; }
+
+    virtual void ParallelUpdate() {}
+
+    /// @brief 今ある ParallelBehaviour の数。0 なら PlayerLoop は並列のフェーズを丸ごと飛ばす
+    static int getInstanceCount() { return instanceCount_; }
+
+private:
+    // 並列のフェーズの中の AddComponent() でも作られるので atomic にする
+    static inline std::atomic<int> instanceCount_ = 0;
+};
+
+} // namespace UniDx
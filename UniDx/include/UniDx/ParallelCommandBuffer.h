@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+
+namespace UniDx
+{
+
+class GameObject;
+class Component;
+class Transform;
+
+
+// --------------------
+// ParallelCommandBuffer
+// --------------------
+// ParallelBehaviour::ParallelUpdate() を並列に呼んでいる間の、階層やコンポーネントを変える操作の記録
+// AddComponent()、Destroy()、Instantiate()、Transform::SetParent() は記録中ならその場では行わずここへ積む
+// ただしシーンにつながっていない階層の中で親を設定するとき（Instantiate() で複製した子など）はその場で行う
+// 並列のフェーズが終わったらメインスレッドで、呼んだ Behaviour の順（直列に呼んだときと同じ順）に適用する
+class ParallelCommandBuffer
+{
+public:
+    // ParallelUpdate() を並列に呼んでいる間か
+    static bool isRecording() { return recording_.load(std::memory_order_acquire); }
+
+    // 記録を始める。メインスレッドから呼ぶ
+    static void begin();
+
+    // このスレッドでこれから記録するコマンドの順番。並列に呼ぶ Behaviour の番号を渡す
+    static void setOrder(int order);
+
+    // 記録を終えて、積んだコマンドを順番どおりに適用する。メインスレッドから呼ぶ
+    static void end();
+
+    static void destroy(GameObject* gameObject);
+    static void destroy(Component* component);
+    static void addComponent(GameObject* gameObject, std::unique_ptr<Component> component);
+    static void setParent(std::unique_ptr<GameObject> gameObject, Transform* newParent);
+    static void setParent(Transform* transform, Transform* newParent);
+
+private:
+    enum class Kind
+    {
+        DestroyGameObject,
+        DestroyComponent,
+        AddComponent,
+        SetParentNew,       // 親のいない GameObject をつなぐ（Instantiate()）
+        SetParent,          // 親を付け替える
+    };
+
+    struct Command
+    {
+        int order;
+        Kind kind;
+        GameObject* gameObject = nullptr;
+        Component* component = nullptr;
+        Transform* transform = nullptr;
+        Transform* newParent = nullptr;
+        std::unique_ptr<Component> newComponent;
+        std::unique_ptr<GameObject> newGameObject;
+    };
+
+    static inline std::atomic<bool> recording_ = false;
+    static inline std::mutex mutex_;
+    static inline std::vector<Command> commands_;
+
+    static void record(Command&& command);
+    static void apply(Command& command);
+};
+
+}
@@ -2,7 +2,9 @@
 
 #include <vector>
 #include <array>
-#include <map>
+#include <span>
+#include <limits>
+#include <functional>
 
 #include "Property.h"
 #include "Singleton.h"
@@ -14,29 +16,104 @@ namespace UniDx
 
 class Collider;
 class Rigidbody;
+class Transform;
 class PhysicsShape;
 
 
+// --------------------
+// PhysicsHandle
+// --------------------
+// Physics に登録した Rigidbody・コライダーの場所を引くハンドル
+// 表の番号は使い回すので、登録を解除したあとの古いハンドルは世代が合わずに無効になる
+struct PhysicsHandle
+{
+    static constexpr uint32_t invalidIndex = ~0u;
+
+    uint32_t index = invalidIndex;
+    uint32_t generation = 0;
+
+    // 表の番号の順。使い回した番号は世代で分ける。登録の順に決まるので、実行ごとに変わらない
+    bool operator<(const PhysicsHandle& other) const
+    {
+        return index != other.index ? index < other.index : generation < other.generation;
+    }
+    bool operator==(const PhysicsHandle& other) const = default;
+};
+
+
 struct Contact
 {
-//    Vector3 point;
+    Vector3 point;
     Vector3 normal;     // from A to B
-    float   penetration;
+    float   penetration;    // 負のときは離れている距離
+
+    // ソルバで使う値。インパルスは前のステップから引き継いでウォームスタートする
+    float   normalImpulse = 0.0f;
+    Vector3 tangentImpulse = Vector3::zero;
+    float   velocityBias = 0.0f;   // 法線方向の相対速度の目標
 };
 
 struct ContactManifold
 {
     PhysicsShape* a;
     PhysicsShape* b;
+    Collider* colliderA;
+    Collider* colliderB;
+    PhysicsHandle handleA;  // 前のステップの接触を探すキー。handleA < handleB にそろえる
+    PhysicsHandle handleB;
     std::array<Contact, 4> contacts;  // 1〜4点
     int numContacts;
+
+    // ソルバで使う値
+    int bodyA;
+    int bodyB;
+    float friction;
 };
 
 class AABBGeometory;
 class SpheresGeometory;
 class CapsulesGeometory;
 class BoxGeometory;
-class PhysicsGrid;
+class Broadphase;
+class StaticAABBTree;
+class NarrowphaseBatch;
+class PhysicsSlotMap;
+
+
+// ブロードフェーズの種類
+enum class BroadphaseType
+{
+    BruteForce, // 総当たり
+    Grid,       // 階層グリッド。サイズのそろった Shape が多いとき
+    AABBTree,   // 動的AABB木。Shape のサイズがばらつくとき
+    SweepAndPrune, // 端点ソート。動きが一方向にそろっているとき
+};
+
+
+// ナローフェーズで形状の組み合わせごとにまとめて判定するための形状の種類
+// Other は Collider の仮想関数で判定する
+enum class ShapeType : uint8_t
+{
+    Other,
+    Sphere,
+    AABB,
+};
+
+
+// 衝突の解き方
+enum class SolverType
+{
+    PositionCorrection, // 位置補正法。simulatePositionCorrection()
+    SequentialImpulse,  // 逐次インパルス法。simulate()
+};
+
+
+// Rigidbody の衝突の調べ方
+enum class CollisionDetectionMode
+{
+    Discrete,   // ステップの終わりの位置で重なりを調べる
+    Continuous, // 球のコライダーを移動の経路に沿って調べ、ぶつかる位置で止める。速く動くものがすり抜けない
+};
 
 
 // --------------------
@@ -53,6 +130,13 @@ public:
 
     explicit PhysicsActor(Rigidbody* rigidbody) : rigidbody_(rigidbody) {}
 
+    PhysicsHandle handle;   // 登録先の表でのハンドル
+    int island = -1;    // スリープ判定で使う島の番号。スリープしない Rigidbody は -1
+    int solverBody = 0; // simulate() のソルバでの剛体の番号
+    float timeOfImpact = 1.0f;  // 連続衝突判定で求めた、このステップの移動のうち進める割合
+    bool immovable = false;     // このステップで動かない。積分・移動・Transform への反映を飛ばす
+    bool moving = false;        // このステップで速度か移動の指定がある。触れているスリープ中の島を起こす
+
     Rigidbody* getRigidbody() const { return rigidbody_; }
     bool isValid() const { return rigidbody_ != nullptr; }
     void setInvalid() { rigidbody_ = nullptr; }
@@ -88,6 +172,47 @@ private:
 };
 
 
+// --------------------
+// CorrectionBuffer
+// --------------------
+// ナローフェーズで生じた補正の記録
+// Collider::checkIntersect() は PhysicsActor を直接書き換えずにここへ記録し、あとで決まった順に適用する
+class CorrectionBuffer
+{
+public:
+    void addCorrectPosition(PhysicsActor* actor, Vector3 vec) { if (actor != nullptr) records_.push_back({ actor, vec, false }); }
+    void addCorrectVelocity(PhysicsActor* actor, Vector3 vec) { if (actor != nullptr) records_.push_back({ actor, vec, true }); }
+
+    void clear() { records_.clear(); }
+    size_t size() const { return records_.size(); }
+
+    // 記録した順に PhysicsActor へ適用する
+    void apply() const
+    {
+        for (const auto& r : records_)
+        {
+            if (r.velocity)
+            {
+                r.actor->addCorrectVelocity(r.vec);
+            }
+            else
+            {
+                r.actor->addCorrectPosition(r.vec);
+            }
+        }
+    }
+
+private:
+    struct Record
+    {
+        PhysicsActor* actor;
+        Vector3 vec;
+        bool velocity;
+    };
+    std::vector<Record> records_;
+};
+
+
 // --------------------
 // PhysicsShape
 // --------------------
@@ -97,23 +222,80 @@ public:
     void initialize(Collider* collider);
 
     Bounds moveBounds;  // コライダーの bounds に移動量を広げた範囲
-    PhysicsActor* actor;
+    PhysicsActor* actor;    // ステップの始めに Rigidbody から引き直す
+    PhysicsHandle handle;   // 登録先の表でのハンドル
+    int proxyId = -1;   // ブロードフェーズ内での登録先のハンドル
+    uint32_t layerBit = 1;          // コライダーのレイヤーのビット
+    uint32_t collisionMask = ~0u;   // 衝突するレイヤーのビットマスク
+
+    // 形状の種類と、種類ごとのプール（SpheresGeometory など）での番号
+    ShapeType shapeType = ShapeType::Other;
+    int geometory = -1;
+
+    // レイヤーの組み合わせで衝突しうるか
+    bool canCollide(const PhysicsShape& other) const { return (collisionMask & other.layerBit) != 0; }
 
     Collider* getCollider() const { return collider_; }
     bool isValid() const { return collider_ != nullptr; }
     void setInvalid() { collider_ = nullptr; }
     void initOtherNew() { triggersNew_.clear(); collisionsNew_.clear(); }
-    void addCollide(const Collision& col) { collisionsNew_.push_back(col); }
-    void addTrigger(Collider* other) { triggersNew_.push_back(other); }
-    void collideCallback();
+    void addCollide(const PhysicsShape& other, const Collision& col) { collisionsNew_.push_back({ other.handle, col }); }
+    void addTrigger(const PhysicsShape& other) { triggersNew_.push_back({ other.handle, other.getCollider() }); }
+    void collideCallback(std::span<Collider* const> sleepingColliders);
 
 private:
     Collider* collider_;
 
-    std::vector<Collision> collisions_;
-    std::vector<Collision> collisionsNew_;
-    std::vector<Collider*> triggers_;
-    std::vector<Collider*> triggersNew_;
+    // 相手の Shape のハンドルの順に並べる。コライダーのアドレスの順だとコールバックの順が実行ごとに変わる
+    // 相手が登録を解除するとコライダーのハンドルは無効になるので、見つけたときのハンドルを持っておく
+    struct TriggerContact
+    {
+        PhysicsHandle handle;
+        Collider* collider;
+    };
+    struct CollisionContact
+    {
+        PhysicsHandle handle;
+        Collision collision;
+    };
+    std::vector<CollisionContact> collisions_;
+    std::vector<CollisionContact> collisionsNew_;
+    std::vector<TriggerContact> triggers_;
+    std::vector<TriggerContact> triggersNew_;
+};
+
+
+// --------------------
+// PhysicsStats
+// --------------------
+// 直近の1ステップの計測値
+struct PhysicsStats
+{
+    int steps = 0;                  // 計測したステップ数の累計
+    int dynamicShapes = 0;
+    int staticShapes = 0;
+    int actors = 0;
+    int sleepingActors = 0;         // スリープ中の Rigidbody
+    int immovableActors = 0;        // 動かないので積分を飛ばした Rigidbody
+    int potentialPairs = 0;         // ブロードフェーズで残ったペア
+    int potentialTriggerPairs = 0;
+    int collisions = 0;             // 実際に当たったペア
+    int triggers = 0;
+    int continuousClamps = 0;       // 連続衝突判定で移動を止めた Rigidbody
+    int transformWrites = 0;        // 解いた姿勢を Transform に書き込んだ Rigidbody
+    size_t broadphaseBytes = 0;     // ブロードフェーズが確保しているメモリの目安
+
+    // 区間ごとの時間（ミリ秒）
+    double initializeMs = 0.0;
+    double broadphaseUpdateMs = 0.0;
+    double broadphasePairsMs = 0.0;
+    double narrowphaseMs = 0.0;
+    double solveMs = 0.0;
+    double callbackMs = 0.0;
+    double totalMs = 0.0;
+
+    // JSON 形式の文字列にする
+    u8string toJson() const;
 };
 
 
@@ -126,39 +308,211 @@ public:
     typedef std::pair<PhysicsShape*, PhysicsShape*> PotentialPair;
 
     static inline float gravity = -9.81f;
+    static constexpr int layerCount = 32;
+
+    // Rigidbody が静止したまま、この時間（秒）が過ぎるとスリープする
+    static inline float timeToSleep = 0.5f;
+
+    // simulate() のソルバの設定
+    static inline int velocityIterations = 6;       // 速度の拘束を解く反復回数
+    static inline int positionIterations = 2;       // めり込みを戻す反復回数
+    static inline bool warmStarting = true;         // 前のステップのインパルスから解き始める
+    static inline float contactOffset = 0.01f;      // この距離まで近づいたら接触として扱う
+    static inline float bounceThreshold = 2.0f;     // これより遅くぶつかったときは跳ね返らない
+
+    // 解いた位置が前回 Transform に書いた位置からこれ以内なら書き込まない
+    static inline float transformWriteTolerance = 1e-5f;
 
     Physics();
+    ~Physics();
 
-    void simulate(float setp);
+    // 逐次インパルス法による物理計算。接触をステップ間で覚えてウォームスタートする
+    void simulate(float step);
     void simulatePositionCorrection(float step);
 
+    // solverType に応じて simulate() か simulatePositionCorrection() を呼ぶ
+    void simulateStep(float step);
+
+    SolverType solverType = SolverType::PositionCorrection;
+
     void registerRigidbody(Rigidbody* rigidbody);
     void unregisterRigidbody(Rigidbody* rigidbody);
     void register3d(Collider* collider);
     void unregister3d(Collider* collider);
 
+    // クエリで調べるコライダーを選ぶ関数。true を返したものだけを含める
+    typedef std::function<bool(const Collider*)> ColliderFilter;
+
+    // RaycastBatch でこれより少ないレイは1スレッドで処理する
+    int raycastBatchThreshold = 32;
+
+    // simulatePositionCorrection() のナローフェーズで1つのジョブが受け持つペアの数
+    // ペアがこれより少なければ1スレッドで処理する
+    int narrowphaseBatchSize = 256;
+
+    // クエリ用にブロードフェーズの境界を今のコライダーの位置に合わせる
+    // ステップの間に Transform を動かして、次のステップの前にクエリするときに呼ぶ
+    // クエリの状態を書き換えるので ParallelBehaviour::ParallelUpdate() の中では呼べない
+    void SyncTransforms();
+
+    // ステップ後にまだ合わせていなければ SyncTransforms() する
+    // 並列のフェーズの前に呼んでおくと、その中のクエリは読むだけになる
+    void syncTransformsIfNeeded() { if (!querySynced) SyncTransforms(); }
+
     /**
      * @brief origin, direction, maxDistance, filter (デフォルト nullptr => 全て含める)
+     * ブロードフェーズで候補を絞り、候補のコライダーを今の位置で判定する
+     * ステップ後の最初のクエリでブロードフェーズの境界を今の位置に合わせる
      * @return コライダーにヒットしたとき true
      */
     bool Raycast(Vector3 origin, Vector3 direction, float maxDistance,
-        RaycastHit* hitInfo = nullptr, std::function<bool(const Collider*)> filter = nullptr);
+        RaycastHit* hitInfo = nullptr, ColliderFilter filter = nullptr);
+
+    // レイが当たるすべてのコライダーを近い順に返す
+    std::vector<RaycastHit> RaycastAll(Vector3 origin, Vector3 direction, float maxDistance, ColliderFilter filter = nullptr);
+
+    // 半径 radius の球を動かして最初に当たるコライダーを調べる
+    bool SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance,
+        RaycastHit* hitInfo = nullptr, ColliderFilter filter = nullptr);
+
+    // 球の中心 point1, point2 と半径 radius のカプセルを動かして最初に当たるコライダーを調べる
+    // 始点で重なっている相手には当たらない
+    bool CapsuleCast(Vector3 point1, Vector3 point2, float radius, Vector3 direction, float maxDistance,
+        RaycastHit* hitInfo = nullptr, ColliderFilter filter = nullptr);
+
+    /**
+     * @brief rays をまとめてレイキャストし、hits[i] に rays[i] の結果を入れる。当たらなかったものは collider が nullptr
+     * レイは複数スレッドに分けて処理するので、filter は複数スレッドから同時に呼ばれる
+     * @return ヒットしたレイの数
+     */
+    int RaycastBatch(std::span<const Ray> rays, std::span<RaycastHit> hits,
+        float maxDistance = std::numeric_limits<float>::infinity(), ColliderFilter filter = nullptr);
+
+    // center から radius 以内に重なるコライダーを返す
+    std::vector<Collider*> OverlapSphere(Vector3 center, float radius, ColliderFilter filter = nullptr);
+
+    // OverlapSphere の結果を results に書き込み、書き込んだ数を返す。入りきらない分は捨てる
+    int OverlapSphereNonAlloc(Vector3 center, float radius, std::span<Collider*> results, ColliderFilter filter = nullptr);
+
+    // center を中心に各軸 halfExtents の範囲の箱（回転なし）と重なるコライダーを返す
+    std::vector<Collider*> OverlapBox(Vector3 center, Vector3 halfExtents, ColliderFilter filter = nullptr);
+
+    // OverlapBox の結果を results に書き込み、書き込んだ数を返す。入りきらない分は捨てる
+    int OverlapBoxNonAlloc(Vector3 center, Vector3 halfExtents, std::span<Collider*> results, ColliderFilter filter = nullptr);
 
     void checkBounds(PhysicsShape* shape1, PhysicsShape* shape2);
 
+    // layer1 と layer2 のコライダー同士の衝突を無視するか設定する
+    static void IgnoreLayerCollision(int layer1, int layer2, bool ignore = true);
+    static bool GetIgnoreLayerCollision(int layer1, int layer2);
+
+    // layer と衝突するレイヤーのビットマスク
+    static uint32_t GetLayerCollisionMask(int layer) { return layerCollisionMasks[layer]; }
+
+    // ブロードフェーズを切り替える
+    void setBroadphaseType(BroadphaseType type);
+    BroadphaseType getBroadphaseType() const { return broadphaseType; }
+
+    // 動くShapeのブロードフェーズ。設定を変えたり中を調べたりするときは private の Broadphase.h などを使う
+    Broadphase* getBroadphase() const { return broadphase.get(); }
+
+    // 直近のステップの計測値
+    const PhysicsStats& getStats() const { return stats; }
+
 private:
+    // レイヤー同士の衝突マトリクス。layerCollisionMasks[a] のビット b が立っていれば a と b は衝突する
+    static inline std::array<uint32_t, layerCount> layerCollisionMasks = []
+    {
+        std::array<uint32_t, layerCount> masks;
+        masks.fill(~0u);
+        return masks;
+    }();
+
     std::vector<PotentialPair> potentialPairs;
     std::vector<PotentialPair> potentialPairsTrigger;
 
-    std::vector<ContactManifold> manifolds;
+    // ナローフェーズのジョブごとの出力。ジョブはペアを連続した範囲で受け持つので、
+    // ジョブの順に適用すれば1スレッドで回したときと同じ順になる
+    struct NarrowphaseJob
+    {
+        std::unique_ptr<NarrowphaseBatch> batch;
+        CorrectionBuffer corrections;
+        std::vector<int> hits;  // 当たったペアの番号
+    };
+    std::vector<NarrowphaseJob> narrowphaseJobs;
 
-    std::map<Rigidbody*, PhysicsActor> physicsActors;
-    std::vector<PhysicsShape> physicsShapes;
-    std::unique_ptr<PhysicsGrid> physicsGrid;
+    // simulate() の作業領域。manifolds は前のステップの分を prevManifolds に残してウォームスタートに使う
+    struct SolverBody
+    {
+        Vector3 velocity;
+        Vector3 move;           // このステップの移動量
+        Vector3 correction;     // めり込みを戻す位置の補正量
+        float invMass;          // 動かないものは 0
+    };
+    std::vector<ContactManifold> manifolds;
+    std::vector<ContactManifold> prevManifolds;
+    std::vector<SolverBody> solverBodies;
+
+    // スリープ判定の作業領域
+    std::vector<std::pair<PhysicsActor*, PhysicsActor*>> contactActors;
+    std::vector<PhysicsActor*> islandActors;
+    std::vector<int> islandParent;
+    std::vector<float> islandSleepTime;
+    std::vector<Collider*> sleepingColliders;
+
+    // Transform への書き込み。親ごとにまとめるため、階層の深さと親で並べる
+    struct TransformWrite
+    {
+        int depth;
+        Transform* parent;
+        Rigidbody* rigidbody;
+    };
+    std::vector<TransformWrite> transformWrites;
+
+    // Rigidbody とコライダーは密な配列に入れ、ハンドルから表で場所を引く
+    // 登録の解除は末尾と入れ替えて詰める。Shape はブロードフェーズが指しているので、詰めるのは次のステップの始め
+    std::vector<PhysicsActor> physicsActors;
+    std::vector<PhysicsShape> physicsShapes;  // 動くShape
+    std::vector<PhysicsShape> staticShapes;   // 動かないShape。staticTree で管理する
+    std::unique_ptr<PhysicsSlotMap> actorSlots;
+    std::unique_ptr<PhysicsSlotMap> shapeSlots; // group は dynamicGroup か staticGroup
+    BroadphaseType broadphaseType;
+    std::unique_ptr<Broadphase> broadphase;
+    std::unique_ptr<StaticAABBTree> staticTree;
+
+    // 形状の種類ごとのデータをワールド座標で詰めて持つ
+    // ステップの始めと SyncTransforms() でコライダーから書き込む
+    std::unique_ptr<SpheresGeometory> spheres;
+    std::unique_ptr<AABBGeometory> aabbs;
+    PhysicsStats stats;
+    bool queryDirty; // ステップ後にShapeの配列が変わり、ブロードフェーズの参照が使えない
+    bool querySynced; // ブロードフェーズの境界がステップ後の位置に合っている
+    std::vector<std::vector<std::pair<float, PhysicsShape*>>> batchCandidates;
 
     void initializeSimulate(float step);
-    void solveVelocityConstraint(Rigidbody* A, Rigidbody* B, const ContactManifold& m);
-    void solvePositionConstraint(Rigidbody* A, Rigidbody* B, const ContactManifold& m);
+    void initializeShape(PhysicsShape& shape, float step);
+    void compactShapes(std::vector<PhysicsShape>& shapes, int group);
+    PhysicsShape* findShape(PhysicsHandle handle);
+    void classifyShapes(float step);
+    static bool isStaticShape(const PhysicsShape& shape, float step);
+    void writeGeometory(PhysicsShape& shape, const Bounds& bounds);
+    static bool canSleep(const Rigidbody* rigidbody);
+    void updateSleep(float step);
+    void clampContinuousMotion(float step);
+    void writeTransforms();
+    void raycastShapes(Vector3 origin, Vector3 direction, float radius, float maxDistance,
+        const std::function<float(PhysicsShape*, float, float)>& func);
+    void overlapColliders(const Bounds& bounds, const ColliderFilter& filter,
+        const std::function<bool(Collider*)>& test, const std::function<bool(Collider*)>& output);
+    int checkTriggers();
+    int checkCollisions();
+    void updateStats(int collisionCount, int triggerCount);
+    void invokeCallbacks();
+    void gatherManifolds();
+    void prepareSolver(float step);
+    void warmStart(ContactManifold& m);
+    void solveVelocityConstraint(ContactManifold& m);
+    void solvePositionConstraint(const ContactManifold& m);
 };
 
 }
@@ -15,6 +15,7 @@ namespace UniDx
 class GameObject;
 class Camera;
 class Canvas;
+class ParallelBehaviour;
 
 /**
  * @brief フレームワーク全体のループ処理を行うクラス。
@@ -45,6 +46,7 @@ protected:
     virtual void fixedUpdate();
     virtual void physics();
     virtual void input();
+    virtual void parallelUpdate();
     virtual void update();
     virtual void lateUpdate();
     virtual void render();
@@ -53,12 +55,14 @@ protected:
 
     void fixedUpdate(GameObject* object);
     void checkStart(GameObject* object);
+    void collectParallelBehaviours(GameObject* object);
     void update(GameObject* object);
     void lateUpdate(GameObject* object);
     void render(GameObject* object, const Camera& camera);
 
 private:
     std::vector<Canvas*> canvas_;
+    std::vector<ParallelBehaviour*> parallelBehaviours_;   // このフレームで ParallelUpdate() を呼ぶもの
 
     void createScene();
 };
@@ -34,14 +34,23 @@ public:
 
     bool isKinematic = false;
 
+    // Continuous にすると、球のコライダーが速く動いても薄いコライダーをすり抜けない
+    CollisionDetectionMode collisionDetectionMode = CollisionDetectionMode::Discrete;
+
+    // Physics に登録した PhysicsActor のハンドル。Physics が設定する
+    PhysicsHandle physicsHandle;
+
+    // 質量あたりの運動エネルギーがこれを下回ったまま Physics::timeToSleep 秒たつとスリープする
+    float sleepThreshold = 0.005f;
+
     Rigidbody() :
         position(
             [this]() { return position_; },
-            [this](Vector3 v) { position_ = v; move_ = Vector3::zero; hasMovePos_ = true; }
+            [this](Vector3 v) { position_ = v; move_ = Vector3::zero; hasMovePos_ = true; WakeUp(); }
         ),
         rotation(
             [this]() { return rotation_; },
-            [this](Quaternion q) { rotation_ = q; hasMoveRot_ = true; }
+            [this](Quaternion q) { rotation_ = q; hasMoveRot_ = true; WakeUp(); }
         )
     {
     }
@@ -55,6 +64,8 @@ public:
         gravityScale = source.gravityScale;
         mass = source.mass;
         isKinematic = source.isKinematic;
+        collisionDetectionMode = source.collisionDetectionMode;
+        sleepThreshold = source.sleepThreshold;
     }
 
     // 初期化
@@ -62,6 +73,10 @@ public:
     {
         position_ = transform->position;
         rotation_ = transform->rotation;
+        writtenPosition_ = position_;
+        writtenRotation_ = rotation_;
+        writtenLocalPosition_ = transform->localPosition;
+        writtenLocalRotation_ = transform->localRotation;
     }
 
     virtual void OnEnable() override
@@ -79,6 +94,7 @@ public:
     {
         move_ = pos - position_;
         hasMovePos_ = true;
+        WakeUp();
     }
 
     // 姿勢を指定。補間が有効な場合は間の衝突判定を行う。
@@ -87,11 +103,57 @@ public:
         // TODO:補間は未実装
         rotation_ = rot;
         hasMoveRot_ = true;
+        WakeUp();
+    }
+
+    // スリープ中か。スリープ中は積分せず、動かないShapeとしてブロードフェーズから外れる
+    bool IsSleeping() const { return sleeping_; }
+
+    // このステップで動かないか
+    // 質量が無限大か Kinematic で、速度も位置・姿勢の指定もなく、重力でも動かないもの
+    bool IsImmovable() const
+    {
+        return (isKinematic || mass == std::numeric_limits<float>::infinity())
+            && linearVelocity == Vector3::zero
+            && (gravityScale == 0.0f || Physics::gravity == 0.0f)
+            && !hasMovePos_ && !hasMoveRot_;
+    }
+
+    // スリープさせる
+    void Sleep()
+    {
+        sleeping_ = true;
+        linearVelocity = Vector3::zero;
+        move_ = Vector3::zero;
+    }
+
+    // スリープから起こす
+    void WakeUp()
+    {
+        sleeping_ = false;
+        sleepTime_ = 0.0f;
+    }
+
+    // 静止している時間を step だけ進めて返す。動いていれば 0 に戻す
+    float updateSleepTime(float step)
+    {
+        if (0.5f * linearVelocity.sqrMagnitude() > sleepThreshold)
+        {
+            sleepTime_ = 0.0f;
+        }
+        else
+        {
+            sleepTime_ += step;
+        }
+        return sleepTime_;
     }
 
     // ステップ時間を指定して移動ベクトルを取得
     Vector3 getMoveVector(float step) { return move_ * (Time::fixedDeltaTime > 0 ? step / Time::fixedDeltaTime : 1); }
 
+    // このステップの移動を fraction の割合までに縮める（Physics の連続衝突判定から呼ぶ）
+    void clampMove(float fraction) { move_ *= fraction; }
+
     // 衝突前の物理更新
     // ここで移動量などを設定しておくが、位置や速度の更新はコリジョン処理の後
     virtual void physicsUpdate()
@@ -114,28 +176,88 @@ public:
     // 移動ベクトルを位置に適用
     virtual void applyMove(float step)
     {
-        position_ += getMoveVector(step);
+        const Vector3 move = getMoveVector(step);
+        if (move != Vector3::zero || hasMovePos_ || hasMoveRot_)
+        {
+            position_ += move;
+            transformDirty_ = true;
+        }
 
         move_ = Vector3::zero;
         hasMovePos_ = false;
         hasMoveRot_ = false;
     }
 
-    // 位置と速度の補正を適用してTransformに反映
+    // 衝突で解いた速度の変化を加える。移動ベクトルも同じだけ変える（Physics::simulate() から呼ぶ）
+    void addSolvedVelocity(Vector3 delta, float step)
+    {
+        linearVelocity += delta;
+        move_ += delta * (Time::fixedDeltaTime > 0 ? Time::fixedDeltaTime : step);
+    }
+
+    // 位置と速度の補正を適用
+    // Transform への反映は、このあと Physics がまとめて行う
     virtual void solveCorrection(Bounds correctPosition, Bounds correctVelocity)
     {
         // 位置と速度の補正
-        position_ += correctPosition.min();
-        position_ += correctPosition.max();
+        if (correctPosition.min() != Vector3::zero || correctPosition.max() != Vector3::zero)
+        {
+            position_ += correctPosition.min();
+            position_ += correctPosition.max();
+            transformDirty_ = true;
+        }
 
         linearVelocity += correctVelocity.min();
         linearVelocity += correctVelocity.max();
+    }
 
-        // Transformに位置と姿勢を反映
-        transform->position = position_;
-        transform->rotation = rotation_;
+    // スクリプトが Transform を直接動かしていたら、その姿勢を取り込む
+    // Kinematic は MovePosition() と同じく移動として扱い、途中の相手を押してトリガーにも入る。それ以外は position を指定したのと同じに置き直す
+    // 最後に書いたローカルの姿勢と比べるので、Physics が書いた値のままなら何もしない（Physics::simulate() の始めに呼ぶ）
+    void syncFromTransform()
+    {
+        const Vector3 localPos = transform->localPosition;
+        const Quaternion localRot = transform->localRotation;
+        if (localPos == writtenLocalPosition_ && localRot == writtenLocalRotation_) return;
+
+        const Vector3 worldPos = transform->position;
+        if (isKinematic)
+        {
+            MovePosition(worldPos);
+            MoveRotation(transform->rotation);
+        }
+        else
+        {
+            position = worldPos;
+            rotation = transform->rotation;
+        }
+        writtenPosition_ = worldPos;
+        writtenRotation_ = rotation_;
+        writtenLocalPosition_ = localPos;
+        writtenLocalRotation_ = localRot;
+    }
+
+    // 前回 Transform に書いた姿勢から変わっていて、書き込みが必要か
+    // 位置は tolerance 以内の違いなら書かない。ずれは前回書いた位置からの差なので tolerance を超えて積もらない
+    bool needsTransformWrite(float tolerance) const
+    {
+        if (!transformDirty_) return false;
+        return SqrDistance(position_, writtenPosition_) > tolerance * tolerance || rotation_ != writtenRotation_;
     }
 
+    // Transform にローカルの姿勢 localPos, localRot を書いた（Physics の同期から呼ぶ）
+    void markTransformWritten(Vector3 localPos, Quaternion localRot)
+    {
+        writtenPosition_ = position_;
+        writtenRotation_ = rotation_;
+        writtenLocalPosition_ = localPos;
+        writtenLocalRotation_ = localRot;
+        transformDirty_ = false;
+    }
+
+    // 書かずに済ませた
+    void skipTransformWrite() { transformDirty_ = false; }
+
 private:
     Vector3 position_ = Vector3::zero;
     Quaternion rotation_ = Quaternion::identity;
@@ -143,6 +265,13 @@ private:
 
     bool hasMovePos_ = false;
     bool hasMoveRot_ = false;
+    bool transformDirty_ = false;   // このステップで position_, rotation_ が変わった
+    Vector3 writtenPosition_ = Vector3::zero;   // 最後に Transform に書いた姿勢
+    Quaternion writtenRotation_ = Quaternion::identity;
+    Vector3 writtenLocalPosition_ = Vector3::zero;   // 最後に Transform に書いたローカルの姿勢。外から動かされたかを見る
+    Quaternion writtenLocalRotation_ = Quaternion::identity;
+    bool sleeping_ = false;
+    float sleepTime_ = 0.0f;
 };
 
 
@@ -51,6 +51,14 @@ public:
     /// @brief 子を取得
     Transform* GetChild(size_t index) const;
 
+    /// @brief ローカルの位置と回転をまとめて設定
+    void SetLocalPositionAndRotation(Vector3 pos, Quaternion rot)
+    {
+        localPosition_ = pos;
+        localRotation_ = rot;
+        m_dirty = true;
+    }
+
     /// @brief ローカル座標系から親座標系への変換行列
     const Matrix4x4& localMatrix() const;
 
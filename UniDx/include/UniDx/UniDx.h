@@ -11,8 +11,10 @@
 #include "GameObject_impl.h"
 #include "Random.h"
 #include "Behaviour.h"
+#include "ParallelBehaviour.h"
 #include "Rigidbody.h"
 #include "Collider.h"
+#include "CharacterController.h"
 #include "Camera.h"
 #include "Light.h"
 
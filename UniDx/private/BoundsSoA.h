@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include <vector>
+
+
+// 重なり判定に使う命令セットをコンパイル時に選ぶ
+#if defined(__AVX2__)
+#define UNIDX_BOUNDS_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UNIDX_BOUNDS_SIMD_SSE2 1
+#endif
+
+
+namespace UniDx
+{
+
+// --------------------
+// BoundsSoA
+// --------------------
+// Bounds を中心と半サイズの成分ごとの配列で持ち、1つの Bounds と複数の要素の重なりをまとめて判定する
+// 判定は Bounds::Intersects と同じ式なので、結果も一致する
+class BoundsSoA
+{
+public:
+    void clear();
+    void reserve(size_t size);
+    void push_back(const Bounds& bounds);
+    int size() const { return int(cx.size()); }
+
+    // [begin, end) の要素のうち bounds と重なるものの番号を out に追加する
+    void gatherOverlaps(const Bounds& bounds, int begin, int end, std::vector<int>& out) const;
+
+    // 確保しているバイト数
+    size_t getMemoryUsage() const { return (cx.capacity() + cy.capacity() + cz.capacity() + ex.capacity() + ey.capacity() + ez.capacity()) * sizeof(float); }
+
+    // 使っている命令セットの名前
+    static const char* kernelName();
+
+private:
+    std::vector<float> cx, cy, cz;
+    std::vector<float> ex, ey, ez;
+};
+
+}
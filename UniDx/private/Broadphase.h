@@ -0,0 +1,124 @@
+﻿#pragma once
+
+#include <span>
+#include <functional>
+#include <vector>
+#include <unordered_map>
+
+
+namespace UniDx
+{
+
+class Physics;
+class PhysicsShape;
+
+
+// --------------------
+// Broadphase
+// --------------------
+// 衝突する可能性のあるペアを集める構造の共通インターフェース
+class Broadphase
+{
+public:
+    typedef MemberAction<Physics, PhysicsShape*, PhysicsShape*> CheckBoundFunc;
+
+    // レイキャストで候補のShapeを受け取る関数。引数は Shape、境界に入る距離、今の最大距離
+    // 戻り値の距離より遠い候補は以後渡さない
+    typedef std::function<float(PhysicsShape*, float, float)> RaycastFunc;
+
+    // 範囲クエリで候補のShapeを受け取る関数。false を返すとそこで打ち切る
+    typedef std::function<bool(PhysicsShape*)> QueryFunc;
+
+    explicit Broadphase(CheckBoundFunc checkBoundFunc) : checkBoundF(checkBoundFunc) {}
+    virtual ~Broadphase() {}
+
+    // 登録するShapeを更新。PhysicsShape::proxyId に登録先を記録する
+    virtual void update(std::span<PhysicsShape> shapes) = 0;
+
+    // Shapeを取り除く（PhysicsShape を削除する前に呼ぶ）
+    virtual void remove(PhysicsShape& shape) = 0;
+
+    // 衝突する可能性のあるペアを集めて checkBoundF に渡す
+    virtual void gatherPairs() = 0;
+
+    // 半径 radius だけ太らせたレイと境界が重なるShapeを、できるだけ近い順に func に渡す
+    // 複数スレッドから同時に呼んでよい
+    virtual void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const = 0;
+
+    // 境界が bounds と重なる可能性のあるShapeを func に渡す。打ち切られたら false を返す
+    // 複数スレッドから同時に呼んでよい
+    virtual bool query(const Bounds& bounds, const QueryFunc& func) const = 0;
+
+    // 確保しているメモリのおおよそのバイト数
+    virtual size_t getMemoryUsage() const = 0;
+
+protected:
+    CheckBoundFunc checkBoundF;
+};
+
+
+// ノードの境界は Encapsulate の丸めで僅かに小さくなることがあるので、枝刈りは少し緩めに判定する
+inline bool MayIntersect(const Bounds& nodeBounds, const Bounds& bounds)
+{
+    constexpr float tolerance = 1e-4f;
+    Vector3 d = nodeBounds.Center - bounds.Center;
+    Vector3 e = nodeBounds.extents + bounds.extents;
+    return std::abs(d.x) <= e.x + (e.x + 1.0f) * tolerance
+        && std::abs(d.y) <= e.y + (e.y + 1.0f) * tolerance
+        && std::abs(d.z) <= e.z + (e.z + 1.0f) * tolerance;
+}
+
+// レイ origin + direction * t (0 <= t <= maxDistance) が、boxMin〜boxMax を radius だけ広げた箱を通るか
+// 通るときは箱に入る t を enter に返す。枝刈り用なので丸めの分だけ緩めに判定する
+inline bool RayOverlapsBox(Vector3 origin, Vector3 direction, float radius, float maxDistance,
+    Vector3 boxMin, Vector3 boxMax, float& enter)
+{
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float d[3] = { direction.x, direction.y, direction.z };
+    const float lo[3] = { boxMin.x, boxMin.y, boxMin.z };
+    const float hi[3] = { boxMax.x, boxMax.y, boxMax.z };
+
+    float tMin = 0.0f;
+    float tMax = maxDistance;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!(lo[i] <= hi[i])) return false; // 空の境界
+        const float pad = radius + (hi[i] - lo[i] + std::fabs(lo[i]) + 1.0f) * 1e-4f;
+        const float a = lo[i] - pad;
+        const float b = hi[i] + pad;
+        if (std::fabs(d[i]) < 1e-12f)
+        {
+            if (o[i] < a || b < o[i]) return false;
+            continue;
+        }
+        const float inv = 1.0f / d[i];
+        float t1 = (a - o[i]) * inv;
+        float t2 = (b - o[i]) * inv;
+        if (t1 > t2) std::swap(t1, t2);
+        tMin = std::max(tMin, t1);
+        tMax = std::min(tMax, t2);
+        if (tMin > tMax) return false;
+    }
+    enter = tMin;
+    return true;
+}
+
+inline bool RayOverlapsBounds(Vector3 origin, Vector3 direction, float radius, float maxDistance,
+    const Bounds& bounds, float& enter)
+{
+    return RayOverlapsBox(origin, direction, radius, maxDistance, bounds.min(), bounds.max(), enter);
+}
+
+
+// vector が確保しているバイト数
+template<class T>
+inline size_t CapacityBytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+// unordered_map が確保しているおおよそのバイト数
+template<class K, class V>
+inline size_t CapacityBytes(const std::unordered_map<K, V>& m)
+{
+    return m.size() * (sizeof(std::pair<const K, V>) + sizeof(void*) * 2) + m.bucket_count() * sizeof(void*);
+}
+
+}
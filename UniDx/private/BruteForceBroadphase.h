@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <vector>
+#include <span>
+
+#include "Broadphase.h"
+#include "BoundsSoA.h"
+
+
+namespace UniDx
+{
+
+class PhysicsShape;
+
+
+// --------------------
+// BruteForceBroadphase
+// --------------------
+// すべての組み合わせを調べるブロードフェーズ。Shapeが少ないときや確認用
+// 境界は BoundsSoA に詰めて、1つのShapeと後ろのShapeをまとめて判定する
+class BruteForceBroadphase : public Broadphase
+{
+public:
+    BruteForceBroadphase(CheckBoundFunc checkBoundFunc);
+
+    // 境界を詰め直す
+    void update(std::span<PhysicsShape> shapes) override;
+
+    // 登録先を持たないので何もしない
+    void remove(PhysicsShape& shape) override {}
+
+    // 衝突する可能性のあるペアを集める
+    void gatherPairs() override;
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const override;
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool query(const Bounds& bounds, const QueryFunc& func) const override;
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t getMemoryUsage() const override;
+
+private:
+    std::span<PhysicsShape> shapes;
+    BoundsSoA bounds;
+    std::vector<int> overlapIndices;
+};
+
+}
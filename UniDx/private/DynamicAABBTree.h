@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <vector>
+#include <span>
+
+#include "Broadphase.h"
+
+
+namespace UniDx
+{
+
+class PhysicsShape;
+
+
+// --------------------
+// DynamicAABBTree
+// --------------------
+// Shapeを葉に持つ二分木によるブロードフェーズ
+// 葉の境界は moveBounds を margin だけ太らせておき、はみ出したときだけ入れ直す
+class DynamicAABBTree : public Broadphase
+{
+public:
+    DynamicAABBTree(CheckBoundFunc checkBoundFunc);
+
+    // 葉の境界を moveBounds から各方向に広げる量
+    float margin = 0.1f;
+
+    // 登録するShapeを更新
+    void update(std::span<PhysicsShape> shapes) override;
+
+    // Shapeを木から取り除く（PhysicsShape を削除する前に呼ぶ）
+    void remove(PhysicsShape& shape) override;
+
+    // 衝突する可能性のあるペアを集める
+    void gatherPairs() override;
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const override;
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool query(const Bounds& bounds, const QueryFunc& func) const override;
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t getMemoryUsage() const override;
+
+    // 木の高さ。葉だけなら0
+    int getHeight() const { return root == nullNode ? 0 : nodes[root].height; }
+
+    // 直近の update() で入れ直した葉の数
+    int getReinsertCount() const { return reinsertCount; }
+
+private:
+    static constexpr int nullNode = -1;
+
+    struct TreeNode
+    {
+        Bounds bounds;          // 葉では太らせた境界、枝では子の境界を含む境界
+        PhysicsShape* shape;    // 葉のShape。毎回 update() で張り直す
+        int parent;             // 空きノードでは次の空きノード
+        int child1;
+        int child2;
+        int height;             // 葉は0、空きノードは-1
+        uint32_t layers;        // 部分木に含まれるレイヤーのビット
+        uint32_t collisionMask; // 部分木のShapeが衝突するレイヤーのビット
+
+        bool isLeaf() const { return child1 == nullNode; }
+    };
+
+    std::vector<TreeNode> nodes;
+    int root;
+    int freeList;
+    int reinsertCount;
+    std::vector<std::pair<int, int>> traverseStack;
+
+    int allocateNode();
+    void freeNode(int index);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    void refitAncestors(int index);
+    int balance(int index);
+    void mergeChildren(int index);
+    Bounds fatBounds(const Bounds& moveBounds) const;
+};
+
+}
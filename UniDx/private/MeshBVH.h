@@ -0,0 +1,126 @@
+﻿#pragma once
+
+#include <vector>
+#include <span>
+#include <iosfwd>
+
+#include <UniDx/Bounds.h>
+
+
+namespace UniDx
+{
+
+// --------------------
+// MeshBVH
+// --------------------
+// 三角形メッシュの BVH。MeshCollider がローカル座標で持つ
+// SAH（表面積ヒューリスティック）で分割し、ノードは深さ優先の順に 32 バイトで並べる
+// 作った木はファイルに書き出して、次からは読み込むだけで使える
+class MeshBVH
+{
+public:
+    // 葉に入れる三角形の最大数
+    static constexpr int maxPerLeaf = 4;
+
+    // 32 バイトのノード。左の子はすぐ後ろのノード
+    struct Node
+    {
+        float minX, minY, minZ;
+        uint32_t first;     // 葉では三角形の先頭、枝では右の子のノード番号
+        float maxX, maxY, maxZ;
+        uint32_t count;     // 葉の三角形数。枝では0
+
+        bool isLeaf() const { return count != 0; }
+        Vector3 min() const { return Vector3(minX, minY, minZ); }
+        Vector3 max() const { return Vector3(maxX, maxY, maxZ); }
+    };
+    static_assert(sizeof(Node) == 32);
+
+    // 位置とインデックス（三角形リスト）から作る。indices が空なら位置を3つずつ三角形にする
+    void build(std::span<const Vector3> positions, std::span<const uint32_t> indices);
+
+    // 作り直すかどうかを決めるための、元の位置とインデックスのハッシュ
+    static uint64_t hashSource(std::span<const Vector3> positions, std::span<const uint32_t> indices);
+    uint64_t getSourceHash() const { return sourceHash; }
+
+    // 木を書き出す・読み込む。読み込めなければ false を返して空になる
+    bool save(std::ostream& out) const;
+    bool load(std::istream& in);
+
+    void clear();
+    bool empty() const { return nodes.empty(); }
+
+    int triangleCount() const { return int(triangles.size() / 3); }
+    int nodeCount() const { return int(nodes.size()); }
+
+    // 全体の境界（ローカル座標）
+    Bounds getBounds() const;
+
+    // 三角形 index の頂点（ローカル座標）
+    void getTriangle(int index, Vector3& a, Vector3& b, Vector3& c) const
+    {
+        a = positions[triangles[index * 3]];
+        b = positions[triangles[index * 3 + 1]];
+        c = positions[triangles[index * 3 + 2]];
+    }
+
+    // レイ origin + direction * t (0 <= t <= maxDistance) が最初に当たる三角形を探す。裏面にも当たる
+    bool raycast(Vector3 origin, Vector3 direction, float maxDistance, float& distance, int& triangle) const;
+
+    // 境界が bounds と重なる葉の三角形ごとに f(三角形の番号) を呼ぶ
+    // f が true を返したらそこで打ち切って true を返す
+    template<typename F>
+    bool query(const Bounds& bounds, F&& f) const
+    {
+        if (nodes.empty()) return false;
+        const Vector3 mn = bounds.min();
+        const Vector3 mx = bounds.max();
+
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const uint32_t index = stack[--top];
+            const Node& node = nodes[index];
+            if (node.minX > mx.x || node.maxX < mn.x ||
+                node.minY > mx.y || node.maxY < mn.y ||
+                node.minZ > mx.z || node.maxZ < mn.z) continue;
+
+            if (node.isLeaf())
+            {
+                for (uint32_t i = 0; i < node.count; ++i)
+                {
+                    if (f(int(node.first + i))) return true;
+                }
+                continue;
+            }
+            stack[top++] = node.first;
+            stack[top++] = index + 1;
+        }
+        return false;
+    }
+
+    // 確保しているバイト数
+    size_t getMemoryUsage() const
+    {
+        return positions.capacity() * sizeof(Vector3) + triangles.capacity() * sizeof(uint32_t) + nodes.capacity() * sizeof(Node);
+    }
+
+private:
+    std::vector<Vector3> positions;
+    std::vector<uint32_t> triangles;    // 三角形ごとに頂点番号3つ。葉の順に並べ替えてある
+    std::vector<Node> nodes;
+    uint64_t sourceHash = 0;
+
+    // 作るときだけ使う三角形ごとの境界と重心
+    struct BuildItem
+    {
+        Vector3 min, max, centroid;
+        uint32_t triangle;
+    };
+
+    void buildNode(std::vector<BuildItem>& items, uint32_t nodeIndex, int begin, int end, int depth);
+};
+
+}
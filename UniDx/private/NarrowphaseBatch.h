@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include <vector>
+#include <span>
+
+#include <UniDx/Physics.h>
+#include <BoundsSoA.h>
+
+
+namespace UniDx
+{
+
+class SphereCollider;
+class AABBCollider;
+class SpheresGeometory;
+class AABBGeometory;
+
+
+// --------------------
+// NarrowphaseBatch
+// --------------------
+// 衝突のペアを形状の組み合わせごとに分けてまとめて判定する
+// 組み合わせごとに形状のデータを成分ごとの配列に集め、距離の判定を SIMD でまとめて行う
+// 距離で残ったペアだけ、Collider::checkIntersect() と同じ式で補正を計算する
+class NarrowphaseBatch
+{
+public:
+    typedef std::pair<PhysicsShape*, PhysicsShape*> PotentialPair;
+
+    // pairs の [begin, end) を判定し、補正と当たったペアの番号をペアの順に記録する
+    // 形状のデータは PhysicsShape::geometory の番号で spheres, aabbs から読む
+    void run(std::span<const PotentialPair> pairs, int begin, int end,
+        const SpheresGeometory& spheres, const AABBGeometory& aabbs, CorrectionBuffer& corrections, std::vector<int>& hits);
+
+    // 球と箱の衝突の応答。衝突していれば補正を corrections に記録する
+    // aabb は箱の側のコライダー。TilemapCollider のセルの箱にも使う
+    static bool sphereAABB(SphereCollider* sphere, Vector3 sphereCenter, Collider* aabb, Vector3 boxMin, Vector3 boxMax,
+        PhysicsActor* sphereActor, PhysicsActor* aabbActor, CorrectionBuffer& corrections);
+
+    // 球と、相手の形状の上で球の中心に最も近い点 closest との衝突の応答。衝突していれば補正を corrections に記録する
+    // 中心が closest に重なっているときは fallbackNormal の向きに押し出す
+    static bool sphereClosestPoint(SphereCollider* sphere, Vector3 sphereCenter, Collider* other, Vector3 closest, Vector3 fallbackNormal,
+        PhysicsActor* sphereActor, PhysicsActor* otherActor, CorrectionBuffer& corrections);
+
+    // 球と球の衝突の応答。衝突していれば補正を corrections に記録する
+    static bool sphereSphere(SphereCollider* a, Vector3 centerA, SphereCollider* b, Vector3 centerB,
+        PhysicsActor* actorA, PhysicsActor* actorB, CorrectionBuffer& corrections);
+
+    // 使っている命令セットの名前
+    static const char* kernelName() { return BoundsSoA::kernelName(); }
+
+private:
+    // 球と球のペア
+    struct SphereSphereBucket
+    {
+        std::vector<int> pairs;
+        std::vector<float> ax, ay, az, ar;
+        std::vector<float> bx, by, bz, br;
+
+        void clear();
+        void push_back(int pair, const SpheresGeometory& spheres, int a, int b);
+        int size() const { return int(pairs.size()); }
+    };
+
+    // 球と箱のペア
+    struct SphereAABBBucket
+    {
+        std::vector<int> pairs;
+        std::vector<float> cx, cy, cz, r;
+        std::vector<float> minX, minY, minZ;
+        std::vector<float> maxX, maxY, maxZ;
+
+        void clear();
+        void push_back(int pair, const SpheresGeometory& spheres, int sphere, const AABBGeometory& aabbs, int aabb);
+        int size() const { return int(pairs.size()); }
+    };
+
+    SphereSphereBucket sphereSpheres;
+    SphereAABBBucket sphereAABBs;
+    std::vector<int> others;            // 組み合わせに対応していないペア。仮想関数で判定する
+    std::vector<int> sphereSphereNear;  // 距離で残ったもの（バケット内の番号）
+    std::vector<int> sphereAABBNear;
+
+    void gatherSphereSphere();
+    void gatherSphereAABB();
+};
+
+}
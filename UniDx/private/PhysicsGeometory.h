@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include <vector>
+
+#include <UniDx/Bounds.h>
+#include <UniDx/Collision.h>
+
+
+namespace UniDx
+{
+
+// --------------------
+// SpheresGeometory
+// --------------------
+// 球の形状データをワールド座標で成分ごとの配列に持つ
+// Physics がステップの始めと SyncTransforms() でコライダーから書き込み、ナローフェーズとレイキャストはここを読む
+class SpheresGeometory
+{
+public:
+    void clear();
+
+    // 追加して番号を返す
+    int add(Vector3 center, float radius);
+    void set(int index, Vector3 center, float radius);
+
+    int size() const { return int(cx.size()); }
+    Vector3 center(int index) const { return Vector3(cx[index], cy[index], cz[index]); }
+    float radius(int index) const { return r[index]; }
+
+    // 確保しているバイト数
+    size_t getMemoryUsage() const { return (cx.capacity() + cy.capacity() + cz.capacity() + r.capacity()) * sizeof(float); }
+
+    // 球へのレイキャスト。始点が内部のときは false を返す
+    // hitInfo の collider は呼び出し側で設定する
+    static bool raycast(Vector3 center, float radius, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo);
+    bool raycast(int index, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo) const
+    {
+        return raycast(center(index), r[index], origin, direction, maxDistance, hitInfo);
+    }
+
+private:
+    std::vector<float> cx, cy, cz;
+    std::vector<float> r;
+};
+
+
+// --------------------
+// AABBGeometory
+// --------------------
+// 軸並行の箱の形状データをワールド座標の最小・最大で成分ごとの配列に持つ
+class AABBGeometory
+{
+public:
+    void clear();
+
+    // 追加して番号を返す
+    int add(const Bounds& bounds);
+    void set(int index, const Bounds& bounds);
+
+    int size() const { return int(minX.size()); }
+    Vector3 min(int index) const { return Vector3(minX[index], minY[index], minZ[index]); }
+    Vector3 max(int index) const { return Vector3(maxX[index], maxY[index], maxZ[index]); }
+
+    // 確保しているバイト数
+    size_t getMemoryUsage() const
+    {
+        return (minX.capacity() + minY.capacity() + minZ.capacity() + maxX.capacity() + maxY.capacity() + maxZ.capacity()) * sizeof(float);
+    }
+
+    // 箱へのレイキャスト。始点が内部のときは false を返す
+    // hitInfo の collider は呼び出し側で設定する
+    static bool raycast(Vector3 bmin, Vector3 bmax, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo);
+    bool raycast(int index, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo) const
+    {
+        return raycast(min(index), max(index), origin, direction, maxDistance, hitInfo);
+    }
+
+private:
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+};
+
+}
@@ -6,6 +6,8 @@
 #include <array>
 #include <map>
 
+#include "Broadphase.h"
+
 
 namespace UniDx
 {
@@ -18,46 +20,74 @@ class PhysicsShape;
 // --------------------
 // PhysicsGrid
 // --------------------
-class PhysicsGrid
+class PhysicsGrid : public Broadphase
 {
 public:
     typedef std::pair<PhysicsShape*, PhysicsShape*> PotentialPair;
-    typedef MemberAction<Physics, PhysicsShape*, PhysicsShape*> CheckBoundFunc;
 
     PhysicsGrid(CheckBoundFunc checkBoundFunc);
 
     int nodeDivide = 8;
     int maxPerCell = 16;
 
+    // true のとき、セルを出たShapeだけを再挿入する。false のときは毎回作り直す
+    bool incremental = true;
+
+    // true のとき、ルート直下のセルごとに分けて複数スレッドでペアを集める
+    bool multithread = true;
+
+    // これより少ないShapeでは1スレッドで巡る
+    int parallelThreshold = 2048;
+
     // グリッドに登録するShapeを更新
-    void update(std::span<PhysicsShape> shapes);
+    void update(std::span<PhysicsShape> shapes) override;
+
+    // Shapeをグリッドから取り除く（PhysicsShape を削除する前に呼ぶ）
+    void remove(PhysicsShape& shape) override;
 
     // 衝突する可能性のあるペアを集める
-    void gatherPairs();
+    void gatherPairs() override;
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const override;
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool query(const Bounds& bounds, const QueryFunc& func) const override;
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t getMemoryUsage() const override;
+
+    // 直近の update() で再挿入したShapeの数
+    int getReinsertCount() const { return reinsertCount; }
+
+    // 直近の update() でグリッド全体を作り直したか
+    bool isRebuilt() const { return rebuilt; }
 
 private:
     struct GridNode
     {
         Bounds bounds; // グリッドの境界
         Bounds shapeBounds; // グリッドに含まれるシェープを含む境界。隣のグリッドまで及ぶ可能性がある
-        std::vector<PhysicsShape*> shapes; // このノードに属するコライダー
+        std::vector<int> shapes; // このノードに属するコライダーのプロキシ番号
         std::vector<GridNode*> children; // 子グリッド３次元配列
+        GridNode* parent;
         Vector3 leafCellSize;
         int smallShapeSize;
         int childX, childY, childZ;
         Vector3 stride;
 
-        GridNode& initialize()
+        GridNode& initialize(GridNode* parentNode)
         {
             shapeBounds.extents = Vector3::negativeInfinity;
             shapes.clear();
             children.clear();
+            parent = parentNode;
             smallShapeSize = 0;
             return *this;
         }
         GridNode* getChild(int x, int y, int z)
         {
-            if (x < 0 || childX <= x || y < 0 || childY <= y || z < 0 || childZ < z) return nullptr;
+            if (x < 0 || childX <= x || y < 0 || childY <= y || z < 0 || childZ <= z) return nullptr;
             return children[x + childX * y + childX * childY * z];
         }
         void setChild(int x, int y, int z, GridNode* child) { children[x + childX * y + childX * childY * z] = child; }
@@ -70,22 +100,52 @@ private:
             childY = int(std::ceil(bounds.size().y / leafCellSize.y));
             childZ = int(std::ceil(bounds.size().z / leafCellSize.z));
             stride = bounds.size() / Vector3(float(childX), float(childY), float(childZ));
+
+            // 子に置くShapeは実際の子セルより小さくし、隣のセルまでしか及ばないようにする
+            leafCellSize = stride;
         }
         bool isTooBig(Vector3 size) const
         { return size.x >= leafCellSize.x || size.y >= leafCellSize.y || size.z >= leafCellSize.z; }
     };
-    CheckBoundFunc checkBoundF;
+    // Shapeごとの登録先。PhysicsShape::proxyId で引く
+    struct Proxy
+    {
+        PhysicsShape* shape; // 毎回 update() で張り直す
+        GridNode* node;      // 所属ノード。未登録なら nullptr
+        int slot;            // node->shapes の中の位置
+        bool small;          // 葉の smallShapeSize に数えているか
+    };
+
     std::deque<GridNode> gridNodes;
     int gridNodeSize;
-    std::vector<std::span<PhysicsShape*>> traverseAncestorShapes;
-    std::vector<GridNode*> traverseNeighborGrids;
+    std::vector<Proxy> proxies;
+    std::vector<int> freeProxies;
+    Vector3 shapeMin;
+    int reinsertCount;
+    bool rebuilt;
+
+    // ルート直下の子セル1つ分の巡回に使う作業領域。スレッドごとに別のものを使う
+    struct TraverseContext
+    {
+        std::vector<std::span<int>> ancestorShapes;
+        std::vector<GridNode*> neighbor;
+        std::vector<PotentialPair> pairs;
+    };
+    std::vector<std::array<int, 3>> traverseTasks;
+    std::deque<TraverseContext> traverseContexts;
 
-    GridNode* addGridNode();
+    GridNode* addGridNode(GridNode* parent);
+    void rebuild(std::span<PhysicsShape> shapes);
+    void refitShapeBounds();
+    bool isInPlace(const Proxy& proxy, const Bounds& moveBounds) const;
+    void addToNode(GridNode* node, int proxyId, bool small);
+    void removeFromNode(int proxyId);
     void subdivide(GridNode* node, Vector3 cellMin);
-    void insertShape(GridNode* node, PhysicsShape* shape, Vector3 cellMin);
-    void insertShapeToChild(GridNode* node, PhysicsShape* shape, Vector3 cellMin);
-    void traverseNode(GridNode* node, std::vector<std::span<PhysicsShape*>>& ancestorShapes, std::vector<GridNode*>& neighbor);
-    void checkBounds(GridNode* node, PhysicsShape* shape);
+    void insertShape(GridNode* node, int proxyId, Vector3 cellMin);
+    void insertShapeToChild(GridNode* node, int proxyId, Vector3 cellMin);
+    void traverseNode(GridNode* node, TraverseContext& context);
+    void checkBounds(GridNode* node, PhysicsShape* shape, TraverseContext& context);
+    void addPair(PhysicsShape* shape1, PhysicsShape* shape2, TraverseContext& context);
 };
 
 }
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <UniDx/Physics.h>
+
+
+namespace UniDx
+{
+
+// --------------------
+// PhysicsSlotMap
+// --------------------
+// PhysicsHandle から、密な配列のどこに入っているかを引く表
+// 表の番号は解放したものから使い回し、世代で古いハンドルを見分ける
+// 配列は呼び出し側が末尾と入れ替えて詰め、移した要素の場所を move() で直す
+class PhysicsSlotMap
+{
+public:
+    // 配列の group 番目の index に入れたものを登録してハンドルを返す
+    PhysicsHandle add(int index, int group = 0);
+
+    // 登録を解除する。以後 handle は無効になる
+    void remove(PhysicsHandle handle);
+
+    // 要素を別の場所に移した
+    void move(PhysicsHandle handle, int index, int group = 0);
+
+    // 有効なハンドルか
+    bool contains(PhysicsHandle handle) const
+    {
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation && slots[handle.index].index >= 0;
+    }
+
+    // 配列での位置。無効なハンドルなら -1
+    int indexOf(PhysicsHandle handle) const { return contains(handle) ? slots[handle.index].index : -1; }
+    int groupOf(PhysicsHandle handle) const { return slots[handle.index].group; }
+
+    // 確保しているバイト数
+    size_t getMemoryUsage() const { return slots.capacity() * sizeof(Slot); }
+
+private:
+    struct Slot
+    {
+        int index;              // 配列での位置。空いているときは -1
+        uint32_t generation;    // 解放するたびに進める
+        int group;              // どの配列に入っているか。空いているときは次の空きの番号
+    };
+    std::vector<Slot> slots;
+    int freeList = -1;
+};
+
+}
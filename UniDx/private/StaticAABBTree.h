@@ -0,0 +1,96 @@
+﻿#pragma once
+
+#include <vector>
+#include <span>
+#include <array>
+
+#include "Broadphase.h"
+#include "BoundsSoA.h"
+
+
+namespace UniDx
+{
+
+class PhysicsShape;
+
+
+// --------------------
+// StaticAABBTree
+// --------------------
+// 動かないShapeだけを入れる木
+// 追加・移動したShapeはいったん木の外の保留リストに置き、削除したShapeは木の中で無効にしておく
+// 保留と無効の数が多くなったときだけ作り直すので、スリープの出入りが続いても毎ステップは作り直さない
+// 動くShapeとのペアだけを作り、静的なShape同士のペアは作らない
+// レイヤーごとに別の木を作り、動くShapeと衝突しないレイヤーの木はまとめて飛ばす
+class StaticAABBTree
+{
+public:
+    typedef Broadphase::CheckBoundFunc CheckBoundFunc;
+
+    StaticAABBTree(CheckBoundFunc checkBoundFunc);
+
+    // 葉に入れるShapeの最大数。葉の中は BoundsSoA でまとめて判定する
+    int maxPerLeaf = 8;
+
+    // 保留と無効の数が、これと木のShape数の rebuildRatio 倍の大きいほうを超えたら作り直す
+    int minRebuildChanges = 32;
+    float rebuildRatio = 0.25f;
+
+    // 静的なShapeを更新。追加・削除・移動は保留リストに回し、溜まったら木を作り直す
+    void update(std::span<PhysicsShape> staticShapes);
+
+    // Shapeを取り除く（PhysicsShape を削除する前に呼ぶ）
+    void remove(PhysicsShape& shape);
+
+    // 動くShapeと静的なShapeのペアを集める
+    void gatherPairs(std::span<PhysicsShape> dynamicShapes);
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const Broadphase::RaycastFunc& func) const;
+
+    // 境界が bounds と重なるShapeを func に渡す。打ち切られたら false を返す
+    bool query(const Bounds& bounds, const Broadphase::QueryFunc& func) const;
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t getMemoryUsage() const;
+
+    // 直近の update() で作り直したか
+    bool isRebuilt() const { return rebuilt; }
+
+private:
+    struct Proxy
+    {
+        PhysicsShape* shape; // 毎回 update() で張り直す
+        Bounds bounds;       // 木か保留リストに入れたときの境界
+        uint32_t layerBit;   // 木か保留リストに入れたときのレイヤー
+        int item;            // items の中の位置。保留中は -1
+    };
+    struct TreeNode
+    {
+        Bounds bounds;
+        int first; // 葉では items の先頭、枝では左の子（右の子は first + 1）
+        int count; // 葉のShape数。枝では0
+    };
+
+    CheckBoundFunc checkBoundF;
+    std::vector<Proxy> proxies;
+    std::vector<int> freeProxies;
+    std::vector<int> items;  // 葉の並びのプロキシ番号。削除・移動で木から外したものは -1
+    int deadItems;
+    std::vector<int> pending; // 木の外に置いたプロキシ番号
+    BoundsSoA pendingBounds;  // pending と同じ並びの境界
+    BoundsSoA itemBounds; // items と同じ並びの境界
+    std::vector<int> overlapIndices;
+    std::vector<TreeNode> nodes;
+    std::array<int, 32> layerRoots; // レイヤーごとの木の根。Shapeがなければ -1
+    uint32_t presentLayers;         // 木があるレイヤーのビット
+    std::vector<int> traverseStack;
+    bool dirty;    // 保留リストが変わった
+    bool rebuilt;
+
+    void rebuild();
+    void detach(int proxyId);
+    void buildNode(int nodeIndex, int begin, int end);
+};
+
+}
@@ -0,0 +1,102 @@
+﻿#pragma once
+
+#include <vector>
+#include <array>
+#include <span>
+#include <unordered_map>
+
+#include "Broadphase.h"
+
+
+namespace UniDx
+{
+
+class PhysicsShape;
+
+
+// --------------------
+// SweepAndPrune
+// --------------------
+// 3軸の端点リストを挿入ソートで保ち、端点がすれ違ったときだけ重なりペアを増減させるブロードフェーズ
+// 動きが一方向にそろっている場面では、ほぼ O(n) で更新できる
+class SweepAndPrune : public Broadphase
+{
+public:
+    typedef std::pair<int, int> ProxyPair;
+
+    SweepAndPrune(CheckBoundFunc checkBoundFunc);
+
+    // 一度に増えたShapeがこれより多く、全体の1/4を超えるときはソートし直して作り直す
+    int rebuildThreshold = 64;
+
+    // 登録するShapeを更新して、重なりペアを差分で更新する
+    void update(std::span<PhysicsShape> shapes) override;
+
+    // Shapeを取り除く（PhysicsShape を削除する前に呼ぶ）
+    void remove(PhysicsShape& shape) override;
+
+    // 保持している重なりペアを渡す
+    void gatherPairs() override;
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const override;
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool query(const Bounds& bounds, const QueryFunc& func) const override;
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t getMemoryUsage() const override;
+
+    // 直近の update() で増えたペアと減ったペア（proxyId の組）
+    const std::vector<ProxyPair>& getAddedPairs() const { return addedPairs; }
+    const std::vector<ProxyPair>& getRemovedPairs() const { return removedPairs; }
+
+    // 直近の update() で端点を入れ替えた回数
+    int getSwapCount() const { return swapCount; }
+
+private:
+    struct Endpoint
+    {
+        float value;
+        int proxyId;
+        bool isMin;
+
+        // 同じ値なら min を先に並べ、接しているものも重なりとする
+        bool operator<(const Endpoint& other) const
+        {
+            return value < other.value || (value == other.value && isMin && !other.isMin);
+        }
+    };
+    struct Proxy
+    {
+        PhysicsShape* shape; // 毎回 update() で張り直す
+        float min[3];
+        float max[3];
+        bool alive;
+    };
+
+    std::array<std::vector<Endpoint>, 3> axes;
+    std::vector<Proxy> proxies;
+    std::vector<int> freeProxies;
+    std::vector<int> removedProxies;
+    std::vector<int> newProxies;
+
+    std::vector<ProxyPair> pairs;
+    std::unordered_map<uint64_t, int> pairIndex;   // ペアのキーから pairs の位置
+    std::unordered_map<uint64_t, bool> changedPairs; // この update() で触ったペアと、その前に重なっていたか
+    std::vector<ProxyPair> addedPairs;
+    std::vector<ProxyPair> removedPairs;
+    std::vector<int> sweepActive;
+    int swapCount;
+
+    static uint64_t pairKey(int a, int b);
+    bool overlaps(int a, int b) const;
+    void addPair(int a, int b);
+    void removePair(int a, int b);
+    void flushRemoved();
+    void rebuild();
+    void sortAxis(int axis);
+    void resolveDeltas();
+};
+
+}
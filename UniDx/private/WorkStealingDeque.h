@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+
+namespace UniDx
+{
+
+// --------------------
+// WorkStealingDeque
+// --------------------
+// Chase-Lev の work-stealing 両端キュー
+// 持ち主のスレッドだけが末尾に push() / pop() し、ほかのスレッドは先頭から steal() で盗む
+// 持ち主は後から積んだもの（キャッシュに残っているもの）から取り、盗む側は古いものから取る
+// T はポインタ。空のときは nullptr を返す
+template<typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+    {
+        auto a = std::make_unique<Array>(capacity);
+        array_.store(a.get(), std::memory_order_relaxed);
+        arrays_.push_back(std::move(a));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 末尾に積む。持ち主のスレッドだけが呼ぶ
+    void push(T item)
+    {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            a = grow(a, b, t);
+        }
+        a->put(b, item);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // 末尾から取る。持ち主のスレッドだけが呼ぶ
+    T pop()
+    {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // 空だった
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T item = a->get(b);
+        if (t == b)
+        {
+            // 最後の1つは盗む側と取り合う
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 先頭から盗む。どのスレッドから呼んでもよい
+    // 空のときと、ほかのスレッドと取り合って負けたときは nullptr
+    T steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        Array* a = array_.load(std::memory_order_acquire);
+        T item = a->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // 目安の個数。ほかのスレッドが操作中なら正確ではない
+    int64_t size() const
+    {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    // 環状の配列。容量は2のべき乗
+    struct Array
+    {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> items;
+
+        explicit Array(int64_t c) : capacity(c), mask(c - 1), items(new std::atomic<T>[size_t(c)]) {}
+
+        T get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T item) { items[i & mask].store(item, std::memory_order_relaxed); }
+    };
+
+    alignas(64) std::atomic<int64_t> top_ = 0;
+    alignas(64) std::atomic<int64_t> bottom_ = 0;
+    alignas(64) std::atomic<Array*> array_;
+
+    // 盗む側がまだ古い配列を読んでいるかもしれないので、広げる前の配列も捨てずに持っておく
+    std::vector<std::unique_ptr<Array>> arrays_;
+
+    Array* grow(Array* a, int64_t b, int64_t t)
+    {
+        auto bigger = std::make_unique<Array>(a->capacity * 2);
+        for (int64_t i = t; i < b; ++i)
+        {
+            bigger->put(i, a->get(i));
+        }
+        Array* result = bigger.get();
+        arrays_.push_back(std::move(bigger));
+        array_.store(result, std::memory_order_release);
+        return result;
+    }
+};
+
+}
@@ -0,0 +1,109 @@
+﻿#include "pch.h"
+#include <BoundsSoA.h>
+
+#include <bit>
+
+#if UNIDX_BOUNDS_SIMD_AVX2 || UNIDX_BOUNDS_SIMD_SSE2
+#include <immintrin.h>
+#endif
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    void BoundsSoA::clear()
+    {
+        cx.clear(); cy.clear(); cz.clear();
+        ex.clear(); ey.clear(); ez.clear();
+    }
+
+    void BoundsSoA::reserve(size_t size)
+    {
+        cx.reserve(size); cy.reserve(size); cz.reserve(size);
+        ex.reserve(size); ey.reserve(size); ez.reserve(size);
+    }
+
+    void BoundsSoA::push_back(const Bounds& bounds)
+    {
+        cx.push_back(bounds.Center.x); cy.push_back(bounds.Center.y); cz.push_back(bounds.Center.z);
+        ex.push_back(bounds.extents.x); ey.push_back(bounds.extents.y); ez.push_back(bounds.extents.z);
+    }
+
+
+    // [begin, end) の要素のうち bounds と重なるものの番号を out に追加する
+    void BoundsSoA::gatherOverlaps(const Bounds& bounds, int begin, int end, std::vector<int>& out) const
+    {
+        int i = begin;
+
+#if UNIDX_BOUNDS_SIMD_AVX2
+        // 8要素ずつ判定
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 qcx = _mm256_set1_ps(bounds.Center.x);
+        const __m256 qcy = _mm256_set1_ps(bounds.Center.y);
+        const __m256 qcz = _mm256_set1_ps(bounds.Center.z);
+        const __m256 qex = _mm256_set1_ps(bounds.extents.x);
+        const __m256 qey = _mm256_set1_ps(bounds.extents.y);
+        const __m256 qez = _mm256_set1_ps(bounds.extents.z);
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 dx = _mm256_and_ps(_mm256_sub_ps(qcx, _mm256_loadu_ps(&cx[i])), absMask);
+            __m256 dy = _mm256_and_ps(_mm256_sub_ps(qcy, _mm256_loadu_ps(&cy[i])), absMask);
+            __m256 dz = _mm256_and_ps(_mm256_sub_ps(qcz, _mm256_loadu_ps(&cz[i])), absMask);
+            __m256 hit = _mm256_cmp_ps(dx, _mm256_add_ps(qex, _mm256_loadu_ps(&ex[i])), _CMP_LE_OQ);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(dy, _mm256_add_ps(qey, _mm256_loadu_ps(&ey[i])), _CMP_LE_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(dz, _mm256_add_ps(qez, _mm256_loadu_ps(&ez[i])), _CMP_LE_OQ));
+            for (unsigned mask = unsigned(_mm256_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                out.push_back(i + std::countr_zero(mask));
+            }
+        }
+#elif UNIDX_BOUNDS_SIMD_SSE2
+        // 4要素ずつ判定
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 qcx = _mm_set1_ps(bounds.Center.x);
+        const __m128 qcy = _mm_set1_ps(bounds.Center.y);
+        const __m128 qcz = _mm_set1_ps(bounds.Center.z);
+        const __m128 qex = _mm_set1_ps(bounds.extents.x);
+        const __m128 qey = _mm_set1_ps(bounds.extents.y);
+        const __m128 qez = _mm_set1_ps(bounds.extents.z);
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 dx = _mm_and_ps(_mm_sub_ps(qcx, _mm_loadu_ps(&cx[i])), absMask);
+            __m128 dy = _mm_and_ps(_mm_sub_ps(qcy, _mm_loadu_ps(&cy[i])), absMask);
+            __m128 dz = _mm_and_ps(_mm_sub_ps(qcz, _mm_loadu_ps(&cz[i])), absMask);
+            __m128 hit = _mm_cmple_ps(dx, _mm_add_ps(qex, _mm_loadu_ps(&ex[i])));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(dy, _mm_add_ps(qey, _mm_loadu_ps(&ey[i]))));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(dz, _mm_add_ps(qez, _mm_loadu_ps(&ez[i]))));
+            for (unsigned mask = unsigned(_mm_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                out.push_back(i + std::countr_zero(mask));
+            }
+        }
+#endif
+
+        // 残りは1つずつ
+        for (; i < end; ++i)
+        {
+            if (std::abs(bounds.Center.x - cx[i]) <= bounds.extents.x + ex[i]
+                && std::abs(bounds.Center.y - cy[i]) <= bounds.extents.y + ey[i]
+                && std::abs(bounds.Center.z - cz[i]) <= bounds.extents.z + ez[i])
+            {
+                out.push_back(i);
+            }
+        }
+    }
+
+
+    // 使っている命令セットの名前
+    const char* BoundsSoA::kernelName()
+    {
+#if UNIDX_BOUNDS_SIMD_AVX2
+        return "AVX2";
+#elif UNIDX_BOUNDS_SIMD_SSE2
+        return "SSE2";
+#else
+        return "Scalar";
+#endif
+    }
+}
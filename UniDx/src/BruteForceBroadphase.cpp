@@ -0,0 +1,90 @@
+﻿#include "pch.h"
+#include <BruteForceBroadphase.h>
+
+#include <algorithm>
+
+#include <UniDx/Physics.h>
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    BruteForceBroadphase::BruteForceBroadphase(
+        CheckBoundFunc checkBoundFunc)
+        : Broadphase(checkBoundFunc)
+    {
+        overlapIndices.reserve(64);
+    }
+
+
+    // 境界を詰め直す
+    void BruteForceBroadphase::update(std::span<PhysicsShape> shapes)
+    {
+        this->shapes = shapes;
+        bounds.clear();
+        bounds.reserve(shapes.size());
+        for (const auto& shape : shapes)
+        {
+            bounds.push_back(shape.moveBounds);
+        }
+    }
+
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t BruteForceBroadphase::getMemoryUsage() const
+    {
+        return bounds.getMemoryUsage() + CapacityBytes(overlapIndices);
+    }
+
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void BruteForceBroadphase::raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const
+    {
+        std::vector<std::pair<float, PhysicsShape*>> hits;
+        for (auto& shape : shapes)
+        {
+            float enter;
+            if (RayOverlapsBounds(origin, direction, radius, maxDistance, shape.moveBounds, enter))
+            {
+                hits.emplace_back(enter, &shape);
+            }
+        }
+
+        std::sort(hits.begin(), hits.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (const auto& [t, shape] : hits)
+        {
+            if (t > maxDistance) break;
+            maxDistance = std::min(maxDistance, func(shape, t, maxDistance));
+        }
+    }
+
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool BruteForceBroadphase::query(const Bounds& bounds, const QueryFunc& func) const
+    {
+        std::vector<int> overlaps;
+        this->bounds.gatherOverlaps(bounds, 0, int(shapes.size()), overlaps);
+        for (int i : overlaps)
+        {
+            if (!func(&shapes[i])) return false;
+        }
+        return true;
+    }
+
+
+    // 衝突する可能性のあるペアを集める
+    void BruteForceBroadphase::gatherPairs()
+    {
+        const int size = int(shapes.size());
+        for (int i = 0; i < size; ++i)
+        {
+            overlapIndices.clear();
+            bounds.gatherOverlaps(shapes[i].moveBounds, i + 1, size, overlapIndices);
+            for (int j : overlapIndices)
+            {
+                checkBoundF(&shapes[i], &shapes[j]);
+            }
+        }
+    }
+}
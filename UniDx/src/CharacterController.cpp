@@ -0,0 +1,215 @@
+﻿#include "pch.h"
+#include <UniDx/CharacterController.h>
+
+#include <UniDx/Physics.h>
+#include <UniDx/Collider.h>
+#include <UniDx/Time.h>
+#include <UniDx/GameObject.h>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    // 1回の移動で面に沿って滑らせる回数の上限
+    constexpr int maxSlideIterations = 4;
+
+    // これより短い残りの移動は捨てる
+    constexpr float minSlideDistance = 1e-5f;
+}
+
+
+namespace UniDx
+{
+
+    // motion だけ動かす
+    // 1. 段差を登るために stepOffset だけ持ち上げる（上向きの移動もここで）
+    // 2. 横に動かして、ぶつかった面に沿って滑らせる
+    // 3. 持ち上げた分と下向きの移動だけ下ろす
+    // 登った先が登れない坂か stepOffset より高いところなら、持ち上げずにやり直す
+    uint8_t CharacterController::Move(Vector3 motion)
+    {
+        if (motion.magnitude() < minMoveDistance)
+        {
+            velocity = Vector3::zero;
+            return collisionFlags;
+        }
+
+        const Vector3 start = transform->position;
+        const float foot = start.y + center.y - height * 0.5f;
+        const Vector3 horizontal(motion.x, 0.0f, motion.z);
+        const bool canStep = stepOffset > 0.0f && isGrounded() && horizontal.sqrMagnitude() > minSlideDistance * minSlideDistance;
+
+        hits.clear();
+        Vector3 position;
+        uint8_t flags;
+        for (float step : { canStep ? stepOffset : 0.0f, 0.0f })
+        {
+            hits.clear();
+            flags = CollisionFlags_None;
+            groundNormal = Vector3::zero;
+
+            position = slide(start, Vector3::up * (step + std::max(motion.y, 0.0f)), Pass::Up, flags);
+            const float lifted = std::min(position.y - start.y, step);
+            position = slide(position, horizontal, Pass::Side, flags);
+            position = slide(position, Vector3::up * -(lifted + std::max(-motion.y, 0.0f)), Pass::Down, flags);
+
+            if (step == 0.0f || groundNormal == Vector3::zero) break;
+            if (isWalkable(groundNormal) && groundHeight - foot <= stepOffset) break;
+        }
+
+        transform->position = position;
+        collisionFlags = flags;
+
+        const float dt = Time::deltaTime;
+        velocity = dt > 0.0f ? (position - start) / dt : Vector3::zero;
+
+        // コールバックの中で Move() を呼んでもよいように、記録を取り出してから呼ぶ
+        std::vector<ControllerColliderHit> called;
+        called.swap(hits);
+        for (const auto& hit : called)
+        {
+            gameObject->onControllerColliderHit(hit);
+        }
+        if (hits.empty()) hits.swap(called);  // 確保した領域を使い回す
+
+        return flags;
+    }
+
+
+    // 水平の速度 speed で動かす。地面に着いていなければ重力で落とす
+    bool CharacterController::SimpleMove(Vector3 speed)
+    {
+        const float dt = Time::deltaTime;
+        fallSpeed += Physics::gravity * dt;
+
+        Move(Vector3(speed.x * dt, fallSpeed * dt, speed.z * dt));
+        if (isGrounded()) fallSpeed = 0.0f;
+        return isGrounded();
+    }
+
+
+    // position から motion だけ動かし、ぶつかったら面に沿って残りを滑らせる
+    // 2つの面に挟まれたら、面の交わる線に沿ってだけ動かして角での行き来を防ぐ
+    Vector3 CharacterController::slide(Vector3 position, Vector3 motion, Pass pass, uint8_t& flags)
+    {
+        const float length = motion.magnitude();
+        if (length < minSlideDistance) return position;
+        const Vector3 firstDirection = motion / length;
+
+        Vector3 prevNormal = Vector3::zero;
+        for (int i = 0; i < maxSlideIterations; ++i)
+        {
+            const float len = motion.magnitude();
+            if (len < minSlideDistance) break;
+            const Vector3 dir = motion / len;
+
+            RaycastHit hit;
+            if (!cast(position, dir, len, hit))
+            {
+                position += motion;
+                break;
+            }
+
+            // 小さいカプセルが当たった位置から skinWidth だけ手前で、本来のカプセルが面に接する
+            const float travel = std::clamp(hit.distance - skinWidth, 0.0f, len);
+            position += dir * travel;
+            flags |= classify(hit.normal);
+            hits.push_back({ this, hit.collider, hit.point, hit.normal, dir, len });
+
+            Vector3 normal = hit.normal;
+            if (pass == Pass::Up) break;
+            if (pass == Pass::Down)
+            {
+                groundNormal = groundNormalAt(hit);
+                groundHeight = hit.point.y;
+                if (isWalkable(groundNormal)) break;
+            }
+            if (pass == Pass::Side && !isWalkable(normal))
+            {
+                // 急な面は垂直な壁として扱い、横に動かすだけで登らせない
+                normal.y = 0.0f;
+                if (normal.sqrMagnitude() < 1e-6f) break;
+                normal = normal.normalized();
+            }
+
+            Vector3 remaining = dir * (len - travel);
+            remaining -= normal * Dot(remaining, normal);
+            if (Dot(remaining, prevNormal) < 0.0f)
+            {
+                Vector3 crease = Cross(prevNormal, normal);
+                if (crease.sqrMagnitude() < 1e-6f) break;
+                crease = crease.normalized();
+                remaining = crease * Dot(remaining, crease);
+            }
+            if (Dot(remaining, firstDirection) <= 0.0f) break;
+
+            prevNormal = normal;
+            motion = remaining;
+        }
+        return position;
+    }
+
+
+    // position にあるカプセルを direction へ distance 動かしたときに当たる面を調べる
+    // 半径を skinWidth だけ小さくして調べ、少しめり込んでいても当たるようにする
+    bool CharacterController::cast(Vector3 position, Vector3 direction, float distance, RaycastHit& hit) const
+    {
+        const Vector3 c = position + center;
+        const float castRadius = std::max(radius - skinWidth, radius * 0.5f);
+        const float halfSegment = std::max(height * 0.5f - radius, 0.0f);
+        const Vector3 p1 = c - Vector3::up * halfSegment;
+        const Vector3 p2 = c + Vector3::up * halfSegment;
+
+        return Physics::getInstance()->CapsuleCast(p1, p2, castRadius, direction, distance + skinWidth, &hit,
+            [this](const Collider* col) { return canCollide(col); });
+    }
+
+
+    // 足もとの面の法線
+    // 段差の角に当たると法線が斜めになるので、角の少し内側を真下に調べて上の面の法線を使う
+    Vector3 CharacterController::groundNormalAt(const RaycastHit& hit) const
+    {
+        if (isWalkable(hit.normal)) return hit.normal;
+
+        Vector3 outward(hit.normal.x, 0.0f, hit.normal.z);
+        if (outward.sqrMagnitude() < 1e-6f) return hit.normal;
+        outward = outward.normalized();
+
+        RaycastHit top;
+        const Vector3 origin = hit.point - outward * skinWidth + Vector3::up * skinWidth;
+        if (Physics::getInstance()->Raycast(origin, -Vector3::up, skinWidth * 2.0f, &top,
+            [this](const Collider* col) { return canCollide(col); }) && isWalkable(top.normal))
+        {
+            return top.normal;
+        }
+        return hit.normal;
+    }
+
+
+    // ぶつかる相手か。トリガーと自分のコライダー、衝突しないレイヤーは無視する
+    bool CharacterController::canCollide(const Collider* col) const
+    {
+        return !col->isTrigger && col->gameObject != gameObject &&
+            (Physics::GetLayerCollisionMask(layer) & (1u << col->layer)) != 0;
+    }
+
+
+    // 面の法線からカプセルのどこに当たったかを分ける
+    // カプセルの面の法線は軸から放射状なので、下向きの成分があれば下の半球
+    uint8_t CharacterController::classify(Vector3 normal) const
+    {
+        const float eps = 0.01f;
+        if (normal.y > eps) return CollisionFlags_Below;
+        if (normal.y < -eps) return CollisionFlags_Above;
+        return CollisionFlags_Sides;
+    }
+
+
+    // 立っていられる坂か
+    bool CharacterController::isWalkable(Vector3 normal) const
+    {
+        return normal.y >= std::cos(slopeLimit * Deg2Rad) - 1e-4f;
+    }
+
+}
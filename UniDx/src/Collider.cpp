@@ -1,9 +1,16 @@
 ﻿#include "pch.h"
 
 #include <limits>
+#include <array>
+#include <fstream>
+#include <filesystem>
 #include <UniDx/Collider.h>
 #include <UniDx/Collision.h>
 #include <UniDx/Rigidbody.h>
+#include <UniDx/Renderer.h>
+#include <MeshBVH.h>
+#include <NarrowphaseBatch.h>
+#include <PhysicsGeometory.h>
 
 namespace
 {
@@ -14,16 +21,9 @@ namespace
     constexpr float infinity = numeric_limits<float>::infinity();
 
 
-    // トリガーチェック
-    bool checkTrigger_(SphereCollider* sphere, AABBCollider* aabb)
+    // トリガーチェック（球と箱）
+    bool checkTrigger_(Vector3 sphereCenter, float sphereRadius, const Bounds& aabbBounds)
     {
-        // 球の中心（ワールド座標）
-        Vector3 sphereCenter = sphere->transform->TransformPoint(sphere->center);
-        float sphereRadius = sphere->radius;
-
-        // AABBのBounds
-        Bounds aabbBounds = aabb->getBounds();
-
         // AABB上で球中心に最も近い点
         Vector3 closest = aabbBounds.ClosestPoint(sphereCenter);
 
@@ -35,78 +35,439 @@ namespace
         return distSqr <= sphereRadius * sphereRadius;
     }
 
-    // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-    bool checkIntersect_(SphereCollider* sphere, AABBCollider* aabb, PhysicsActor* sphereActor, PhysicsActor* aabbActor)
+    // トリガーチェック
+    bool checkTrigger_(SphereCollider* sphere, AABBCollider* aabb)
+    {
+        // 球の中心（ワールド座標）
+        Vector3 sphereCenter = sphere->transform->TransformPoint(sphere->center);
+
+        return checkTrigger_(sphereCenter, sphere->radius, aabb->getBounds());
+    }
+
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool checkIntersect_(SphereCollider* sphere, AABBCollider* aabb, PhysicsActor* sphereActor, PhysicsActor* aabbActor, CorrectionBuffer& corrections)
     {
         // 球の中心（ワールド座標）
         Vector3 sphereCenter = sphere->transform->TransformPoint(sphere->center);
-        float sphereRadius = sphere->radius;
+        Bounds b = aabb->getBounds();
 
-        // AABBのBounds
-        Bounds aabbBounds = aabb->getBounds();
+        return NarrowphaseBatch::sphereAABB(sphere, sphereCenter, aabb, b.min(), b.max(), sphereActor, aabbActor, corrections);
+    }
 
-        // AABB上で球中心に最も近い点
+    // 接触点を1点だけ設定する
+    void setContact_(ContactManifold& m, Vector3 point, Vector3 normal, float separation)
+    {
+        Contact& c = m.contacts[0];
+        c.point = point;
+        c.normal = normal;
+        c.penetration = -separation;
+        c.normalImpulse = 0.0f;
+        c.tangentImpulse = Vector3::zero;
+        c.velocityBias = 0.0f;
+        m.numContacts = 1;
+    }
+
+    // 法線の向きを反対にする
+    void flipContacts_(ContactManifold& m)
+    {
+        for (int i = 0; i < m.numContacts; ++i)
+        {
+            m.contacts[i].normal = -m.contacts[i].normal;
+        }
+    }
+
+    // 接触点の生成（球と球）。法線は球 A から球 B へ向く
+    bool contactSphereSphere_(Vector3 centerA, float radiusA, Vector3 centerB, float radiusB, float margin, ContactManifold& m)
+    {
+        Vector3 sub = centerB - centerA;
+        float dist = sub.magnitude();
+        float separation = dist - (radiusA + radiusB);
+        if (separation > margin) return false;
+
+        // 中心が重なっているときは上に押し出す
+        Vector3 normal = dist > 1e-6f ? sub / dist : Vector3(0, 1, 0);
+
+        // 接触点は重なりの中ほど
+        setContact_(m, centerA + normal * (radiusA + separation * 0.5f), normal, separation);
+        return true;
+    }
+
+    // 接触点の生成（球と箱）。法線は球から箱へ向く
+    bool contactSphereBox_(Vector3 sphereCenter, float sphereRadius, const Bounds& aabbBounds, float margin, ContactManifold& m)
+    {
         Vector3 closest = aabbBounds.ClosestPoint(sphereCenter);
+        Vector3 sub = closest - sphereCenter;
+        float distSqr = sub.sqrMagnitude();
 
-        // 最近点と球中心のベクトル
-        Vector3 normal = sphereCenter - closest;
-        float distSqr = normal.sqrMagnitude();
+        // 中心が箱の外にあれば最近点との距離で決まる
+        if (distSqr > 1e-12f)
+        {
+            float dist = std::sqrt(distSqr);
+            float separation = dist - sphereRadius;
+            if (separation > margin) return false;
 
-        // 衝突していない
-        if (distSqr > sphereRadius * sphereRadius)
-            return false;
+            setContact_(m, closest, sub / dist, separation);
+            return true;
+        }
+
+        // 中心が箱の中にあれば、いちばん近い面から押し出す
+        Vector3 toMin = sphereCenter - aabbBounds.min();
+        Vector3 toMax = aabbBounds.max() - sphereCenter;
+        const float dists[6] = { toMin.x, toMax.x, toMin.y, toMax.y, toMin.z, toMax.z };
+        const Vector3 faces[6] = {
+            Vector3(-1, 0, 0), Vector3(1, 0, 0), Vector3(0, -1, 0), Vector3(0, 1, 0), Vector3(0, 0, -1), Vector3(0, 0, 1) };
+        int face = 0;
+        for (int i = 1; i < 6; ++i)
+        {
+            if (dists[i] < dists[face]) face = i;
+        }
+        setContact_(m, sphereCenter + faces[face] * dists[face], -faces[face], -(dists[face] + sphereRadius));
+        return true;
+    }
+
+    // 接触点の生成（箱と箱）。法線は箱 A から箱 B へ向く
+    // 重なりの浅い軸で押し出す。接触点は重なっている範囲の中心
+    bool contactBoxBox_(const Bounds& a, const Bounds& b, float margin, ContactManifold& m)
+    {
+        Vector3 minA = a.min(), maxA = a.max();
+        Vector3 minB = b.min(), maxB = b.max();
+
+        // 軸ごとの離れている距離（重なっていれば負）
+        const float separations[3] = {
+            std::max(minB.x - maxA.x, minA.x - maxB.x),
+            std::max(minB.y - maxA.y, minA.y - maxB.y),
+            std::max(minB.z - maxA.z, minA.z - maxB.z) };
+        int axis = 0;
+        for (int i = 1; i < 3; ++i)
+        {
+            if (separations[i] > separations[axis]) axis = i;
+        }
+        if (separations[axis] > margin) return false;
+
+        Vector3 normal = Vector3::zero;
+        Vector3 sub = b.Center - a.Center;
+        const float d[3] = { sub.x, sub.y, sub.z };
+        const float sign = d[axis] >= 0 ? 1.0f : -1.0f;
+        if (axis == 0) normal.x = sign;
+        else if (axis == 1) normal.y = sign;
+        else normal.z = sign;
+
+        Vector3 point = (Max(minA, minB) + Min(maxA, maxB)) * 0.5f;
+        setContact_(m, point, normal, separations[axis]);
+        return true;
+    }
+
+    // レイ origin + direction * t が bmin〜bmax の箱を通る t の範囲を [tmin, tmax] に絞る
+    bool clipRayBox_(Vector3 origin, Vector3 direction, Vector3 bmin, Vector3 bmax, float& tmin, float& tmax)
+    {
+        const float eps = 1e-6f;
+        const float o[3] = { origin.x, origin.y, origin.z };
+        const float d[3] = { direction.x, direction.y, direction.z };
+        const float lo[3] = { bmin.x, bmin.y, bmin.z };
+        const float hi[3] = { bmax.x, bmax.y, bmax.z };
+        for (int i = 0; i < 3; ++i)
+        {
+            if (fabs(d[i]) < eps)
+            {
+                if (o[i] < lo[i] || o[i] > hi[i]) return false;
+                continue;
+            }
+            float inv = 1.0f / d[i];
+            float t1 = (lo[i] - o[i]) * inv;
+            float t2 = (hi[i] - o[i]) * inv;
+            tmin = std::max(tmin, std::min(t1, t2));
+            tmax = std::min(tmax, std::max(t1, t2));
+            if (tmin > tmax) return false;
+        }
+        return true;
+    }
+
+    // 箱 b に半径 radius の球を当てる。hitInfo の collider は呼び出し側で設定する
+    // - 半径だけ広げた箱にレイで入る位置から、角や辺の丸みの分だけ球を進めて接する位置を探す
+    // - 始点で重なっていれば無視する
+    bool sphereCastBox_(const Bounds& b, Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        const float eps = 1e-6f;
+
+        if (b.SqrDistance(origin) <= radius * radius) return false;
 
-        // Rigidbody取得
-        Rigidbody* rbA = sphere->attachedRigidbody;
-        Rigidbody* rbB = aabb->attachedRigidbody;
+        const float speed = direction.magnitude();
+        if (speed < eps) return false;
 
-        // 相対速度
-        Vector3 velA = rbA ? rbA->linearVelocity : Vector3::zero;
-        Vector3 velB = rbB ? rbB->linearVelocity : Vector3::zero;
-        Vector3 relVel = velA - velB;
+        const Vector3 r(radius, radius, radius);
+        float t = 0.0f;
+        float tExit = maxDistance;
+        if (!clipRayBox_(origin, direction, b.min() - r, b.max() + r, t, tExit)) return false;
 
-        // 相対速度が法線方向（離れようとしている）場合は無視
-        if (Dot(relVel, normal) > 0)
-            return false;
+        // 面の正面なら入口で接している。角や辺では箱までの距離が半径になるまで進める
+        const float tolerance = (radius + 1.0f) * 1e-4f;
+        for (int i = 0; i < 32; ++i)
+        {
+            Vector3 center = origin + direction * t;
+            Vector3 closest = b.ClosestPoint(center);
+            float dist = Distance(center, closest);
+            if (dist <= radius + tolerance)
+            {
+                if (hitInfo)
+                {
+                    Vector3 normal = center - closest;
+                    if (dist > eps) normal /= dist;
+                    else normal = -direction / speed;
+
+                    hitInfo->point = closest;
+                    hitInfo->normal = normal;
+                    hitInfo->distance = t;
+                }
+                return true;
+            }
+
+            t += (dist - radius) / speed;
+            if (t > tExit) return false;
+        }
+
+        return false;
+    }
+
+    // 座標 v が入るセルの番号。格子の外は -1 か count に丸める
+    int tileIndex_(float v, float gridMin, float size, int count)
+    {
+        return int(std::clamp(std::floor((v - gridMin) / size), -1.0f, float(count)));
+    }
+
+    // メッシュの三角形リストのサブメッシュを、1つの位置とインデックスの並びにまとめる
+    void gatherTriangles_(const Mesh& mesh, vector<Vector3>& positions, vector<uint32_t>& indices)
+    {
+        for (auto& sub : mesh.submesh)
+        {
+            if (sub == nullptr || sub->topology != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST) continue;
+
+            const uint32_t base = uint32_t(positions.size());
+            positions.insert(positions.end(), sub->positions.begin(), sub->positions.end());
+            if (sub->indices.empty())
+            {
+                for (uint32_t i = 0; i < uint32_t(sub->positions.size()); ++i) indices.push_back(base + i);
+            }
+            else
+            {
+                for (uint32_t i : sub->indices) indices.push_back(base + i);
+            }
+        }
+    }
 
-        float dist = std::sqrt(distSqr);
-        // 法線（dist==0のときは適当な軸にする）
-        Vector3 contactNormal = (dist > 1e-6f) ? (normal / dist) : Vector3(1, 0, 0);
+    // 三角形 abc の上で p に最も近い点
+    Vector3 closestPointTriangle_(Vector3 p, Vector3 a, Vector3 b, Vector3 c)
+    {
+        Vector3 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = Dot(ab, ap), d2 = Dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+        Vector3 bp = p - b;
+        float d3 = Dot(ab, bp), d4 = Dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) return b;
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+        Vector3 cp = p - c;
+        float d5 = Dot(ab, cp), d6 = Dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) return c;
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denom = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
 
-        // penetration（めり込み量）
-        float penetration = sphereRadius - dist;
+    // 三角形の面の法線。つぶれていれば上向き
+    Vector3 triangleNormal_(Vector3 a, Vector3 b, Vector3 c)
+    {
+        Vector3 n = Cross(b - a, c - a);
+        float len = n.magnitude();
+        return len > 1e-12f ? n / len : Vector3(0, 1, 0);
+    }
 
-        // 質量取得（0以下は1.0f扱い）
-        float massA = (rbA && !rbA->isKinematic) ? (rbA->mass > 0.0f ? rbA->mass : 1.0f) : infinity;
-        float massB = (rbB && !rbB->isKinematic) ? (rbB->mass > 0.0f ? rbB->mass : 1.0f) : infinity;
-        float totalMass = massA + massB;
+    // 三角形と箱の重なり（分離軸判定）
+    bool triangleBox_(Vector3 a, Vector3 b, Vector3 c, const Bounds& box)
+    {
+        const Vector3 center = box.Center;
+        const Vector3 e = box.extents;
+        const Vector3 v[3] = { a - center, b - center, c - center };
+        const Vector3 edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+        const Vector3 axes[3] = { Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1) };
+
+        // 軸 axis に投影して重なっていなければ分離している
+        auto separated = [&](Vector3 axis)
+            {
+                float p0 = Dot(v[0], axis), p1 = Dot(v[1], axis), p2 = Dot(v[2], axis);
+                float r = e.x * std::fabs(axis.x) + e.y * std::fabs(axis.y) + e.z * std::fabs(axis.z);
+                return std::max({ p0, p1, p2 }) < -r || std::min({ p0, p1, p2 }) > r;
+            };
 
-        float massAPerTotal = massA != infinity ? massA / totalMass : 1;
-        float massBPerTotal = massB != infinity ? massB / totalMass : 1;
+        // 箱の面の法線、三角形の法線、辺同士の外積
+        for (const Vector3& axis : axes)
+        {
+            if (separated(axis)) return false;
+        }
+        if (separated(Cross(edges[0], edges[1]))) return false;
+        for (const Vector3& edge : edges)
+        {
+            for (const Vector3& axis : axes)
+            {
+                if (separated(Cross(axis, edge))) return false;
+            }
+        }
+        return true;
+    }
 
-        // 補正ベクトル
-        Vector3 correctionA = contactNormal * (penetration * massBPerTotal);
-        Vector3 correctionB = -contactNormal * (penetration * massAPerTotal);
+    // レイ origin + direction * t が中心 center、半径 radius の球に入る t
+    bool rayEnterSphere_(Vector3 origin, Vector3 direction, Vector3 center, float radius, float& t)
+    {
+        Vector3 m = origin - center;
+        float a = Dot(direction, direction);
+        float b = Dot(m, direction);
+        float c = Dot(m, m) - radius * radius;
+        if (c <= 0.0f || b >= 0.0f) return false;   // 始点が内部か、離れていく
 
-        // 位置補正
-        if (rbA && !rbA->isKinematic && massA != infinity) sphereActor->addCorrectPosition(correctionA);
-        if (rbB && !rbB->isKinematic && massB != infinity) aabbActor->addCorrectPosition(correctionB);
+        float disc = b * b - a * c;
+        if (disc < 0.0f) return false;
+        t = (-b - std::sqrt(disc)) / a;
+        return true;
+    }
 
-        // 跳ね返り係数
-        float bounce = sphere->bounciness * aabb->bounciness;
+    // レイ origin + direction * t が線分 p0-p1 を軸とする半径 radius の円柱の側面に入る t
+    bool rayEnterCylinder_(Vector3 origin, Vector3 direction, Vector3 p0, Vector3 p1, float radius, float& t)
+    {
+        Vector3 d = p1 - p0;
+        Vector3 m = origin - p0;
+        float dd = Dot(d, d);
+        float nd = Dot(direction, d);
+        float md = Dot(m, d);
+        float a = dd * Dot(direction, direction) - nd * nd;
+        if (a < 1e-12f * dd * Dot(direction, direction)) return false;  // 軸と平行なら両端の球で当たる
+
+        float b = dd * Dot(m, direction) - nd * md;
+        float c = dd * (Dot(m, m) - radius * radius) - md * md;
+        if (c <= 0.0f || b >= 0.0f) return false;
+
+        float disc = b * b - a * c;
+        if (disc < 0.0f) return false;
+        float th = (-b - std::sqrt(disc)) / a;
 
-        // 法線方向の速度成分
-        float relVelN = Dot(relVel, contactNormal);
+        // 線分の範囲に入っているところだけ
+        float s = md + th * nd;
+        if (s < 0.0f || s > dd) return false;
+        t = th;
+        return true;
+    }
 
-        // 反射させる
-        Vector3 impulse = -(1.0f + bounce) * relVelN * contactNormal;
+    // 三角形 abc に半径 radius の球を origin から direction へ動かして当てる。始点で重なっていないこと
+    // 面に当たらなければ、辺の円柱と頂点の球でいちばん早く当たるところを探す
+    bool sphereCastTriangle_(Vector3 a, Vector3 b, Vector3 c, Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit& hit)
+    {
+        float best = infinity;
 
-        if (rbA && !rbA->isKinematic && massA != infinity) sphereActor->addCorrectVelocity(impulse * massBPerTotal);
-        if (rbB && !rbB->isKinematic && massB != infinity) aabbActor->addCorrectVelocity(-impulse * massAPerTotal);
+        // 面
+        Vector3 n = Cross(b - a, c - a);
+        float nlen = n.magnitude();
+        if (nlen > 1e-12f)
+        {
+            n /= nlen;
+            float side = Dot(origin - a, n);
+            if (side < 0.0f)
+            {
+                n = -n;
+                side = -side;
+            }
+            float approach = -Dot(direction, n);
+            if (side > radius && approach > 0.0f)
+            {
+                float t = (side - radius) / approach;
+                Vector3 p = origin + direction * t - n * radius;
+                if (SqrDistance(closestPointTriangle_(p, a, b, c), p) <= 1e-10f * (1.0f + Dot(p, p))) best = t;
+            }
+        }
 
+        // 辺と頂点
+        if (best == infinity)
+        {
+            const Vector3 v[3] = { a, b, c };
+            for (int i = 0; i < 3; ++i)
+            {
+                float t;
+                if (rayEnterCylinder_(origin, direction, v[i], v[(i + 1) % 3], radius, t) && t < best) best = t;
+                if (rayEnterSphere_(origin, direction, v[i], radius, t) && t < best) best = t;
+            }
+        }
+        if (!(best >= 0.0f) || best > maxDistance) return false;
+
+        Vector3 center = origin + direction * best;
+        Vector3 closest = closestPointTriangle_(center, a, b, c);
+        Vector3 normal = center - closest;
+        float len = normal.magnitude();
+        hit.point = closest;
+        hit.normal = len > 1e-6f ? normal / len : -direction.normalized();
+        hit.distance = best;
         return true;
     }
 
+    // タイルや三角形ごとの接触をまとめる
+    // 隣り合うタイルの継ぎ目や三角形の辺で同じ向きの接触が重ならないよう、法線の近いものは深い方だけを残す
+    struct MergedContacts_
+    {
+        static constexpr float sameNormalDot = 0.7f;
+
+        std::array<Contact, 4> contacts;
+        std::array<Bounds, 4> tiles;    // TilemapCollider のときの接触したセル
+        int count = 0;
+
+        // m の1点目を追加する
+        void add(const ContactManifold& m, const Bounds& tile = Bounds())
+        {
+            const Contact& c = m.contacts[0];
+            int slot = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                if (Dot(contacts[i].normal, c.normal) > sameNormalDot)
+                {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot < 0)
+            {
+                if (count < int(contacts.size()))
+                {
+                    slot = count++;
+                    contacts[slot] = c;
+                    tiles[slot] = tile;
+                    return;
+                }
+                // 空きがなければいちばん浅いものと比べる
+                slot = 0;
+                for (int i = 1; i < count; ++i)
+                {
+                    if (contacts[i].penetration < contacts[slot].penetration) slot = i;
+                }
+            }
+            if (c.penetration > contacts[slot].penetration)
+            {
+                contacts[slot] = c;
+                tiles[slot] = tile;
+            }
+        }
+
+        bool write(ContactManifold& m) const
+        {
+            for (int i = 0; i < count; ++i) m.contacts[i] = contacts[i];
+            m.numContacts = count;
+            return count > 0;
+        }
+    };
+
 }
 
 
@@ -163,19 +524,59 @@ namespace UniDx
     }
 
 
+    // 球との重なりチェック
+    bool AABBCollider::intersectsSphere(Vector3 sphereCenter, float sphereRadius)
+    {
+        return checkTrigger_(sphereCenter, sphereRadius, getBounds());
+    }
+
+
+    // 箱との重なりチェック
+    bool AABBCollider::intersectsBox(const Bounds& box)
+    {
+        return getBounds().Intersects(box);
+    }
+
+
     // 衝突チェック
-    // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-    bool AABBCollider::checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor)
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool AABBCollider::checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
     {
         return false;
     }
 
 
     // 衝突チェック
-    // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-    bool AABBCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor)
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool AABBCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return checkIntersect_(other, this, otherActor, myActor, corrections);
+    }
+
+
+    // 接触点の生成
+    bool AABBCollider::generateContacts(Collider* other, float margin, ContactManifold& m)
+    {
+        // 相手の型で呼び分けたあと、法線を this から other の向きに戻す
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // 接触点の生成
+    bool AABBCollider::generateContacts(SphereCollider* other, float margin, ContactManifold& m)
+    {
+        if (!contactSphereBox_(other->transform->TransformPoint(other->center), other->radius, getBounds(), margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // 接触点の生成
+    bool AABBCollider::generateContacts(AABBCollider* other, float margin, ContactManifold& m)
     {
-        return checkIntersect_(other, this, otherActor, myActor);
+        return contactBoxBox_(getBounds(), other->getBounds(), margin, m);
     }
 
 
@@ -185,104 +586,69 @@ namespace UniDx
     //
     bool AABBCollider::Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
     {
-        const float eps = 1e-6f;
         Bounds b = getBounds();
+        if (!AABBGeometory::raycast(b.min(), b.max(), origin, direction, maxDistance, hitInfo)) return false;
 
-        // origin が内部にある場合は Unity と同様に無視する
-        if (b.SqrDistance(origin) <= eps * eps)
-        {
-            return false;
-        }
+        if (hitInfo) hitInfo->collider = this;
+        return true;
+    }
 
-        Vector3 bmin = b.min();
-        Vector3 bmax = b.max();
 
-        float tmin = 0.0f;
-        float tmax = maxDistance;
+    //
+    // SphereCast 実装（AABB）
+    // - 始点で重なっていれば無視する
+    //
+    bool AABBCollider::SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        if (!sphereCastBox_(getBounds(), origin, radius, direction, maxDistance, hitInfo)) return false;
 
-        // X axis
-        if (fabs(direction.x) < eps)
-        {
-            if (origin.x < bmin.x || origin.x > bmax.x) return false;
-        }
-        else
-        {
-            float inv = 1.0f / direction.x;
-            float t1 = (bmin.x - origin.x) * inv;
-            float t2 = (bmax.x - origin.x) * inv;
-            float tn = std::min(t1, t2);
-            float tf = std::max(t1, t2);
-            tmin = std::max(tmin, tn);
-            tmax = std::min(tmax, tf);
-            if (tmin > tmax) return false;
-        }
+        if (hitInfo) hitInfo->collider = this;
+        return true;
+    }
 
-        // Y axis
-        if (fabs(direction.y) < eps)
-        {
-            if (origin.y < bmin.y || origin.y > bmax.y) return false;
-        }
-        else
-        {
-            float inv = 1.0f / direction.y;
-            float t1 = (bmin.y - origin.y) * inv;
-            float t2 = (bmax.y - origin.y) * inv;
-            float tn = std::min(t1, t2);
-            float tf = std::max(t1, t2);
-            tmin = std::max(tmin, tn);
-            tmax = std::min(tmax, tf);
-            if (tmin > tmax) return false;
-        }
 
-        // Z axis
-        if (fabs(direction.z) < eps)
-        {
-            if (origin.z < bmin.z || origin.z > bmax.z) return false;
-        }
-        else
-        {
-            float inv = 1.0f / direction.z;
-            float t1 = (bmin.z - origin.z) * inv;
-            float t2 = (bmax.z - origin.z) * inv;
-            float tn = std::min(t1, t2);
-            float tf = std::max(t1, t2);
-            tmin = std::max(tmin, tn);
-            tmax = std::min(tmax, tf);
-            if (tmin > tmax) return false;
-        }
+    // トリガーチェック
+    bool AABBCollider::intersects(TilemapCollider* other)
+    {
+        return other->intersects(this);
+    }
 
-        float tHit = tmin;
-        if (tHit < 0.0f) tHit = 0.0f;
 
-        if (tHit <= maxDistance)
-        {
-            if (hitInfo)
-            {
-                Vector3 hitPoint = origin + direction * tHit;
-
-                Vector3 normal = Vector3::zero;
-                const float normEps = 1e-3f;
-                if (fabs(hitPoint.x - bmin.x) < normEps) normal = Vector3(-1, 0, 0);
-                else if (fabs(hitPoint.x - bmax.x) < normEps) normal = Vector3(1, 0, 0);
-                else if (fabs(hitPoint.y - bmin.y) < normEps) normal = Vector3(0, -1, 0);
-                else if (fabs(hitPoint.y - bmax.y) < normEps) normal = Vector3(0, 1, 0);
-                else if (fabs(hitPoint.z - bmin.z) < normEps) normal = Vector3(0, 0, -1);
-                else if (fabs(hitPoint.z - bmax.z) < normEps) normal = Vector3(0, 0, 1);
-                else
-                {
-                    Vector3 invDir = -direction;
-                    float len = std::sqrt(invDir.x * invDir.x + invDir.y * invDir.y + invDir.z * invDir.z);
-                    if (len > eps) normal = invDir / len;
-                }
+    // 衝突チェック
+    // 箱と箱の補正はしないので、タイルとも補正しない
+    bool AABBCollider::checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return false;
+    }
+
+
+    // 接触点の生成
+    bool AABBCollider::generateContacts(TilemapCollider* other, float margin, ContactManifold& m)
+    {
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // トリガーチェック
+    bool AABBCollider::intersects(MeshCollider* other)
+    {
+        return other->intersects(this);
+    }
+
+
+    // 衝突チェック
+    // 箱とメッシュの補正はしない
+    bool AABBCollider::checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return false;
+    }
 
-                hitInfo->collider = this;
-                hitInfo->point = hitPoint;
-                hitInfo->normal = normal;
-                hitInfo->distance = tHit;
-            }
-            return true;
-        }
 
+    // 接触点の生成
+    bool AABBCollider::generateContacts(MeshCollider* other, float margin, ContactManifold& m)
+    {
         return false;
     }
 
@@ -306,65 +672,108 @@ namespace UniDx
     }
 
 
-    // 衝突チェック
-    // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-    bool SphereCollider::checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor)
+    // 球との重なりチェック
+    bool SphereCollider::intersectsSphere(Vector3 sphereCenter, float sphereRadius)
     {
-        return checkIntersect_(this, other, myActor, otherActor);
+        float radiusAB = radius + sphereRadius;
+        return SqrDistance(transform->TransformPoint(center), sphereCenter) <= radiusAB * radiusAB;
     }
 
 
-    // 衝突チェック
-    // 衝突していれば attachedRigidbody に addCorrectPosition(), addCorrectVelocity() で補正する
-    bool SphereCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherShap)
+    // 箱との重なりチェック
+    bool SphereCollider::intersectsBox(const Bounds& box)
     {
-        Vector3 centerA = transform->TransformPoint(center);
-        float radiusA = radius;
-        Vector3 centerB = other->transform->TransformPoint(other->center);
-        float radiusB = other->radius;
+        return checkTrigger_(transform->TransformPoint(center), radius, box);
+    }
 
-        // 中心距離が半径の合計より離れていれば当たっていない
-        if (Distance(centerA, centerB) > radiusA + radiusB)
-            return false;
 
-        // めり込みの深さ
-        float penetration = radiusA + radiusB - Distance(centerA, centerB);
+    // 衝突チェック
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool SphereCollider::checkIntersect(AABBCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return checkIntersect_(this, other, myActor, otherActor, corrections);
+    }
+
 
-        // 中心の差
-        Vector3 sub = centerB - centerA;
+    // 衝突チェック
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool SphereCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherShap, CorrectionBuffer& corrections)
+    {
+        return NarrowphaseBatch::sphereSphere(this, transform->TransformPoint(center),
+            other, other->transform->TransformPoint(other->center), myActor, otherShap, corrections);
+    }
 
-        // それぞれの位置補正
-        Vector3 addB = sub.normalized();
-        addB *= penetration * 0.5f;
 
-        otherShap->addCorrectPosition(addB);
+    // 接触点の生成
+    bool SphereCollider::generateContacts(Collider* other, float margin, ContactManifold& m)
+    {
+        // 相手の型で呼び分けたあと、法線を this から other の向きに戻す
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
 
-        Vector3 addA = (-sub).normalized();
-        addA *= penetration * 0.5f;
 
-        myActor->addCorrectPosition(addA);
+    // 接触点の生成
+    bool SphereCollider::generateContacts(SphereCollider* other, float margin, ContactManifold& m)
+    {
+        return contactSphereSphere_(transform->TransformPoint(center), radius,
+            other->transform->TransformPoint(other->center), other->radius, margin, m);
+    }
 
-        // 跳ね返り計算
-        Vector3 va = attachedRigidbody->linearVelocity;
-        Vector3 vb = other->attachedRigidbody->linearVelocity;
 
-        // 相対速度
-        Vector3 relV = va - vb;
+    // 接触点の生成
+    bool SphereCollider::generateContacts(AABBCollider* other, float margin, ContactManifold& m)
+    {
+        return contactSphereBox_(transform->TransformPoint(center), radius, other->getBounds(), margin, m);
+    }
 
-        Vector3 normal = sub.normalized();
-        if (Dot(relV, normal) < 0)
-        {
-            return false;
-        }
 
-        // 跳ね返り係数
-        float bounce = bounciness * other->bounciness;
+    // トリガーチェック
+    bool SphereCollider::intersects(TilemapCollider* other)
+    {
+        return other->intersects(this);
+    }
 
-        Vector3 relVNormal = normal * Dot(relV, normal);
-        myActor->addCorrectVelocity(relVNormal * -bounce);
-        otherShap->addCorrectVelocity(relVNormal * bounce);
 
-        return true;
+    // 衝突チェック
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool SphereCollider::checkIntersect(TilemapCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return other->checkIntersect(this, otherActor, myActor, corrections);
+    }
+
+
+    // 接触点の生成
+    bool SphereCollider::generateContacts(TilemapCollider* other, float margin, ContactManifold& m)
+    {
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // トリガーチェック
+    bool SphereCollider::intersects(MeshCollider* other)
+    {
+        return other->intersects(this);
+    }
+
+
+    // 衝突チェック
+    // 衝突していれば attachedRigidbody の補正を corrections に記録する
+    bool SphereCollider::checkIntersect(MeshCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        return other->checkIntersect(this, otherActor, myActor, corrections);
+    }
+
+
+    // 接触点の生成
+    bool SphereCollider::generateContacts(MeshCollider* other, float margin, ContactManifold& m)
+    {
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
     }
 
 
@@ -373,46 +782,48 @@ namespace UniDx
     // - 始点がコライダー内部なら無視する
     //
     bool SphereCollider::Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        if (!SpheresGeometory::raycast(transform->TransformPoint(center), radius, origin, direction, maxDistance, hitInfo)) return false;
+
+        if (hitInfo) hitInfo->collider = this;
+        return true;
+    }
+
+
+    //
+    // SphereCast 実装（Sphere）
+    // - 半径の合計の球に対するレイキャストとして解く
+    // - 始点で重なっていれば無視する
+    //
+    bool SphereCollider::SphereCast(Vector3 origin, float castRadius, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
     {
         const float eps = 1e-6f;
         Vector3 centerWorld = transform->TransformPoint(center);
+        float radiusSum = radius + castRadius;
 
-        // origin が内部にある場合は無視
-        float distSqr = SqrDistance(origin, centerWorld);
-        if (distSqr <= radius * radius)
-        {
-            return false;
-        }
-
-        // 二次方程式: (d·d)t^2 + 2(d·oc)t + (oc·oc - r^2) = 0
         Vector3 oc = origin - centerWorld;
+        float c = Dot(oc, oc) - radiusSum * radiusSum;
+        if (c <= 0.0f) return false;
+
         float a = Dot(direction, direction);
+        if (a < eps * eps) return false;
         float b = 2.0f * Dot(direction, oc);
-        float c = Dot(oc, oc) - radius * radius;
 
         float disc = b * b - 4.0f * a * c;
         if (disc < 0.0f) return false;
 
-        float sqrtD = std::sqrt(disc);
-        float t0 = (-b - sqrtD) / (2.0f * a);
-        float t1 = (-b + sqrtD) / (2.0f * a);
-
-        float t = std::numeric_limits<float>::infinity();
-        if (t0 >= 0.0f) t = t0;
-        else if (t1 >= 0.0f) t = t1; // origin 内部なら除外済みなので通常はこちらは有効になることは少ない
-
+        float t = (-b - std::sqrt(disc)) / (2.0f * a);
         if (!(t >= 0.0f) || t > maxDistance) return false;
 
         if (hitInfo)
         {
-            Vector3 hitPoint = origin + direction * t;
-            Vector3 normal = hitPoint - centerWorld;
+            Vector3 normal = origin + direction * t - centerWorld;
             float len = normal.magnitude();
             if (len > eps) normal /= len;
             else normal = Vector3(1, 0, 0);
 
             hitInfo->collider = this;
-            hitInfo->point = hitPoint;
+            hitInfo->point = centerWorld + normal * radius;
             hitInfo->normal = normal;
             hitInfo->distance = t;
         }
@@ -420,6 +831,611 @@ namespace UniDx
         return true;
     }
 
+    // --------------------
+    // TilemapCollider
+    // --------------------
+
+    // range と重なる埋まったセルごとに f(セルの空間境界) を呼ぶ
+    template<typename F>
+    bool TilemapCollider::forEachSolidTile(const Bounds& range, F&& f) const
+    {
+        Vector3 gridMin, cell;
+        getGrid(gridMin, cell);
+
+        Vector3 mn = range.min();
+        Vector3 mx = range.max();
+        if (mx.y < gridMin.y || mn.y > gridMin.y + cell.y) return false;
+
+        const int x0 = std::max(tileIndex_(mn.x, gridMin.x, cell.x, width), 0);
+        const int x1 = std::min(tileIndex_(mx.x, gridMin.x, cell.x, width), width - 1);
+        const int z0 = std::max(tileIndex_(mn.z, gridMin.z, cell.z, depth), 0);
+        const int z1 = std::min(tileIndex_(mx.z, gridMin.z, cell.z, depth), depth - 1);
+        const Vector3 extents = cell * 0.5f;
+        for (int z = z0; z <= z1; ++z)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                if (tiles[x + z * width] == 0) continue;
+                if (f(Bounds(gridMin + Vector3(x * cell.x, 0, z * cell.z) + extents, extents))) return true;
+            }
+        }
+        return false;
+    }
+
+
+    // 格子の大きさを変えて、すべてのセルを solid の状態にする
+    void TilemapCollider::resize(int w, int d, bool solid)
+    {
+        width = std::max(w, 0);
+        depth = std::max(d, 0);
+        tiles.assign(size_t(width) * depth, solid ? 1 : 0);
+    }
+
+
+    // セル (x, z) を埋める・空ける
+    void TilemapCollider::setTile(int x, int z, bool solid)
+    {
+        if (x < 0 || x >= width || z < 0 || z >= depth) return;
+        tiles[x + z * width] = solid ? 1 : 0;
+    }
+
+
+    // セル (x, z) が埋まっているか
+    bool TilemapCollider::isSolid(int x, int z) const
+    {
+        if (x < 0 || x >= width || z < 0 || z >= depth) return false;
+        return tiles[x + z * width] != 0;
+    }
+
+
+    // ワールド空間での格子の最小の角とセルの大きさ
+    void TilemapCollider::getGrid(Vector3& gridMin, Vector3& cell) const
+    {
+        gridMin = transform->position + transform->TransformVector(center);
+        cell = transform->TransformVector(cellSize);
+    }
+
+
+    // セル (x, z) のワールド空間における空間境界
+    Bounds TilemapCollider::getTileBounds(int x, int z) const
+    {
+        Vector3 gridMin, cell;
+        getGrid(gridMin, cell);
+        const Vector3 extents = cell * 0.5f;
+        return Bounds(gridMin + Vector3(x * cell.x, 0, z * cell.z) + extents, extents);
+    }
+
+
+    // ワールド空間における空間境界を取得
+    Bounds TilemapCollider::getBounds() const
+    {
+        Vector3 gridMin, cell;
+        getGrid(gridMin, cell);
+        const Vector3 extents(width * cell.x * 0.5f, cell.y * 0.5f, depth * cell.z * 0.5f);
+        return Bounds(gridMin + extents, extents);
+    }
+
+
+    // トリガーチェック
+    bool TilemapCollider::intersects(SphereCollider* other)
+    {
+        return intersectsSphere(other->transform->TransformPoint(other->center), other->radius);
+    }
+
+
+    // トリガーチェック
+    bool TilemapCollider::intersects(AABBCollider* other)
+    {
+        return intersectsBox(other->getBounds());
+    }
+
+
+    // 球との重なりチェック
+    bool TilemapCollider::intersectsSphere(Vector3 sphereCenter, float sphereRadius)
+    {
+        return forEachSolidTile(Bounds(sphereCenter, Vector3(sphereRadius, sphereRadius, sphereRadius)),
+            [&](const Bounds& tile) { return checkTrigger_(sphereCenter, sphereRadius, tile); });
+    }
+
+
+    // 箱との重なりチェック
+    bool TilemapCollider::intersectsBox(const Bounds& box)
+    {
+        return forEachSolidTile(box, [&](const Bounds& tile) { return tile.Intersects(box); });
+    }
+
+
+    // 衝突チェック
+    // 重なっているセルを箱として、AABBCollider と同じ式で補正する
+    bool TilemapCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        Vector3 sphereCenter = other->transform->TransformPoint(other->center);
+        float r = other->radius;
+
+        MergedContacts_ found;
+        ContactManifold m;
+        forEachSolidTile(Bounds(sphereCenter, Vector3(r, r, r)), [&](const Bounds& tile)
+            {
+                if (contactSphereBox_(sphereCenter, r, tile, 0.0f, m)) found.add(m, tile);
+                return false;
+            });
+
+        bool hit = false;
+        for (int i = 0; i < found.count; ++i)
+        {
+            if (NarrowphaseBatch::sphereAABB(other, sphereCenter, this, found.tiles[i].min(), found.tiles[i].max(),
+                otherActor, myActor, corrections))
+            {
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+
+    // 接触点の生成
+    bool TilemapCollider::generateContacts(Collider* other, float margin, ContactManifold& m)
+    {
+        // 相手の型で呼び分けたあと、法線を this から other の向きに戻す
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // 接触点の生成
+    bool TilemapCollider::generateContacts(SphereCollider* other, float margin, ContactManifold& m)
+    {
+        Vector3 sphereCenter = other->transform->TransformPoint(other->center);
+        float r = other->radius;
+        float reach = r + std::max(margin, 0.0f);
+
+        MergedContacts_ found;
+        ContactManifold tileContact;
+        forEachSolidTile(Bounds(sphereCenter, Vector3(reach, reach, reach)), [&](const Bounds& tile)
+            {
+                if (contactSphereBox_(sphereCenter, r, tile, margin, tileContact)) found.add(tileContact, tile);
+                return false;
+            });
+        if (!found.write(m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // 接触点の生成
+    bool TilemapCollider::generateContacts(AABBCollider* other, float margin, ContactManifold& m)
+    {
+        Bounds box = other->getBounds();
+        Bounds range = box;
+        range.Expand(std::max(margin, 0.0f) * 2.0f);
+
+        MergedContacts_ found;
+        ContactManifold tileContact;
+        forEachSolidTile(range, [&](const Bounds& tile)
+            {
+                if (contactBoxBox_(tile, box, margin, tileContact)) found.add(tileContact, tile);
+                return false;
+            });
+        return found.write(m);
+    }
+
+
+    //
+    // Raycast 実装（Tilemap）
+    // - XZ 平面でレイが通るセルを近い順にたどり、最初に当たった埋まったセルを返す
+    // - 格子の高さはセル1つ分なので、格子の箱の中ではどのセルでも y の範囲に入っている
+    //
+    bool TilemapCollider::Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        const float eps = 1e-6f;
+        if (width == 0 || depth == 0) return false;
+
+        Vector3 gridMin, cell;
+        getGrid(gridMin, cell);
+        Bounds grid = getBounds();
+
+        float tEnter = 0.0f;
+        float tExit = maxDistance;
+        if (!clipRayBox_(origin, direction, grid.min(), grid.max(), tEnter, tExit)) return false;
+
+        // 格子に入るセル
+        Vector3 start = origin + direction * tEnter;
+        int x = std::clamp(tileIndex_(start.x, gridMin.x, cell.x, width), 0, width - 1);
+        int z = std::clamp(tileIndex_(start.z, gridMin.z, cell.z, depth), 0, depth - 1);
+
+        // 次のセルの境界に着く t と、セル1つ分進む t
+        const int stepX = direction.x > 0 ? 1 : -1;
+        const int stepZ = direction.z > 0 ? 1 : -1;
+        float nextX = infinity, deltaX = infinity;
+        float nextZ = infinity, deltaZ = infinity;
+        if (fabs(direction.x) >= eps)
+        {
+            nextX = (gridMin.x + (x + (stepX > 0 ? 1 : 0)) * cell.x - origin.x) / direction.x;
+            deltaX = cell.x / fabs(direction.x);
+        }
+        if (fabs(direction.z) >= eps)
+        {
+            nextZ = (gridMin.z + (z + (stepZ > 0 ? 1 : 0)) * cell.z - origin.z) / direction.z;
+            deltaZ = cell.z / fabs(direction.z);
+        }
+
+        for (;;)
+        {
+            if (tiles[x + z * width] != 0)
+            {
+                Bounds tile = getTileBounds(x, z);
+                if (AABBGeometory::raycast(tile.min(), tile.max(), origin, direction, maxDistance, hitInfo))
+                {
+                    if (hitInfo) hitInfo->collider = this;
+                    return true;
+                }
+            }
+
+            if (nextX < nextZ)
+            {
+                if (nextX > tExit) break;
+                x += stepX;
+                nextX += deltaX;
+                if (x < 0 || x >= width) break;
+            }
+            else
+            {
+                if (nextZ > tExit) break;
+                z += stepZ;
+                nextZ += deltaZ;
+                if (z < 0 || z >= depth) break;
+            }
+        }
+        return false;
+    }
+
+
+    //
+    // SphereCast 実装（Tilemap）
+    // - 球が通る範囲のセルそれぞれに箱として当て、いちばん近いものを返す
+    // - 始点で重なっていれば無視する
+    //
+    bool TilemapCollider::SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        if (intersectsSphere(origin, radius)) return false;
+
+        // 半径だけ広げた格子の中を通る区間に絞る
+        const Vector3 r(radius, radius, radius);
+        Bounds grid = getBounds();
+        float tEnter = 0.0f;
+        float tExit = maxDistance;
+        if (!clipRayBox_(origin, direction, grid.min() - r, grid.max() + r, tEnter, tExit)) return false;
+
+        Bounds swept(origin + direction * tEnter, r);
+        swept.Encapsulate(Bounds(origin + direction * tExit, r));
+
+        RaycastHit best;
+        best.distance = infinity;
+        forEachSolidTile(swept, [&](const Bounds& tile)
+            {
+                RaycastHit hit;
+                if (sphereCastBox_(tile, origin, radius, direction, maxDistance, &hit) && hit.distance < best.distance)
+                {
+                    best = hit;
+                }
+                return false;
+            });
+        if (!(best.distance < infinity)) return false;
+
+        if (hitInfo)
+        {
+            *hitInfo = best;
+            hitInfo->collider = this;
+        }
+        return true;
+    }
+
+    // --------------------
+    // MeshCollider
+    // --------------------
+
+    // bounds と重なる三角形ごとに f(ワールド座標の頂点 a, b, c) を呼ぶ
+    template<typename F>
+    bool MeshCollider::forEachTriangle(const Bounds& bounds, F&& f) const
+    {
+        if (!bvh || bvh->empty()) return false;
+
+        const Matrix4x4& world = transform->localToWorldMatrix();
+        return bvh->query(toLocalBounds(bounds), [&](int triangle)
+            {
+                Vector3 a, b, c;
+                bvh->getTriangle(triangle, a, b, c);
+                return f(a * world, b * world, c * world);
+            });
+    }
+
+
+    // ワールド空間の bounds を覆うローカル座標の箱
+    Bounds MeshCollider::toLocalBounds(const Bounds& bounds) const
+    {
+        const Matrix4x4 inv = transform->localToWorldMatrix().inverse();
+        const Vector3 mn = bounds.min();
+        const Vector3 mx = bounds.max();
+        Bounds local(Vector3(mn) * inv, Vector3::zero);
+        for (int i = 1; i < 8; ++i)
+        {
+            local.Encapsulate(Vector3(i & 1 ? mx.x : mn.x, i & 2 ? mx.y : mn.y, i & 4 ? mx.z : mn.z) * inv);
+        }
+        return local;
+    }
+
+
+    // メッシュのすべてのサブメッシュ（三角形リスト）から BVH を作る
+    void MeshCollider::SetMesh(const Mesh& mesh)
+    {
+        vector<Vector3> positions;
+        vector<uint32_t> indices;
+        gatherTriangles_(mesh, positions, indices);
+        SetMesh(positions, indices);
+    }
+
+
+    // 位置とインデックス（三角形リスト）から BVH を作る
+    void MeshCollider::SetMesh(std::span<const Vector3> positions, std::span<const uint32_t> indices)
+    {
+        auto built = make_shared<MeshBVH>();
+        built->build(positions, indices);
+        bvh = std::move(built);
+    }
+
+
+    // 書き出した BVH が同じデータから作ったものなら読み込み、違えば作り直して書き出す
+    bool MeshCollider::Bake(const Mesh& mesh, const u8string& cachePath)
+    {
+        // サブメッシュをまとめたデータのハッシュで見分ける
+        vector<Vector3> positions;
+        vector<uint32_t> indices;
+        gatherTriangles_(mesh, positions, indices);
+
+        auto cached = make_shared<MeshBVH>();
+        std::ifstream in(std::filesystem::path(cachePath), std::ios::binary);
+        if (in && cached->load(in) && cached->getSourceHash() == MeshBVH::hashSource(positions, indices))
+        {
+            bvh = std::move(cached);
+            return true;
+        }
+
+        SetMesh(positions, indices);
+        return SaveBVH(cachePath);
+    }
+
+
+    // BVH をファイルに書き出す
+    bool MeshCollider::SaveBVH(const u8string& path) const
+    {
+        if (!bvh) return false;
+        std::ofstream out(std::filesystem::path(path), std::ios::binary);
+        return out && bvh->save(out);
+    }
+
+
+    // BVH をファイルから読み込む
+    bool MeshCollider::LoadBVH(const u8string& path)
+    {
+        std::ifstream in(std::filesystem::path(path), std::ios::binary);
+        if (!in) return false;
+
+        auto loaded = make_shared<MeshBVH>();
+        if (!loaded->load(in)) return false;
+        bvh = std::move(loaded);
+        return true;
+    }
+
+
+    // BVH の三角形数
+    int MeshCollider::GetTriangleCount() const
+    {
+        return bvh ? bvh->triangleCount() : 0;
+    }
+
+
+    // まだ BVH がなければ、同じ GameObject の MeshRenderer のメッシュから作る
+    void MeshCollider::OnEnable()
+    {
+        if (!bvh)
+        {
+            MeshRenderer* renderer = GetComponent<MeshRenderer>();
+            if (renderer != nullptr) SetMesh(renderer->mesh);
+        }
+        Collider::OnEnable();
+    }
+
 
+    // ワールド空間における空間境界を取得
+    Bounds MeshCollider::getBounds() const
+    {
+        if (!bvh || bvh->empty()) return Bounds(transform->position, Vector3::zero);
+
+        const Matrix4x4& world = transform->localToWorldMatrix();
+        const Bounds local = bvh->getBounds();
+        const Vector3 mn = local.min();
+        const Vector3 mx = local.max();
+        Bounds b(mn * world, Vector3::zero);
+        for (int i = 1; i < 8; ++i)
+        {
+            b.Encapsulate(Vector3(i & 1 ? mx.x : mn.x, i & 2 ? mx.y : mn.y, i & 4 ? mx.z : mn.z) * world);
+        }
+        return b;
+    }
+
+
+    // トリガーチェック
+    bool MeshCollider::intersects(SphereCollider* other)
+    {
+        return intersectsSphere(other->transform->TransformPoint(other->center), other->radius);
+    }
+
+
+    // トリガーチェック
+    bool MeshCollider::intersects(AABBCollider* other)
+    {
+        return intersectsBox(other->getBounds());
+    }
+
+
+    // 球との重なりチェック
+    bool MeshCollider::intersectsSphere(Vector3 sphereCenter, float sphereRadius)
+    {
+        return forEachTriangle(Bounds(sphereCenter, Vector3(sphereRadius, sphereRadius, sphereRadius)),
+            [&](Vector3 a, Vector3 b, Vector3 c)
+            {
+                return SqrDistance(closestPointTriangle_(sphereCenter, a, b, c), sphereCenter) <= sphereRadius * sphereRadius;
+            });
+    }
+
+
+    // 箱との重なりチェック
+    bool MeshCollider::intersectsBox(const Bounds& box)
+    {
+        return forEachTriangle(box, [&](Vector3 a, Vector3 b, Vector3 c) { return triangleBox_(a, b, c, box); });
+    }
+
+
+    // 衝突チェック
+    // 重なっている三角形の最近点ごとに、AABBCollider と同じ式で補正する
+    bool MeshCollider::checkIntersect(SphereCollider* other, PhysicsActor* myActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        Vector3 sphereCenter = other->transform->TransformPoint(other->center);
+        float r = other->radius;
+
+        MergedContacts_ found;
+        ContactManifold m;
+        forEachTriangle(Bounds(sphereCenter, Vector3(r, r, r)), [&](Vector3 a, Vector3 b, Vector3 c)
+            {
+                Vector3 closest = closestPointTriangle_(sphereCenter, a, b, c);
+                float dist = Distance(sphereCenter, closest);
+                if (dist > r) return false;
+
+                // 法線は球から三角形へ向ける
+                Vector3 normal = dist > 1e-6f ? (closest - sphereCenter) / dist : -triangleNormal_(a, b, c);
+                setContact_(m, closest, normal, dist - r);
+                found.add(m);
+                return false;
+            });
+
+        bool hit = false;
+        for (int i = 0; i < found.count; ++i)
+        {
+            const Contact& c = found.contacts[i];
+            if (NarrowphaseBatch::sphereClosestPoint(other, sphereCenter, this, c.point, -c.normal, otherActor, myActor, corrections))
+            {
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+
+    // 接触点の生成
+    bool MeshCollider::generateContacts(Collider* other, float margin, ContactManifold& m)
+    {
+        // 相手の型で呼び分けたあと、法線を this から other の向きに戻す
+        if (!other->generateContacts(this, margin, m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    // 接触点の生成
+    bool MeshCollider::generateContacts(SphereCollider* other, float margin, ContactManifold& m)
+    {
+        Vector3 sphereCenter = other->transform->TransformPoint(other->center);
+        float r = other->radius;
+        float reach = r + std::max(margin, 0.0f);
+
+        MergedContacts_ found;
+        ContactManifold triangleContact;
+        forEachTriangle(Bounds(sphereCenter, Vector3(reach, reach, reach)), [&](Vector3 a, Vector3 b, Vector3 c)
+            {
+                Vector3 closest = closestPointTriangle_(sphereCenter, a, b, c);
+                float dist = Distance(sphereCenter, closest);
+                if (dist - r > margin) return false;
+
+                Vector3 normal = dist > 1e-6f ? (closest - sphereCenter) / dist : -triangleNormal_(a, b, c);
+                setContact_(triangleContact, closest, normal, dist - r);
+                found.add(triangleContact);
+                return false;
+            });
+        if (!found.write(m)) return false;
+        flipContacts_(m);
+        return true;
+    }
+
+
+    //
+    // Raycast 実装（Mesh）
+    // - レイをローカル座標に移して BVH をたどる。t は座標変換で変わらない
+    //
+    bool MeshCollider::Raycast(Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        if (!bvh || bvh->empty()) return false;
+
+        const Matrix4x4& world = transform->localToWorldMatrix();
+        const Matrix4x4 inv = world.inverse();
+        float distance;
+        int triangle;
+        if (!bvh->raycast(origin * inv, inv.MultiplyVector(direction), maxDistance, distance, triangle)) return false;
+
+        if (hitInfo)
+        {
+            Vector3 a, b, c;
+            bvh->getTriangle(triangle, a, b, c);
+            Vector3 normal = triangleNormal_(a * world, b * world, c * world);
+            if (Dot(normal, direction) > 0.0f) normal = -normal;
+
+            hitInfo->collider = this;
+            hitInfo->point = origin + direction * distance;
+            hitInfo->normal = normal;
+            hitInfo->distance = distance;
+        }
+        return true;
+    }
+
+
+    //
+    // SphereCast 実装（Mesh）
+    // - 球が通る範囲の三角形それぞれに当て、いちばん近いものを返す
+    // - 始点で重なっていれば無視する
+    //
+    bool MeshCollider::SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        if (intersectsSphere(origin, radius)) return false;
+
+        // 半径だけ広げたメッシュの境界の中を通る区間に絞る
+        const Vector3 r(radius, radius, radius);
+        Bounds bounds = getBounds();
+        float tEnter = 0.0f;
+        float tExit = maxDistance;
+        if (!clipRayBox_(origin, direction, bounds.min() - r, bounds.max() + r, tEnter, tExit)) return false;
+
+        Bounds swept(origin + direction * tEnter, r);
+        swept.Encapsulate(Bounds(origin + direction * tExit, r));
+
+        RaycastHit best;
+        best.distance = infinity;
+        forEachTriangle(swept, [&](Vector3 a, Vector3 b, Vector3 c)
+            {
+                RaycastHit hit;
+                if (sphereCastTriangle_(a, b, c, origin, radius, direction, std::min(maxDistance, best.distance), hit) && hit.distance < best.distance)
+                {
+                    best = hit;
+                }
+                return false;
+            });
+        if (!(best.distance < infinity)) return false;
+
+        if (hitInfo)
+        {
+            *hitInfo = best;
+            hitInfo->collider = this;
+        }
+        return true;
+    }
 
 }
@@ -1,5 +1,6 @@
 ﻿#include "pch.h"
 #include <UniDx/Component.h>
+#include <UniDx/ParallelCommandBuffer.h>
 
 namespace UniDx{
 
@@ -84,6 +85,12 @@ Component::~Component()
 void Destroy(Component* component)
 {
     assert(component != nullptr);
+    if (ParallelCommandBuffer::isRecording())
+    {
+        // ParallelUpdate() の中では記録だけして、並列のフェーズが終わってから
+        ParallelCommandBuffer::destroy(component);
+        return;
+    }
     component->isCalledDestroy = true; // フレームの終わりに削除される
 }
 
@@ -0,0 +1,480 @@
+﻿#include "pch.h"
+#include <DynamicAABBTree.h>
+
+#include <algorithm>
+
+#include <UniDx/Physics.h>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    // outer が inner を完全に含むか
+    bool contains(const Bounds& outer, const Bounds& inner)
+    {
+        Vector3 omin = outer.min(), omax = outer.max();
+        Vector3 imin = inner.min(), imax = inner.max();
+        return omin.x <= imin.x && omin.y <= imin.y && omin.z <= imin.z
+            && imax.x <= omax.x && imax.y <= omax.y && imax.z <= omax.z;
+    }
+
+    // 2つの境界を含む境界
+    Bounds merged(const Bounds& a, const Bounds& b)
+    {
+        Bounds result;
+        result.SetMinMax(Min(a.min(), b.min()), Max(a.max(), b.max()));
+        return result;
+    }
+
+    // 表面積に比例する値。挿入先を選ぶコストに使う
+    float surfaceCost(const Bounds& b)
+    {
+        const Vector3& e = b.extents;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+}
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    DynamicAABBTree::DynamicAABBTree(
+        CheckBoundFunc checkBoundFunc)
+        : Broadphase(checkBoundFunc), root(nullNode), freeList(nullNode), reinsertCount(0)
+    {
+        // ノードはできるだけ再利用し、最初にある程度の数を予約
+        nodes.reserve(128);
+        traverseStack.reserve(64);
+    }
+
+
+    // 登録するShapeを更新
+    void DynamicAABBTree::update(std::span<PhysicsShape> shapes)
+    {
+        reinsertCount = 0;
+        for (auto& shape : shapes)
+        {
+            if (shape.proxyId < 0)
+            {
+                // 新しい葉を作る
+                int leaf = allocateNode();
+                nodes[leaf].shape = &shape;
+                nodes[leaf].bounds = fatBounds(shape.moveBounds);
+                nodes[leaf].layers = shape.layerBit;
+                nodes[leaf].collisionMask = shape.collisionMask;
+                insertLeaf(leaf);
+                shape.proxyId = leaf;
+                reinsertCount++;
+                continue;
+            }
+
+            // vectorの再確保でアドレスが変わるので毎回張り直す
+            TreeNode& node = nodes[shape.proxyId];
+            node.shape = &shape;
+
+            // レイヤーが変わったら祖先のビットを直す
+            if (node.layers != shape.layerBit || node.collisionMask != shape.collisionMask)
+            {
+                node.layers = shape.layerBit;
+                node.collisionMask = shape.collisionMask;
+                for (int i = node.parent; i != nullNode; i = nodes[i].parent)
+                {
+                    mergeChildren(i);
+                }
+            }
+
+            // 太らせた境界に収まっていれば木は変えない
+            // 速く動いた後に止まったなど、境界が大きすぎるようになったときも入れ直す
+            const Vector3 slack = node.bounds.extents - shape.moveBounds.extents;
+            const float maxSlack = margin * 4.0f;
+            if (contains(node.bounds, shape.moveBounds)
+                && slack.x <= maxSlack && slack.y <= maxSlack && slack.z <= maxSlack)
+            {
+                continue;
+            }
+
+            removeLeaf(shape.proxyId);
+            nodes[shape.proxyId].bounds = fatBounds(shape.moveBounds);
+            insertLeaf(shape.proxyId);
+            reinsertCount++;
+        }
+    }
+
+
+    // Shapeを木から取り除く
+    void DynamicAABBTree::remove(PhysicsShape& shape)
+    {
+        if (shape.proxyId < 0) return;
+
+        removeLeaf(shape.proxyId);
+        freeNode(shape.proxyId);
+        shape.proxyId = -1;
+    }
+
+
+    // 衝突する可能性のあるペアを集める
+    // 木と木自身を同時にたどり、境界の重なる葉のペアだけを渡す
+    void DynamicAABBTree::gatherPairs()
+    {
+        if (root == nullNode) return;
+
+        traverseStack.clear();
+        traverseStack.push_back({ root, root });
+        while (!traverseStack.empty())
+        {
+            auto [ia, ib] = traverseStack.back();
+            traverseStack.pop_back();
+
+            const TreeNode& a = nodes[ia];
+            if (ia == ib)
+            {
+                // 同じ部分木の中のペア。衝突するレイヤーの組み合わせがなければ降りない
+                if (a.isLeaf() || (a.collisionMask & a.layers) == 0) continue;
+                traverseStack.push_back({ a.child1, a.child1 });
+                traverseStack.push_back({ a.child2, a.child2 });
+                traverseStack.push_back({ a.child1, a.child2 });
+                continue;
+            }
+
+            const TreeNode& b = nodes[ib];
+            if ((a.collisionMask & b.layers) == 0) continue;
+            if (!a.bounds.Intersects(b.bounds)) continue;
+
+            if (a.isLeaf() && b.isLeaf())
+            {
+                checkBoundF(a.shape, b.shape);
+            }
+            else if (b.isLeaf() || (!a.isLeaf() && a.height >= b.height))
+            {
+                // 高いほうを降りる
+                traverseStack.push_back({ a.child1, ib });
+                traverseStack.push_back({ a.child2, ib });
+            }
+            else
+            {
+                traverseStack.push_back({ ia, b.child1 });
+                traverseStack.push_back({ ia, b.child2 });
+            }
+        }
+    }
+
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    // 近い子を後に積んで先に取り出し、見つかった当たりより遠い枝は捨てる
+    void DynamicAABBTree::raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const
+    {
+        float enter;
+        if (root == nullNode || !RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[root].bounds, enter)) return;
+
+        // 複数スレッドから呼ばれるので作業領域はローカルに持つ
+        std::vector<std::pair<float, int>> stack;
+        stack.reserve(64);
+        stack.emplace_back(enter, root);
+        while (!stack.empty())
+        {
+            auto [t, index] = stack.back();
+            stack.pop_back();
+            if (t > maxDistance) continue;
+
+            const TreeNode& node = nodes[index];
+            if (node.isLeaf())
+            {
+                maxDistance = std::min(maxDistance, func(node.shape, t, maxDistance));
+                continue;
+            }
+
+            float t1, t2;
+            const bool hit1 = RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[node.child1].bounds, t1);
+            const bool hit2 = RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[node.child2].bounds, t2);
+            if (hit1 && hit2)
+            {
+                if (t1 <= t2)
+                {
+                    stack.emplace_back(t2, node.child2);
+                    stack.emplace_back(t1, node.child1);
+                }
+                else
+                {
+                    stack.emplace_back(t1, node.child1);
+                    stack.emplace_back(t2, node.child2);
+                }
+            }
+            else if (hit1)
+            {
+                stack.emplace_back(t1, node.child1);
+            }
+            else if (hit2)
+            {
+                stack.emplace_back(t2, node.child2);
+            }
+        }
+    }
+
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool DynamicAABBTree::query(const Bounds& bounds, const QueryFunc& func) const
+    {
+        if (root == nullNode) return true;
+
+        std::vector<int> stack;
+        stack.reserve(64);
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            const TreeNode& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!MayIntersect(node.bounds, bounds)) continue;
+
+            if (node.isLeaf())
+            {
+                if (!func(node.shape)) return false;
+            }
+            else
+            {
+                stack.push_back(node.child2);
+                stack.push_back(node.child1);
+            }
+        }
+        return true;
+    }
+
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t DynamicAABBTree::getMemoryUsage() const
+    {
+        return CapacityBytes(nodes) + CapacityBytes(traverseStack);
+    }
+
+
+    // ノードを確保する（内部では再利用する）
+    int DynamicAABBTree::allocateNode()
+    {
+        int index;
+        if (freeList == nullNode)
+        {
+            index = int(nodes.size());
+            nodes.emplace_back();
+        }
+        else
+        {
+            index = freeList;
+            freeList = nodes[index].parent;
+        }
+
+        TreeNode& node = nodes[index];
+        node.shape = nullptr;
+        node.parent = nullNode;
+        node.child1 = nullNode;
+        node.child2 = nullNode;
+        node.height = 0;
+        return index;
+    }
+
+
+    // ノードを空きに戻す
+    void DynamicAABBTree::freeNode(int index)
+    {
+        nodes[index].shape = nullptr;
+        nodes[index].parent = freeList;
+        nodes[index].height = -1;
+        freeList = index;
+    }
+
+
+    // 葉を挿入。表面積が最も増えない兄弟を探して枝を作る
+    void DynamicAABBTree::insertLeaf(int leaf)
+    {
+        if (root == nullNode)
+        {
+            root = leaf;
+            nodes[root].parent = nullNode;
+            return;
+        }
+
+        const Bounds leafBounds = nodes[leaf].bounds;
+        int index = root;
+        while (!nodes[index].isLeaf())
+        {
+            const TreeNode& node = nodes[index];
+            const float area = surfaceCost(node.bounds);
+            const float combinedArea = surfaceCost(merged(node.bounds, leafBounds));
+
+            // ここに兄弟として置くコストと、下に降りるときに祖先が広がるコスト
+            const float cost = 2.0f * combinedArea;
+            const float inheritanceCost = 2.0f * (combinedArea - area);
+
+            auto childCost = [&](int child)
+            {
+                const TreeNode& c = nodes[child];
+                float newArea = surfaceCost(merged(c.bounds, leafBounds));
+                return (c.isLeaf() ? newArea : newArea - surfaceCost(c.bounds)) + inheritanceCost;
+            };
+            const float cost1 = childCost(node.child1);
+            const float cost2 = childCost(node.child2);
+
+            if (cost < cost1 && cost < cost2) break;
+            index = cost1 < cost2 ? node.child1 : node.child2;
+        }
+
+        // 兄弟と葉をまとめる枝を作る
+        const int sibling = index;
+        const int oldParent = nodes[sibling].parent;
+        const int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        mergeChildren(newParent);
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if (oldParent == nullNode)
+        {
+            root = newParent;
+        }
+        else if (nodes[oldParent].child1 == sibling)
+        {
+            nodes[oldParent].child1 = newParent;
+        }
+        else
+        {
+            nodes[oldParent].child2 = newParent;
+        }
+
+        refitAncestors(nodes[leaf].parent);
+    }
+
+
+    // 葉を取り除く。親の枝は兄弟で置き換えて捨てる
+    void DynamicAABBTree::removeLeaf(int leaf)
+    {
+        if (leaf == root)
+        {
+            root = nullNode;
+            return;
+        }
+
+        const int parent = nodes[leaf].parent;
+        const int grandParent = nodes[parent].parent;
+        const int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+        if (grandParent == nullNode)
+        {
+            root = sibling;
+            nodes[sibling].parent = nullNode;
+            freeNode(parent);
+            return;
+        }
+
+        if (nodes[grandParent].child1 == parent)
+        {
+            nodes[grandParent].child1 = sibling;
+        }
+        else
+        {
+            nodes[grandParent].child2 = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        refitAncestors(grandParent);
+    }
+
+
+    // 指定ノードから根まで、回転で釣り合いを取りながら境界と高さを直す
+    void DynamicAABBTree::refitAncestors(int index)
+    {
+        while (index != nullNode)
+        {
+            index = balance(index);
+
+            TreeNode& node = nodes[index];
+            node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+            mergeChildren(index);
+
+            index = node.parent;
+        }
+    }
+
+
+    // 枝の境界とレイヤーのビットを子から作る
+    void DynamicAABBTree::mergeChildren(int index)
+    {
+        TreeNode& node = nodes[index];
+        const TreeNode& c1 = nodes[node.child1];
+        const TreeNode& c2 = nodes[node.child2];
+        node.bounds = merged(c1.bounds, c2.bounds);
+        node.layers = c1.layers | c2.layers;
+        node.collisionMask = c1.collisionMask | c2.collisionMask;
+    }
+
+
+    // 左右の高さの差が2以上なら、高い側の子を持ち上げる回転をする
+    // 戻り値はこの位置に来たノード
+    int DynamicAABBTree::balance(int iA)
+    {
+        TreeNode& A = nodes[iA];
+        if (A.isLeaf() || A.height < 2) return iA;
+
+        const int iB = A.child1;
+        const int iC = A.child2;
+        TreeNode& B = nodes[iB];
+        TreeNode& C = nodes[iC];
+
+        // 持ち上げる子 up と、残す子 stay、up の子 (高いほう tall と低いほう low)
+        auto rotate = [&](int iUp, int iStay, bool upIsChild2)
+        {
+            TreeNode& up = nodes[iUp];
+            TreeNode& stay = nodes[iStay];
+            const int iF = up.child1;
+            const int iG = up.child2;
+            const bool fTaller = nodes[iF].height > nodes[iG].height;
+            const int iTall = fTaller ? iF : iG;
+            const int iLow = fTaller ? iG : iF;
+
+            // up を A の位置へ
+            up.child1 = iA;
+            up.parent = A.parent;
+            A.parent = iUp;
+            if (up.parent == nullNode)
+            {
+                root = iUp;
+            }
+            else if (nodes[up.parent].child1 == iA)
+            {
+                nodes[up.parent].child1 = iUp;
+            }
+            else
+            {
+                nodes[up.parent].child2 = iUp;
+            }
+
+            // 高いほうの孫は up に残し、低いほうの孫を A に付け替える
+            up.child2 = iTall;
+            if (upIsChild2) A.child2 = iLow; else A.child1 = iLow;
+            nodes[iLow].parent = iA;
+
+            A.height = 1 + std::max(stay.height, nodes[iLow].height);
+            mergeChildren(iA);
+            up.height = 1 + std::max(A.height, nodes[iTall].height);
+            mergeChildren(iUp);
+            return iUp;
+        };
+
+        const int diff = C.height - B.height;
+        if (diff > 1) return rotate(iC, iB, true);
+        if (diff < -1) return rotate(iB, iC, false);
+        return iA;
+    }
+
+
+    // moveBounds を margin だけ太らせた葉の境界
+    Bounds DynamicAABBTree::fatBounds(const Bounds& moveBounds) const
+    {
+        Bounds result = moveBounds;
+        result.Expand(margin * 2.0f);
+        return result;
+    }
+}
@@ -227,9 +227,25 @@ void GameObject::onCollisionExit(const Collision& collision)
 	}
 }
 
+
+void GameObject::onControllerColliderHit(const ControllerColliderHit& hit)
+{
+	for (auto& i : components)
+	{
+		Behaviour* b = dynamic_cast<Behaviour*>(i.get());
+		if(b != nullptr) b->OnControllerColliderHit(hit);
+	}
+}
+
 void Destroy(GameObject* gameObject)
 {
 	assert(gameObject != nullptr);
+	if (ParallelCommandBuffer::isRecording())
+	{
+		// ParallelUpdate() の中では記録だけして、並列のフェーズが終わってから
+		ParallelCommandBuffer::destroy(gameObject);
+		return;
+	}
 	gameObject->isCalledDestroy = true; // フレームの終わりに削除される
 }
 
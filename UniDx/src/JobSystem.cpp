@@ -0,0 +1,237 @@
+﻿#include "pch.h"
+#include <UniDx/JobSystem.h>
+
+#include <WorkStealingDeque.h>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    // このスレッドのキューの番号。キューを持たないスレッドは -1
+    thread_local const JobSystem* currentSystem_ = nullptr;
+    thread_local int queueIndex_ = -1;
+
+    // 盗む相手を選ぶ乱数（xorshift）
+    thread_local uint32_t stealSeed_ = 0;
+
+    uint32_t nextRandom_()
+    {
+        if (stealSeed_ == 0) stealSeed_ = uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u;
+        stealSeed_ ^= stealSeed_ << 13;
+        stealSeed_ ^= stealSeed_ >> 17;
+        stealSeed_ ^= stealSeed_ << 5;
+        return stealSeed_;
+    }
+
+    // 眠る前にジョブを探し直す回数
+    constexpr int spinCount = 64;
+}
+
+
+namespace UniDx
+{
+
+    struct JobSystem::Queue
+    {
+        WorkStealingDeque<Job*> deque;
+    };
+
+
+    // 作ったスレッドをメインスレッドとしてキュー 0 を割り当て、残りのコアにワーカースレッドを立てる
+    JobSystem::JobSystem()
+    {
+        int count = workerThreadCount;
+        if (count <= 0) count = std::max(1, int(std::thread::hardware_concurrency())) - 1;
+
+        queues.push_back(std::make_unique<Queue>());
+        for (int i = 0; i < count; ++i)
+        {
+            queues.push_back(std::make_unique<Queue>());
+        }
+
+        currentSystem_ = this;
+        queueIndex_ = 0;
+
+        threads.reserve(count);
+        for (int i = 0; i < count; ++i)
+        {
+            threads.emplace_back(&JobSystem::workerMain, this, i + 1);
+        }
+    }
+
+
+    // 積まれたジョブをすべて終えてからワーカースレッドを止める
+    JobSystem::~JobSystem()
+    {
+        while (runOne()) {}
+
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+
+        if (currentSystem_ == this)
+        {
+            currentSystem_ = nullptr;
+            queueIndex_ = -1;
+        }
+    }
+
+
+    // ジョブを積む。依存するカウンタが残っていれば、そのカウンタの待ちに入れる
+    void JobSystem::run(JobFunc func, JobCounter* counter, JobCounter* dependency)
+    {
+        Job* job = new Job{ std::move(func), counter };
+        if (counter != nullptr) counter->count.fetch_add(1, std::memory_order_relaxed);
+
+        if (dependency != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(dependency->mutex);
+            if (dependency->count.load(std::memory_order_acquire) > 0)
+            {
+                dependency->waiting.push_back(job);
+                return;
+            }
+        }
+        push(job);
+    }
+
+
+    // counter が 0 になるまで、ほかのジョブを実行して待つ
+    void JobSystem::wait(JobCounter& counter)
+    {
+        while (!counter.isDone())
+        {
+            if (!runOne()) std::this_thread::yield();
+        }
+
+        // 最後のジョブの finish() がカウンタを触り終えるのを待つ。これで戻ったあとは破棄してよい
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+
+    // 自分のキューがあればそこへ、なければ共有のキューへ積んで、眠っているワーカーを起こす
+    void JobSystem::push(Job* job)
+    {
+        if (currentSystem_ == this && queueIndex_ >= 0)
+        {
+            queues[queueIndex_]->deque.push(job);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            injected.push_back(job);
+        }
+
+        pendingJobs.fetch_add(1);
+        if (sleepingWorkers.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+
+    // 自分のキュー、共有のキュー、ほかのキューの順にジョブを探す
+    JobSystem::Job* JobSystem::take()
+    {
+        const int self = currentSystem_ == this ? queueIndex_ : -1;
+        Job* job = nullptr;
+        if (self >= 0)
+        {
+            job = queues[self]->deque.pop();
+        }
+
+        if (job == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            if (!injected.empty())
+            {
+                job = injected.front();
+                injected.pop_front();
+            }
+        }
+
+        if (job == nullptr)
+        {
+            const int count = int(queues.size());
+            const int start = int(nextRandom_() % uint32_t(count));
+            for (int i = 0; i < count && job == nullptr; ++i)
+            {
+                const int victim = (start + i) % count;
+                if (victim != self) job = queues[victim]->deque.steal();
+            }
+        }
+
+        if (job != nullptr) pendingJobs.fetch_sub(1);
+        return job;
+    }
+
+
+    bool JobSystem::runOne()
+    {
+        Job* job = take();
+        if (job == nullptr) return false;
+
+        execute(job);
+        return true;
+    }
+
+
+    void JobSystem::execute(Job* job)
+    {
+        job->func();
+        JobCounter* counter = job->counter;
+        delete job;
+        if (counter != nullptr) finish(counter);
+    }
+
+
+    // カウンタを減らし、0 になったら待っていたジョブを積む
+    // 0 になると待っている側がカウンタを破棄しうるので、減らすのと待ちを取り出すのは同じロックの中で行う
+    void JobSystem::finish(JobCounter* counter)
+    {
+        std::vector<Job*> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex);
+            if (counter->count.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            ready.swap(counter->waiting);
+        }
+        for (Job* job : ready)
+        {
+            push(job);
+        }
+    }
+
+
+    // ワーカースレッド。ジョブがなければしばらく探し直し、それでもなければ積まれるまで眠る
+    void JobSystem::workerMain(int index)
+    {
+        currentSystem_ = this;
+        queueIndex_ = index;
+
+        while (true)
+        {
+            bool found = false;
+            for (int i = 0; i < spinCount && !found; ++i)
+            {
+                found = runOne();
+                if (!found) std::this_thread::yield();
+            }
+            if (found) continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepingWorkers.fetch_add(1);
+            wake.wait(lock, [this]() { return quit.load() || pendingJobs.load() > 0; });
+            sleepingWorkers.fetch_sub(1);
+            if (quit.load() && pendingJobs.load() == 0) return;
+        }
+    }
+
+}
@@ -0,0 +1,456 @@
+﻿#include "pch.h"
+#include <MeshBVH.h>
+
+#include <algorithm>
+#include <limits>
+#include <istream>
+#include <ostream>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    constexpr int binCount = 16;     // SAH で分割位置を探すときのビンの数
+    constexpr int maxDepth = 48;     // 探索のスタックに収まる深さ。超えたら葉にする
+    constexpr uint32_t fileMagic = 0x48564255; // "UBVH"
+    constexpr uint32_t fileVersion = 1;
+
+    // ファイルの先頭
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t positionCount;
+        uint32_t triangleIndexCount;
+        uint32_t nodeCount;
+        uint32_t reserved;
+    };
+
+    float axisOf(Vector3 v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+    // 箱の表面積
+    float area(Vector3 mn, Vector3 mx)
+    {
+        Vector3 d = mx - mn;
+        if (d.x < 0 || d.y < 0 || d.z < 0) return 0.0f;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // レイが箱に入る t。maxDistance までに当たらなければ infinity
+    float rayBox(const MeshBVH::Node& node, Vector3 origin, Vector3 invDir, float maxDistance)
+    {
+        float t1 = (node.minX - origin.x) * invDir.x, t2 = (node.maxX - origin.x) * invDir.x;
+        float tmin = std::min(t1, t2), tmax = std::max(t1, t2);
+        t1 = (node.minY - origin.y) * invDir.y; t2 = (node.maxY - origin.y) * invDir.y;
+        tmin = std::max(tmin, std::min(t1, t2)); tmax = std::min(tmax, std::max(t1, t2));
+        t1 = (node.minZ - origin.z) * invDir.z; t2 = (node.maxZ - origin.z) * invDir.z;
+        tmin = std::max(tmin, std::min(t1, t2)); tmax = std::min(tmax, std::max(t1, t2));
+
+        tmin = std::max(tmin, 0.0f);
+        tmax = std::min(tmax, maxDistance);
+        return tmin <= tmax && tmin < std::numeric_limits<float>::infinity() ? tmin : std::numeric_limits<float>::infinity();
+    }
+
+    // レイと三角形の交差（Möller–Trumbore）。裏面にも当たる
+    bool rayTriangle(Vector3 origin, Vector3 direction, Vector3 a, Vector3 b, Vector3 c, float& t)
+    {
+        Vector3 e1 = b - a;
+        Vector3 e2 = c - a;
+        Vector3 p = Cross(direction, e2);
+        float det = Dot(e1, p);
+        if (std::fabs(det) < 1e-20f) return false;
+
+        float inv = 1.0f / det;
+        Vector3 s = origin - a;
+        float u = Dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f) return false;
+
+        Vector3 q = Cross(s, e1);
+        float v = Dot(direction, q) * inv;
+        if (v < 0.0f || u + v > 1.0f) return false;
+
+        t = Dot(e2, q) * inv;
+        return true;
+    }
+
+    // 今の位置から終わりまでのバイト数。調べられなければ -1
+    std::streamoff remainingBytes(std::istream& in)
+    {
+        const std::streampos pos = in.tellg();
+        if (pos < 0) return -1;
+        in.seekg(0, std::ios::end);
+        const std::streampos end = in.tellg();
+        in.seekg(pos);
+        if (end < pos || !in) return -1;
+        return std::streamoff(end - pos);
+    }
+
+    template<typename T>
+    bool readArray(std::istream& in, std::vector<T>& v, uint32_t count)
+    {
+        v.resize(count);
+        in.read(reinterpret_cast<char*>(v.data()), std::streamsize(count) * sizeof(T));
+        return bool(in);
+    }
+
+    template<typename T>
+    void writeArray(std::ostream& out, const std::vector<T>& v)
+    {
+        out.write(reinterpret_cast<const char*>(v.data()), std::streamsize(v.size()) * sizeof(T));
+    }
+}
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    static_assert(sizeof(Vector3) == sizeof(float) * 3);
+
+
+    void MeshBVH::clear()
+    {
+        positions.clear();
+        triangles.clear();
+        nodes.clear();
+        sourceHash = 0;
+    }
+
+
+    // 位置とインデックス（三角形リスト）から作る
+    void MeshBVH::build(std::span<const Vector3> sourcePositions, std::span<const uint32_t> sourceIndices)
+    {
+        clear();
+        sourceHash = hashSource(sourcePositions, sourceIndices);
+        positions.assign(sourcePositions.begin(), sourcePositions.end());
+
+        // 三角形ごとの境界と重心を集める。範囲外の頂点を指す三角形は捨てる
+        vector<uint32_t> sourceTriangles;
+        vector<BuildItem> items;
+        const size_t indexCount = sourceIndices.empty() ? positions.size() : sourceIndices.size();
+        sourceTriangles.reserve(indexCount / 3 * 3);
+        items.reserve(indexCount / 3);
+        for (size_t i = 0; i + 2 < indexCount; i += 3)
+        {
+            uint32_t v[3];
+            for (int k = 0; k < 3; ++k) v[k] = sourceIndices.empty() ? uint32_t(i + k) : sourceIndices[i + k];
+            if (v[0] >= positions.size() || v[1] >= positions.size() || v[2] >= positions.size()) continue;
+
+            const Vector3 a = positions[v[0]], b = positions[v[1]], c = positions[v[2]];
+            BuildItem item;
+            item.min = Min(Min(a, b), c);
+            item.max = Max(Max(a, b), c);
+            item.centroid = (a + b + c) / 3.0f;
+            item.triangle = uint32_t(sourceTriangles.size() / 3);
+            items.push_back(item);
+            sourceTriangles.insert(sourceTriangles.end(), v, v + 3);
+        }
+        if (items.empty()) return;
+
+        nodes.reserve(items.size() * 2);
+        nodes.emplace_back();
+        buildNode(items, 0, 0, int(items.size()), 0);
+
+        // 葉の順に三角形を並べ替える
+        triangles.resize(items.size() * 3);
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            const uint32_t* v = &sourceTriangles[items[i].triangle * 3];
+            std::copy(v, v + 3, &triangles[i * 3]);
+        }
+    }
+
+
+    // items の [begin, end) でノードを作る
+    void MeshBVH::buildNode(vector<BuildItem>& items, uint32_t nodeIndex, int begin, int end, int depth)
+    {
+        Vector3 mn = items[begin].min, mx = items[begin].max;
+        Vector3 cmin = items[begin].centroid, cmax = items[begin].centroid;
+        for (int i = begin + 1; i < end; ++i)
+        {
+            mn = Min(mn, items[i].min);
+            mx = Max(mx, items[i].max);
+            cmin = Min(cmin, items[i].centroid);
+            cmax = Max(cmax, items[i].centroid);
+        }
+        {
+            Node& node = nodes[nodeIndex];
+            node.minX = mn.x; node.minY = mn.y; node.minZ = mn.z;
+            node.maxX = mx.x; node.maxY = mx.y; node.maxZ = mx.z;
+            node.first = uint32_t(begin);
+            node.count = uint32_t(end - begin);
+        }
+
+        const int count = end - begin;
+        if (count <= maxPerLeaf || depth >= maxDepth) return;
+
+        // 重心の範囲をビンに分けて、左右の (三角形数 * 表面積) の和が最小になる軸と位置を探す
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float lo = axisOf(cmin, axis);
+            const float extent = axisOf(cmax, axis) - lo;
+            if (extent <= 1e-12f) continue;
+            const float scale = binCount / extent;
+
+            int binN[binCount] = {};
+            Vector3 binMin[binCount], binMax[binCount];
+            for (int i = begin; i < end; ++i)
+            {
+                int b = std::min(int((axisOf(items[i].centroid, axis) - lo) * scale), binCount - 1);
+                if (binN[b]++ == 0)
+                {
+                    binMin[b] = items[i].min;
+                    binMax[b] = items[i].max;
+                }
+                else
+                {
+                    binMin[b] = Min(binMin[b], items[i].min);
+                    binMax[b] = Max(binMax[b], items[i].max);
+                }
+            }
+
+            // 右から累積した表面積
+            float rightArea[binCount];
+            int rightN[binCount];
+            Vector3 rmin, rmax;
+            int n = 0;
+            for (int b = binCount - 1; b > 0; --b)
+            {
+                if (binN[b] > 0)
+                {
+                    rmin = n == 0 ? binMin[b] : Min(rmin, binMin[b]);
+                    rmax = n == 0 ? binMax[b] : Max(rmax, binMax[b]);
+                    n += binN[b];
+                }
+                rightN[b] = n;
+                rightArea[b] = n > 0 ? area(rmin, rmax) : 0.0f;
+            }
+
+            Vector3 lmin, lmax;
+            n = 0;
+            for (int b = 0; b < binCount - 1; ++b)
+            {
+                if (binN[b] > 0)
+                {
+                    lmin = n == 0 ? binMin[b] : Min(lmin, binMin[b]);
+                    lmax = n == 0 ? binMax[b] : Max(lmax, binMax[b]);
+                    n += binN[b];
+                }
+                if (n == 0 || rightN[b + 1] == 0) continue;
+                float cost = n * area(lmin, lmax) + rightN[b + 1] * rightArea[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        int mid;
+        if (bestAxis >= 0)
+        {
+            const float lo = axisOf(cmin, bestAxis);
+            const float scale = binCount / (axisOf(cmax, bestAxis) - lo);
+            mid = int(std::partition(items.begin() + begin, items.begin() + end, [&](const BuildItem& item)
+                {
+                    return std::min(int((axisOf(item.centroid, bestAxis) - lo) * scale), binCount - 1) < bestSplit;
+                }) - items.begin());
+        }
+        else
+        {
+            // 重心がすべて重なっているときは半分に分ける
+            mid = begin + count / 2;
+        }
+        if (mid == begin || mid == end) mid = begin + count / 2;
+
+        // 左の子はすぐ後ろ、右の子は左の部分木の後ろに置く
+        const uint32_t left = uint32_t(nodes.size());
+        nodes.emplace_back();
+        buildNode(items, left, begin, mid, depth + 1);
+
+        const uint32_t right = uint32_t(nodes.size());
+        nodes.emplace_back();
+        buildNode(items, right, mid, end, depth + 1);
+
+        nodes[nodeIndex].first = right;
+        nodes[nodeIndex].count = 0;
+    }
+
+
+    // 元の位置とインデックスのハッシュ（FNV-1a）
+    uint64_t MeshBVH::hashSource(std::span<const Vector3> sourcePositions, std::span<const uint32_t> sourceIndices)
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](const void* data, size_t size)
+            {
+                const uint8_t* p = static_cast<const uint8_t*>(data);
+                for (size_t i = 0; i < size; ++i)
+                {
+                    h ^= p[i];
+                    h *= 1099511628211ull;
+                }
+            };
+        const uint64_t sizes[2] = { sourcePositions.size(), sourceIndices.size() };
+        mix(sizes, sizeof(sizes));
+        mix(sourcePositions.data(), sourcePositions.size_bytes());
+        mix(sourceIndices.data(), sourceIndices.size_bytes());
+        return h;
+    }
+
+
+    // 木を書き出す
+    bool MeshBVH::save(std::ostream& out) const
+    {
+        FileHeader header = {};
+        header.magic = fileMagic;
+        header.version = fileVersion;
+        header.sourceHash = sourceHash;
+        header.positionCount = uint32_t(positions.size());
+        header.triangleIndexCount = uint32_t(triangles.size());
+        header.nodeCount = uint32_t(nodes.size());
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeArray(out, positions);
+        writeArray(out, triangles);
+        writeArray(out, nodes);
+        return bool(out);
+    }
+
+
+    // 木を読み込む。壊れていれば空にして false を返す
+    bool MeshBVH::load(std::istream& in)
+    {
+        clear();
+
+        FileHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+        if (header.magic != fileMagic || header.version != fileVersion || header.triangleIndexCount % 3 != 0) return false;
+
+        // 壊れた数のまま確保しないように、残りの長さに収まるかを先に確かめる
+        const uint64_t bytes = uint64_t(header.positionCount) * sizeof(Vector3) +
+            uint64_t(header.triangleIndexCount) * sizeof(uint32_t) +
+            uint64_t(header.nodeCount) * sizeof(Node);
+        const std::streamoff remaining = remainingBytes(in);
+        if (remaining < 0 || bytes > uint64_t(remaining)) return false;
+
+        if (!readArray(in, positions, header.positionCount) ||
+            !readArray(in, triangles, header.triangleIndexCount) ||
+            !readArray(in, nodes, header.nodeCount))
+        {
+            clear();
+            return false;
+        }
+        sourceHash = header.sourceHash;
+
+        // 番号が範囲に収まっているか、探索のスタックに収まる深さかを確かめる
+        // 根以外のノードはちょうど1つの親から、自分より後ろを指されていなければならない
+        // 2つの親から指されると深さを低く数えてしまい、探索のスタックをあふれさせうる
+        bool valid = true;
+        for (uint32_t v : triangles) valid &= v < positions.size();
+        const uint32_t triangleCount = header.triangleIndexCount / 3;
+        vector<uint8_t> depths(nodes.size(), 0);
+        vector<uint8_t> referenced(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size() && valid; ++i)
+        {
+            const Node& node = nodes[i];
+            valid = i == 0 || referenced[i];
+            if (!valid) break;
+
+            if (node.isLeaf())
+            {
+                valid = node.first <= triangleCount && node.count <= triangleCount - node.first;
+            }
+            else
+            {
+                valid = node.first > i + 1 && node.first < nodes.size() && depths[i] < maxDepth &&
+                    !referenced[i + 1] && !referenced[node.first];
+                if (valid)
+                {
+                    referenced[i + 1] = referenced[node.first] = 1;
+                    depths[i + 1] = depths[node.first] = depths[i] + 1;
+                }
+            }
+        }
+        if (!valid)
+        {
+            clear();
+            return false;
+        }
+        return true;
+    }
+
+
+    // 全体の境界（ローカル座標）
+    Bounds MeshBVH::getBounds() const
+    {
+        if (nodes.empty()) return Bounds(Vector3::zero, Vector3::zero);
+        Bounds b;
+        b.SetMinMax(nodes[0].min(), nodes[0].max());
+        return b;
+    }
+
+
+    // レイが最初に当たる三角形を探す
+    bool MeshBVH::raycast(Vector3 origin, Vector3 direction, float maxDistance, float& distance, int& triangle) const
+    {
+        if (nodes.empty()) return false;
+
+        const float big = 1e30f;
+        const Vector3 invDir(
+            std::fabs(direction.x) > 1e-20f ? 1.0f / direction.x : (direction.x < 0 ? -big : big),
+            std::fabs(direction.y) > 1e-20f ? 1.0f / direction.y : (direction.y < 0 ? -big : big),
+            std::fabs(direction.z) > 1e-20f ? 1.0f / direction.z : (direction.z < 0 ? -big : big));
+
+        float best = maxDistance;
+        bool found = false;
+
+        struct Entry { uint32_t node; float t; };
+        Entry stack[64];
+        int top = 0;
+        const float miss = numeric_limits<float>::infinity();
+        float t = rayBox(nodes[0], origin, invDir, best);
+        if (t == miss) return false;
+        stack[top++] = { 0, t };
+
+        while (top > 0)
+        {
+            const Entry e = stack[--top];
+            if (e.t > best) continue;
+
+            const Node& node = nodes[e.node];
+            if (node.isLeaf())
+            {
+                for (uint32_t i = 0; i < node.count; ++i)
+                {
+                    Vector3 a, b, c;
+                    getTriangle(int(node.first + i), a, b, c);
+                    float th;
+                    if (rayTriangle(origin, direction, a, b, c, th) && th >= 0.0f && th <= best)
+                    {
+                        best = th;
+                        triangle = int(node.first + i);
+                        found = true;
+                    }
+                }
+                continue;
+            }
+
+            // 近い子を先に調べるよう、遠い子から積む
+            Entry left = { e.node + 1, rayBox(nodes[e.node + 1], origin, invDir, best) };
+            Entry right = { node.first, rayBox(nodes[node.first], origin, invDir, best) };
+            if (left.t > right.t) std::swap(left, right);
+            if (right.t != miss) stack[top++] = right;
+            if (left.t != miss) stack[top++] = left;
+        }
+
+        if (found) distance = best;
+        return found;
+    }
+
+}
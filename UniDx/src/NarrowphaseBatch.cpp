@@ -0,0 +1,395 @@
+﻿#include "pch.h"
+#include <NarrowphaseBatch.h>
+#include <PhysicsGeometory.h>
+
+#include <limits>
+#include <bit>
+
+#include <UniDx/Collider.h>
+#include <UniDx/Rigidbody.h>
+
+#if UNIDX_BOUNDS_SIMD_AVX2 || UNIDX_BOUNDS_SIMD_SSE2
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+    using namespace UniDx;
+
+    constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    // 距離の判定は応答の計算でやり直すので、まとめて判定するときは少しだけ広めに残す
+    constexpr float nearSlack = 1.0001f;
+}
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    void NarrowphaseBatch::SphereSphereBucket::clear()
+    {
+        pairs.clear();
+        ax.clear(); ay.clear(); az.clear(); ar.clear();
+        bx.clear(); by.clear(); bz.clear(); br.clear();
+    }
+
+    void NarrowphaseBatch::SphereSphereBucket::push_back(int pair, const SpheresGeometory& spheres, int a, int b)
+    {
+        pairs.push_back(pair);
+        Vector3 ca = spheres.center(a);
+        Vector3 cb = spheres.center(b);
+        ax.push_back(ca.x); ay.push_back(ca.y); az.push_back(ca.z); ar.push_back(spheres.radius(a));
+        bx.push_back(cb.x); by.push_back(cb.y); bz.push_back(cb.z); br.push_back(spheres.radius(b));
+    }
+
+    void NarrowphaseBatch::SphereAABBBucket::clear()
+    {
+        pairs.clear();
+        cx.clear(); cy.clear(); cz.clear(); r.clear();
+        minX.clear(); minY.clear(); minZ.clear();
+        maxX.clear(); maxY.clear(); maxZ.clear();
+    }
+
+    void NarrowphaseBatch::SphereAABBBucket::push_back(int pair, const SpheresGeometory& spheres, int sphere, const AABBGeometory& aabbs, int aabb)
+    {
+        pairs.push_back(pair);
+        Vector3 c = spheres.center(sphere);
+        cx.push_back(c.x); cy.push_back(c.y); cz.push_back(c.z); r.push_back(spheres.radius(sphere));
+        Vector3 mn = aabbs.min(aabb);
+        Vector3 mx = aabbs.max(aabb);
+        minX.push_back(mn.x); minY.push_back(mn.y); minZ.push_back(mn.z);
+        maxX.push_back(mx.x); maxY.push_back(mx.y); maxZ.push_back(mx.z);
+    }
+
+
+    // pairs の [begin, end) を判定し、補正と当たったペアの番号をペアの順に記録する
+    void NarrowphaseBatch::run(std::span<const PotentialPair> pairs, int begin, int end,
+        const SpheresGeometory& spheres, const AABBGeometory& aabbs, CorrectionBuffer& corrections, std::vector<int>& hits)
+    {
+        // 形状の組み合わせごとに分ける
+        sphereSpheres.clear();
+        sphereAABBs.clear();
+        others.clear();
+        for (int i = begin; i < end; ++i)
+        {
+            const PhysicsShape& a = *pairs[i].first;
+            const PhysicsShape& b = *pairs[i].second;
+            if (a.shapeType == ShapeType::Sphere && b.shapeType == ShapeType::Sphere)
+            {
+                sphereSpheres.push_back(i, spheres, a.geometory, b.geometory);
+            }
+            else if (a.shapeType == ShapeType::Sphere && b.shapeType == ShapeType::AABB)
+            {
+                sphereAABBs.push_back(i, spheres, a.geometory, aabbs, b.geometory);
+            }
+            else if (a.shapeType == ShapeType::AABB && b.shapeType == ShapeType::Sphere)
+            {
+                sphereAABBs.push_back(i, spheres, b.geometory, aabbs, a.geometory);
+            }
+            else
+            {
+                others.push_back(i);
+            }
+        }
+
+        // 組み合わせごとに距離でまとめて絞り込む
+        gatherSphereSphere();
+        gatherSphereAABB();
+
+        // 残ったものをペアの順に並行して進め、1ペアずつ応答を計算する
+        // 補正を記録する順番が Collider::checkIntersect() を順に呼んだときと同じになる
+        constexpr int none = std::numeric_limits<int>::max();
+        size_t s = 0, a = 0, o = 0;
+        while (true)
+        {
+            const int ps = s < sphereSphereNear.size() ? sphereSpheres.pairs[sphereSphereNear[s]] : none;
+            const int pa = a < sphereAABBNear.size() ? sphereAABBs.pairs[sphereAABBNear[a]] : none;
+            const int po = o < others.size() ? others[o] : none;
+            const int i = std::min({ ps, pa, po });
+            if (i == none) break;
+
+            PhysicsShape* first = pairs[i].first;
+            PhysicsShape* second = pairs[i].second;
+            bool hit;
+            if (i == ps)
+            {
+                // second->checkIntersect(first) と同じ向きで呼ぶ
+                ++s;
+                hit = sphereSphere(static_cast<SphereCollider*>(second->getCollider()), spheres.center(second->geometory),
+                    static_cast<SphereCollider*>(first->getCollider()), spheres.center(first->geometory),
+                    second->actor, first->actor, corrections);
+            }
+            else if (i == pa)
+            {
+                ++a;
+                PhysicsShape* sphere = first->shapeType == ShapeType::Sphere ? first : second;
+                PhysicsShape* aabb = first->shapeType == ShapeType::Sphere ? second : first;
+                hit = sphereAABB(static_cast<SphereCollider*>(sphere->getCollider()), spheres.center(sphere->geometory),
+                    static_cast<AABBCollider*>(aabb->getCollider()), aabbs.min(aabb->geometory), aabbs.max(aabb->geometory),
+                    sphere->actor, aabb->actor, corrections);
+            }
+            else
+            {
+                ++o;
+                hit = first->getCollider()->checkIntersect(second->getCollider(), first->actor, second->actor, corrections);
+            }
+            if (hit)
+            {
+                hits.push_back(i);
+            }
+        }
+    }
+
+
+    // 中心の距離が半径の和より近い球のペアを残す
+    void NarrowphaseBatch::gatherSphereSphere()
+    {
+        sphereSphereNear.clear();
+        const SphereSphereBucket& b = sphereSpheres;
+        const int count = b.size();
+        int i = 0;
+
+#if UNIDX_BOUNDS_SIMD_AVX2
+        // 8ペアずつ判定
+        const __m256 slack = _mm256_set1_ps(nearSlack);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&b.bx[i]), _mm256_loadu_ps(&b.ax[i]));
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&b.by[i]), _mm256_loadu_ps(&b.ay[i]));
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&b.bz[i]), _mm256_loadu_ps(&b.az[i]));
+            __m256 distSqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 rr = _mm256_add_ps(_mm256_loadu_ps(&b.ar[i]), _mm256_loadu_ps(&b.br[i]));
+            __m256 hit = _mm256_cmp_ps(distSqr, _mm256_mul_ps(_mm256_mul_ps(rr, rr), slack), _CMP_LE_OQ);
+            for (unsigned mask = unsigned(_mm256_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                sphereSphereNear.push_back(i + std::countr_zero(mask));
+            }
+        }
+#elif UNIDX_BOUNDS_SIMD_SSE2
+        // 4ペアずつ判定
+        const __m128 slack = _mm_set1_ps(nearSlack);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(&b.bx[i]), _mm_loadu_ps(&b.ax[i]));
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(&b.by[i]), _mm_loadu_ps(&b.ay[i]));
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(&b.bz[i]), _mm_loadu_ps(&b.az[i]));
+            __m128 distSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 rr = _mm_add_ps(_mm_loadu_ps(&b.ar[i]), _mm_loadu_ps(&b.br[i]));
+            __m128 hit = _mm_cmple_ps(distSqr, _mm_mul_ps(_mm_mul_ps(rr, rr), slack));
+            for (unsigned mask = unsigned(_mm_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                sphereSphereNear.push_back(i + std::countr_zero(mask));
+            }
+        }
+#endif
+
+        // 残りは1つずつ
+        for (; i < count; ++i)
+        {
+            float dx = b.bx[i] - b.ax[i];
+            float dy = b.by[i] - b.ay[i];
+            float dz = b.bz[i] - b.az[i];
+            float rr = b.ar[i] + b.br[i];
+            if (dx * dx + dy * dy + dz * dz <= rr * rr * nearSlack)
+            {
+                sphereSphereNear.push_back(i);
+            }
+        }
+    }
+
+
+    // 箱の上の最近点が半径より近い球と箱のペアを残す
+    void NarrowphaseBatch::gatherSphereAABB()
+    {
+        sphereAABBNear.clear();
+        const SphereAABBBucket& b = sphereAABBs;
+        const int count = b.size();
+        int i = 0;
+
+#if UNIDX_BOUNDS_SIMD_AVX2
+        // 8ペアずつ判定
+        const __m256 slack = _mm256_set1_ps(nearSlack);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&b.cx[i]);
+            __m256 cy = _mm256_loadu_ps(&b.cy[i]);
+            __m256 cz = _mm256_loadu_ps(&b.cz[i]);
+            __m256 dx = _mm256_sub_ps(cx, _mm256_max_ps(_mm256_loadu_ps(&b.minX[i]), _mm256_min_ps(cx, _mm256_loadu_ps(&b.maxX[i]))));
+            __m256 dy = _mm256_sub_ps(cy, _mm256_max_ps(_mm256_loadu_ps(&b.minY[i]), _mm256_min_ps(cy, _mm256_loadu_ps(&b.maxY[i]))));
+            __m256 dz = _mm256_sub_ps(cz, _mm256_max_ps(_mm256_loadu_ps(&b.minZ[i]), _mm256_min_ps(cz, _mm256_loadu_ps(&b.maxZ[i]))));
+            __m256 distSqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 r = _mm256_loadu_ps(&b.r[i]);
+            __m256 hit = _mm256_cmp_ps(distSqr, _mm256_mul_ps(_mm256_mul_ps(r, r), slack), _CMP_LE_OQ);
+            for (unsigned mask = unsigned(_mm256_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                sphereAABBNear.push_back(i + std::countr_zero(mask));
+            }
+        }
+#elif UNIDX_BOUNDS_SIMD_SSE2
+        // 4ペアずつ判定
+        const __m128 slack = _mm_set1_ps(nearSlack);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&b.cx[i]);
+            __m128 cy = _mm_loadu_ps(&b.cy[i]);
+            __m128 cz = _mm_loadu_ps(&b.cz[i]);
+            __m128 dx = _mm_sub_ps(cx, _mm_max_ps(_mm_loadu_ps(&b.minX[i]), _mm_min_ps(cx, _mm_loadu_ps(&b.maxX[i]))));
+            __m128 dy = _mm_sub_ps(cy, _mm_max_ps(_mm_loadu_ps(&b.minY[i]), _mm_min_ps(cy, _mm_loadu_ps(&b.maxY[i]))));
+            __m128 dz = _mm_sub_ps(cz, _mm_max_ps(_mm_loadu_ps(&b.minZ[i]), _mm_min_ps(cz, _mm_loadu_ps(&b.maxZ[i]))));
+            __m128 distSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 r = _mm_loadu_ps(&b.r[i]);
+            __m128 hit = _mm_cmple_ps(distSqr, _mm_mul_ps(_mm_mul_ps(r, r), slack));
+            for (unsigned mask = unsigned(_mm_movemask_ps(hit)); mask != 0; mask &= mask - 1)
+            {
+                sphereAABBNear.push_back(i + std::countr_zero(mask));
+            }
+        }
+#endif
+
+        // 残りは1つずつ
+        for (; i < count; ++i)
+        {
+            float dx = b.cx[i] - std::max(b.minX[i], std::min(b.cx[i], b.maxX[i]));
+            float dy = b.cy[i] - std::max(b.minY[i], std::min(b.cy[i], b.maxY[i]));
+            float dz = b.cz[i] - std::max(b.minZ[i], std::min(b.cz[i], b.maxZ[i]));
+            if (dx * dx + dy * dy + dz * dz <= b.r[i] * b.r[i] * nearSlack)
+            {
+                sphereAABBNear.push_back(i);
+            }
+        }
+    }
+
+
+    // 球と箱の衝突の応答。衝突していれば補正を corrections に記録する
+    bool NarrowphaseBatch::sphereAABB(SphereCollider* sphere, Vector3 sphereCenter, Collider* aabb, Vector3 boxMin, Vector3 boxMax,
+        PhysicsActor* sphereActor, PhysicsActor* aabbActor, CorrectionBuffer& corrections)
+    {
+        // AABB上で球中心に最も近い点
+        Vector3 closest(
+            std::max(boxMin.x, std::min(sphereCenter.x, boxMax.x)),
+            std::max(boxMin.y, std::min(sphereCenter.y, boxMax.y)),
+            std::max(boxMin.z, std::min(sphereCenter.z, boxMax.z)));
+
+        return sphereClosestPoint(sphere, sphereCenter, aabb, closest, Vector3(1, 0, 0), sphereActor, aabbActor, corrections);
+    }
+
+
+    // 球と、相手の形状の上で球の中心に最も近い点との衝突の応答
+    bool NarrowphaseBatch::sphereClosestPoint(SphereCollider* sphere, Vector3 sphereCenter, Collider* other, Vector3 closest, Vector3 fallbackNormal,
+        PhysicsActor* sphereActor, PhysicsActor* otherActor, CorrectionBuffer& corrections)
+    {
+        float sphereRadius = sphere->radius;
+
+        // 最近点と球中心のベクトル
+        Vector3 normal = sphereCenter - closest;
+        float distSqr = normal.sqrMagnitude();
+
+        // 衝突していない
+        if (distSqr > sphereRadius * sphereRadius)
+            return false;
+
+        // Rigidbody取得
+        Rigidbody* rbA = sphere->attachedRigidbody;
+        Rigidbody* rbB = other->attachedRigidbody;
+
+        // 相対速度
+        Vector3 velA = rbA ? rbA->linearVelocity : Vector3::zero;
+        Vector3 velB = rbB ? rbB->linearVelocity : Vector3::zero;
+        Vector3 relVel = velA - velB;
+
+        // 相対速度が法線方向（離れようとしている）場合は無視
+        if (Dot(relVel, normal) > 0)
+            return false;
+
+        float dist = std::sqrt(distSqr);
+        // 法線（dist==0のときは適当な軸にする）
+        Vector3 contactNormal = (dist > 1e-6f) ? (normal / dist) : fallbackNormal;
+
+        // penetration（めり込み量）
+        float penetration = sphereRadius - dist;
+
+        // 質量取得（0以下は1.0f扱い）
+        float massA = (rbA && !rbA->isKinematic) ? (rbA->mass > 0.0f ? rbA->mass : 1.0f) : infinity;
+        float massB = (rbB && !rbB->isKinematic) ? (rbB->mass > 0.0f ? rbB->mass : 1.0f) : infinity;
+        float totalMass = massA + massB;
+
+        float massAPerTotal = massA != infinity ? massA / totalMass : 1;
+        float massBPerTotal = massB != infinity ? massB / totalMass : 1;
+
+        // 補正ベクトル
+        Vector3 correctionA = contactNormal * (penetration * massBPerTotal);
+        Vector3 correctionB = -contactNormal * (penetration * massAPerTotal);
+
+        // 位置補正
+        if (rbA && !rbA->isKinematic && massA != infinity) corrections.addCorrectPosition(sphereActor, correctionA);
+        if (rbB && !rbB->isKinematic && massB != infinity) corrections.addCorrectPosition(otherActor, correctionB);
+
+        // 跳ね返り係数
+        float bounce = sphere->bounciness * other->bounciness;
+
+        // 法線方向の速度成分
+        float relVelN = Dot(relVel, contactNormal);
+
+        // 反射させる
+        Vector3 impulse = -(1.0f + bounce) * relVelN * contactNormal;
+
+        if (rbA && !rbA->isKinematic && massA != infinity) corrections.addCorrectVelocity(sphereActor, impulse * massBPerTotal);
+        if (rbB && !rbB->isKinematic && massB != infinity) corrections.addCorrectVelocity(otherActor, -impulse * massAPerTotal);
+
+        return true;
+    }
+
+
+    // 球と球の衝突の応答。衝突していれば補正を corrections に記録する
+    bool NarrowphaseBatch::sphereSphere(SphereCollider* a, Vector3 centerA, SphereCollider* b, Vector3 centerB,
+        PhysicsActor* actorA, PhysicsActor* actorB, CorrectionBuffer& corrections)
+    {
+        float radiusA = a->radius;
+        float radiusB = b->radius;
+
+        // 中心距離が半径の合計より離れていれば当たっていない
+        if (Distance(centerA, centerB) > radiusA + radiusB)
+            return false;
+
+        // めり込みの深さ
+        float penetration = radiusA + radiusB - Distance(centerA, centerB);
+
+        // 中心の差
+        Vector3 sub = centerB - centerA;
+
+        // それぞれの位置補正
+        Vector3 addB = sub.normalized();
+        addB *= penetration * 0.5f;
+
+        corrections.addCorrectPosition(actorB, addB);
+
+        Vector3 addA = (-sub).normalized();
+        addA *= penetration * 0.5f;
+
+        corrections.addCorrectPosition(actorA, addA);
+
+        // 跳ね返り計算。Rigidbody のない球は止まっているものとする
+        Vector3 va = a->attachedRigidbody ? a->attachedRigidbody->linearVelocity : Vector3::zero;
+        Vector3 vb = b->attachedRigidbody ? b->attachedRigidbody->linearVelocity : Vector3::zero;
+
+        // 相対速度
+        Vector3 relV = va - vb;
+
+        Vector3 normal = sub.normalized();
+        if (Dot(relV, normal) < 0)
+        {
+            return false;
+        }
+
+        // 跳ね返り係数
+        float bounce = a->bounciness * b->bounciness;
+
+        Vector3 relVNormal = normal * Dot(relV, normal);
+        corrections.addCorrectVelocity(actorA, relVNormal * -bounce);
+        corrections.addCorrectVelocity(actorB, relVNormal * bounce);
+
+        return true;
+    }
+}
@@ -0,0 +1,129 @@
+﻿#include "pch.h"
+#include <UniDx/ParallelCommandBuffer.h>
+
+#include <UniDx/GameObject.h>
+#include <UniDx/Component.h>
+#include <UniDx/Transform.h>
+
+
+namespace
+{
+    // このスレッドで記録するコマンドの順番
+    thread_local int order_ = 0;
+}
+
+
+namespace UniDx
+{
+
+    void ParallelCommandBuffer::begin()
+    {
+        assert(!isRecording());
+        order_ = 0;
+        recording_.store(true, std::memory_order_release);
+    }
+
+
+    void ParallelCommandBuffer::setOrder(int order)
+    {
+        order_ = order;
+    }
+
+
+    // 積まれた順はスレッドの進み方で変わるので、Behaviour の順に並べ直してから適用する
+    // 同じ Behaviour のコマンドは同じスレッドから積まれるので、stable_sort でその中の順は保たれる
+    void ParallelCommandBuffer::end()
+    {
+        recording_.store(false, std::memory_order_release);
+        order_ = 0;
+
+        std::vector<Command> commands;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            commands.swap(commands_);
+        }
+        std::stable_sort(commands.begin(), commands.end(),
+            [](const Command& a, const Command& b) { return a.order < b.order; });
+
+        for (auto& command : commands)
+        {
+            apply(command);
+        }
+    }
+
+
+    void ParallelCommandBuffer::destroy(GameObject* gameObject)
+    {
+        record({ order_, Kind::DestroyGameObject, gameObject });
+    }
+
+
+    void ParallelCommandBuffer::destroy(Component* component)
+    {
+        record({ order_, Kind::DestroyComponent, nullptr, component });
+    }
+
+
+    void ParallelCommandBuffer::addComponent(GameObject* gameObject, std::unique_ptr<Component> component)
+    {
+        Command command{ order_, Kind::AddComponent, gameObject };
+        command.newComponent = std::move(component);
+        record(std::move(command));
+    }
+
+
+    void ParallelCommandBuffer::setParent(std::unique_ptr<GameObject> gameObject, Transform* newParent)
+    {
+        Command command{ order_, Kind::SetParentNew };
+        command.newParent = newParent;
+        command.newGameObject = std::move(gameObject);
+        record(std::move(command));
+    }
+
+
+    void ParallelCommandBuffer::setParent(Transform* transform, Transform* newParent)
+    {
+        Command command{ order_, Kind::SetParent };
+        command.transform = transform;
+        command.newParent = newParent;
+        record(std::move(command));
+    }
+
+
+    void ParallelCommandBuffer::record(Command&& command)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        commands_.push_back(std::move(command));
+    }
+
+
+    // 記録は終わっているので、ここからはいつもの経路で即座に行われる
+    void ParallelCommandBuffer::apply(Command& command)
+    {
+        switch (command.kind)
+        {
+        case Kind::DestroyGameObject:
+            Destroy(command.gameObject);
+            break;
+        case Kind::DestroyComponent:
+            Destroy(command.component);
+            break;
+        case Kind::AddComponent:
+        {
+            // GameObject::AddComponent() の後半と同じ
+            GameObject* gameObject = command.gameObject;
+            Component* component = command.newComponent.get();
+            gameObject->components.push_back(std::move(command.newComponent));
+            if (IsConnectedToActiveScene(gameObject)) component->checkAwake();
+            break;
+        }
+        case Kind::SetParentNew:
+            Transform::SetParent(std::move(command.newGameObject), command.newParent);
+            break;
+        case Kind::SetParent:
+            command.transform->SetParent(command.newParent);
+            break;
+        }
+    }
+
+}
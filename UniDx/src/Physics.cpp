@@ -6,9 +6,145 @@
 
 #include <UniDx/Collider.h>
 #include <UniDx/Rigidbody.h>
+#include <UniDx/JobSystem.h>
+#include <UniDx/ParallelCommandBuffer.h>
 #include <PhysicsGrid.h>
+#include <DynamicAABBTree.h>
+#include <SweepAndPrune.h>
+#include <StaticAABBTree.h>
+#include <BruteForceBroadphase.h>
+#include <NarrowphaseBatch.h>
+#include <PhysicsGeometory.h>
+#include <PhysicsSlotMap.h>
+
+namespace
+{
+    using namespace UniDx;
+
+    // shapeSlots の group。Shapeが入っている配列
+    constexpr int dynamicGroup = 0;    // physicsShapes
+    constexpr int staticGroup = 1;     // staticShapes
+
+    // Shapeにレイを当てる
+    // 形状のプールに入っているShapeはプールのデータに当て、それ以外は Collider の Raycast を呼ぶ
+    // 始点内部はどちらの場合も除外される
+    bool raycastGeometory_(const SpheresGeometory& spheres, const AABBGeometory& aabbs, PhysicsShape* shape,
+        Vector3 origin, Vector3 direction, float maxDistance, RaycastHit& hit)
+    {
+        if (shape->geometory >= 0)
+        {
+            switch (shape->shapeType)
+            {
+            case ShapeType::Sphere:
+                if (!spheres.raycast(shape->geometory, origin, direction, maxDistance, &hit)) return false;
+                hit.collider = shape->getCollider();
+                return true;
+            case ShapeType::AABB:
+                if (!aabbs.raycast(shape->geometory, origin, direction, maxDistance, &hit)) return false;
+                hit.collider = shape->getCollider();
+                return true;
+            default:
+                break;
+            }
+        }
+        return shape->getCollider()->Raycast(origin, direction, maxDistance, &hit);
+    }
+
+    // Shapeのコライダーにレイを当て、best より近ければ書き換える
+    bool raycastShape_(const SpheresGeometory& spheres, const AABBGeometory& aabbs, PhysicsShape* shape,
+        Vector3 origin, Vector3 direction, float maxDistance, const Physics::ColliderFilter& filter, RaycastHit& best)
+    {
+        Collider* col = shape->getCollider();
+        if (col == nullptr) return false;
+        if (filter && !filter(col)) return false; // フィルタで除外
+
+        RaycastHit hit;
+        if (!raycastGeometory_(spheres, aabbs, shape, origin, direction, maxDistance, hit) || !(hit.distance < best.distance)) return false;
+
+        best = hit;
+        return true;
+    }
+
+    // 連続衝突判定の対象か
+    bool isContinuous_(const Rigidbody* rb)
+    {
+        return rb->collisionDetectionMode == CollisionDetectionMode::Continuous && !rb->isKinematic && !rb->IsSleeping();
+    }
+
+    // 動かせる Rigidbody か。スリープ中と isKinematic のものは連続衝突判定で止めない
+    PhysicsActor* movableActor_(PhysicsShape* shape)
+    {
+        if (shape->actor == nullptr) return nullptr;
+        const Rigidbody* rb = shape->actor->getRigidbody();
+        return (rb->isKinematic || rb->IsSleeping()) ? nullptr : shape->actor;
+    }
+
+    // shape の球を other に対して動かし、ぶつかる割合で shape の timeOfImpact を縮める
+    // other も動いていれば相対的な移動で調べる。止めるのは Continuous を指定した shape だけで、
+    // other の移動は縮めずにソルバに任せる（other も Continuous なら other 側の判定で止まる）
+    void sweepSphere_(PhysicsShape* shape, PhysicsShape* other, float step)
+    {
+        if (shape->shapeType != ShapeType::Sphere || shape->actor == nullptr) return;
+        Rigidbody* rb = shape->actor->getRigidbody();
+        if (!isContinuous_(rb)) return;
+
+        PhysicsActor* otherActor = movableActor_(other);
+        Vector3 move = rb->getMoveVector(step);
+        if (otherActor != nullptr) move -= otherActor->getRigidbody()->getMoveVector(step);
+
+        // 移動が半径以下なら終わりの位置で重なりとして見つかるので、離散の判定に任せる
+        auto sphere = static_cast<SphereCollider*>(shape->getCollider());
+        const float length = move.magnitude();
+        if (length <= sphere->radius) return;
+
+        // 接触として見つかるよう skin だけ食い込ませた位置で止める
+        // 前のステップで止めて食い込んだままの相手にも当たるよう、2 * skin だけ小さい球を動かす
+        // （SphereCast は始めから重なっている相手には当たらない）
+        const float skin = std::min(Physics::contactOffset, 0.25f * sphere->radius);
+        RaycastHit hit;
+        Vector3 center = sphere->transform->TransformPoint(sphere->center);
+        if (!other->getCollider()->SphereCast(center, sphere->radius - 2.0f * skin, move / length, length, &hit)) return;
+
+        const float toi = std::max(0.0f, hit.distance - skin) / length;
+        shape->actor->timeOfImpact = std::min(shape->actor->timeOfImpact, toi);
+    }
+
+    // simulate() のめり込みの戻し方
+    constexpr float linearSlop = 0.005f;            // 残しておくめり込み。接触を保って振動を防ぐ
+    constexpr float baumgarte = 0.2f;               // 1回の反復で戻すめり込みの割合
+    constexpr float maxLinearCorrection = 0.2f;     // 1回の反復で戻す距離の上限
+
+    // カプセルを、軸に沿って半径の半分以下の間隔で並べた球の集まりとして動かす
+    // 球の間のくびれは半径の 3% ほどで、CharacterController::skinWidth の範囲に収まる
+    bool capsuleCast_(Collider* col, Vector3 point1, Vector3 point2, float radius, Vector3 direction, float maxDistance, RaycastHit& hit)
+    {
+        const float length = (point2 - point1).magnitude();
+        const int segments = std::max(1, int(std::ceil(length / (radius * 0.5f))));
+
+        bool hitAny = false;
+        RaycastHit sphereHit;
+        for (int i = 0; i <= segments; ++i)
+        {
+            const Vector3 p = point1 + (point2 - point1) * (float(i) / float(segments));
+            if (col->SphereCast(p, radius, direction, maxDistance, &sphereHit))
+            {
+                hit = sphereHit;
+                maxDistance = sphereHit.distance;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    }
+
+    // 無効な方向や負の距離はヒットしない
+    bool isValidRay_(Vector3 direction, float maxDistance)
+    {
+        const float eps = 1e-6f;
+        if (maxDistance <= 0.0f) return false;
+        return !(fabs(direction.x) < eps && fabs(direction.y) < eps && fabs(direction.z) < eps);
+    }
+}
 
-#define UNIDX_PHYSICS_USE_GRID true
 
 namespace UniDx
 {
@@ -19,38 +155,67 @@ namespace UniDx
     void PhysicsShape::initialize(Collider* collider)
     {
         collider_ = collider;
+        actor = nullptr;
+        shapeType = ShapeType::Other;
+        geometory = -1;
         // moveBounds
     }
 
     // 衝突対象の新旧を調べて OnTrigger～, OnCollidion～ を呼ぶ
-    void PhysicsShape::collideCallback()
+    // 新旧のリストは相手のハンドルの順に並べておき、並行して進めて新規・継続・離脱を振り分ける
+    // sleepingColliders はスリープ中の Rigidbody のコライダーを並べたもの
+    void PhysicsShape::collideCallback(std::span<Collider* const> sleepingColliders)
     {
+        // スリープ中は接触をそのまま保ち、コールバックも呼ばない
+        Rigidbody* rb = getCollider()->attachedRigidbody;
+        if (rb != nullptr && rb->IsSleeping()) return;
+
+        // スリープ中の相手とはペアを作らないので、前の接触が続いているものとして引き継ぐ
+        auto isSleeping = [sleepingColliders](Collider* other)
+        {
+            return std::binary_search(sleepingColliders.begin(), sleepingColliders.end(), other);
+        };
+        for (const auto& other : triggers_)
+        {
+            if (isSleeping(other.collider)) triggersNew_.push_back(other);
+        }
+        for (const auto& col : collisions_)
+        {
+            if (isSleeping(col.collision.collider)) collisionsNew_.push_back(col);
+        }
+
         // トリガーコールバック
-        for (auto other : triggersNew_)
+        auto triggerOrder = [](const TriggerContact& a, const TriggerContact& b) { return a.handle < b.handle; };
+        auto sameTrigger = [](const TriggerContact& a, const TriggerContact& b) { return a.handle == b.handle; };
+        std::sort(triggersNew_.begin(), triggersNew_.end(), triggerOrder);
+        triggersNew_.erase(std::unique(triggersNew_.begin(), triggersNew_.end(), sameTrigger), triggersNew_.end());
+        auto oldTrigger = triggers_.begin();
+        for (const auto& other : triggersNew_)
         {
-            auto inOld = std::ranges::find(triggers_, other);
-            if (inOld == triggers_.end())
+            while (oldTrigger != triggers_.end() && oldTrigger->handle < other.handle) ++oldTrigger;
+            if (oldTrigger == triggers_.end() || oldTrigger->handle != other.handle)
             {
                 // 以前のリストに含まれていない＝新規
-                getCollider()->gameObject->onTriggerEnter(other);
+                getCollider()->gameObject->onTriggerEnter(other.collider);
                 if (!isValid()) return;
             }
-            else
-            {
-                // 以前のリストに含まれていれば、一旦削除
-                triggers_.erase(inOld);
-            }
 
-            // 新しいほうに含まれているので、Stay
-            getCollider()->gameObject->onTriggerStay(other);
+            // 新しいほうに含まれているので、Stay。スリープ中の相手には呼ばない
+            if (isSleeping(other.collider)) continue;
+            getCollider()->gameObject->onTriggerStay(other.collider);
             if (!isValid()) return;
         }
 
-        // 新しいリストになくて古いほうに残っている=離れた
-        for (auto other : triggers_)
+        // 新しいリストになくて古いほうにある=離れた
+        auto newTrigger = triggersNew_.begin();
+        for (const auto& other : triggers_)
         {
-            getCollider()->gameObject->onTriggerExit(other);
-            if (!isValid()) return;
+            while (newTrigger != triggersNew_.end() && newTrigger->handle < other.handle) ++newTrigger;
+            if (newTrigger == triggersNew_.end() || newTrigger->handle != other.handle)
+            {
+                getCollider()->gameObject->onTriggerExit(other.collider);
+                if (!isValid()) return;
+            }
         }
 
         // 古いほうを削除して新しいほうを古いほうに
@@ -58,31 +223,37 @@ namespace UniDx
         std::swap(triggers_, triggersNew_);
 
         // 衝突コールバック
-        for (const auto& collision : collisionsNew_)
+        auto collisionOrder = [](const CollisionContact& a, const CollisionContact& b) { return a.handle < b.handle; };
+        std::stable_sort(collisionsNew_.begin(), collisionsNew_.end(), collisionOrder);
+        auto sameCollision = [](const CollisionContact& a, const CollisionContact& b) { return a.handle == b.handle; };
+        collisionsNew_.erase(std::unique(collisionsNew_.begin(), collisionsNew_.end(), sameCollision), collisionsNew_.end());
+        auto oldCollision = collisions_.begin();
+        for (const auto& col : collisionsNew_)
         {
-            const auto& inOld = std::ranges::find_if(collisions_, [collision](auto i) {return i.collider == collision.collider; });
-            if (inOld == collisions_.end())
+            while (oldCollision != collisions_.end() && oldCollision->handle < col.handle) ++oldCollision;
+            if (oldCollision == collisions_.end() || oldCollision->handle != col.handle)
             {
                 // 以前のリストに含まれていない＝新規
-                getCollider()->gameObject->onCollisionEnter(collision);
+                getCollider()->gameObject->onCollisionEnter(col.collision);
                 if (!isValid()) return;
             }
-            else
-            {
-                // 以前のリストに含まれていれば、一旦削除
-                collisions_.erase(inOld);
-            }
 
-            // 新しいほうに含まれているので、Stay
-            getCollider()->gameObject->onCollisionStay(collision);
+            // 新しいほうに含まれているので、Stay。スリープ中の相手には呼ばない
+            if (isSleeping(col.collision.collider)) continue;
+            getCollider()->gameObject->onCollisionStay(col.collision);
             if (!isValid()) return;
         }
 
-        // 新しいリストになくて古いほうに残っている=離れた
-        for (auto col : collisions_)
+        // 新しいリストになくて古いほうにある=離れた
+        auto newCollision = collisionsNew_.begin();
+        for (const auto& col : collisions_)
         {
-            getCollider()->gameObject->onCollisionExit(col);
-            if (!isValid()) return;
+            while (newCollision != collisionsNew_.end() && newCollision->handle < col.handle) ++newCollision;
+            if (newCollision == collisionsNew_.end() || newCollision->handle != col.handle)
+            {
+                getCollider()->gameObject->onCollisionExit(col.collision);
+                if (!isValid()) return;
+            }
         }
 
         // 古いほうを削除して新しいほうを古いほうに
@@ -91,226 +262,739 @@ namespace UniDx
     }
 
     // コンストラクタ
-    Physics::Physics()
+    Physics::Physics() :
+        broadphaseType(BroadphaseType::BruteForce),
+        queryDirty(true),
+        querySynced(false)
     {
         // 毎フレームクリアされるデータはできるだけ再利用する
         // 最初にある程度の数を予約
         potentialPairs.reserve(128);
         potentialPairsTrigger.reserve(128);
-#if UNIDX_PHYSICS_USE_GRID
-        physicsGrid = make_unique<PhysicsGrid>(MakeMemberAction(this, &Physics::checkBounds));
-#endif
+        setBroadphaseType(BroadphaseType::Grid);
+        staticTree = make_unique<StaticAABBTree>(MakeMemberAction(this, &Physics::checkBounds));
+        spheres = make_unique<SpheresGeometory>();
+        aabbs = make_unique<AABBGeometory>();
+        actorSlots = make_unique<PhysicsSlotMap>();
+        shapeSlots = make_unique<PhysicsSlotMap>();
+    }
 
+    Physics::~Physics()
+    {
+    }
+
+    // ブロードフェーズを切り替える
+    void Physics::setBroadphaseType(BroadphaseType type)
+    {
+        if (broadphase != nullptr && type == broadphaseType) return;
+
+        // 登録先のハンドルは作り直す側で振り直す
+        broadphase.reset();
+        for (auto& shape : physicsShapes)
+        {
+            shape.proxyId = -1;
+        }
+
+        broadphaseType = type;
+        queryDirty = true;
+        switch (type)
+        {
+        case BroadphaseType::Grid:
+            broadphase = make_unique<PhysicsGrid>(MakeMemberAction(this, &Physics::checkBounds));
+            break;
+        case BroadphaseType::AABBTree:
+            broadphase = make_unique<DynamicAABBTree>(MakeMemberAction(this, &Physics::checkBounds));
+            break;
+        case BroadphaseType::SweepAndPrune:
+            broadphase = make_unique<SweepAndPrune>(MakeMemberAction(this, &Physics::checkBounds));
+            break;
+        default:
+            broadphase = make_unique<BruteForceBroadphase>(MakeMemberAction(this, &Physics::checkBounds));
+            break;
+        }
     }
 
     // Rigidbodyを登録
     void Physics::registerRigidbody(Rigidbody* rigidbody)
     {
-        PhysicsActor temp(rigidbody);
-        physicsActors.insert(std::make_pair(rigidbody, temp));
+        if (actorSlots->contains(rigidbody->physicsHandle)) return; // 登録済み
+
+        physicsActors.emplace_back(rigidbody);
+        physicsActors.back().handle = actorSlots->add(int(physicsActors.size()) - 1);
+        rigidbody->physicsHandle = physicsActors.back().handle;
     }
 
 
-    // 3D形状を持ったコライダーの登録を解除
+    // Rigidbodyの登録を解除
+    // 末尾と入れ替えて詰める。Shapeが指す PhysicsActor は次のステップの始めに引き直す
     void Physics::unregisterRigidbody(Rigidbody* rigidbody)
     {
-        physicsActors.erase(rigidbody);
+        const int index = actorSlots->indexOf(rigidbody->physicsHandle);
+        if (index < 0) return;
+
+        if (index != int(physicsActors.size()) - 1)
+        {
+            physicsActors[index] = physicsActors.back();
+            actorSlots->move(physicsActors[index].handle, index);
+        }
+        physicsActors.pop_back();
+        actorSlots->remove(rigidbody->physicsHandle);
+        rigidbody->physicsHandle = PhysicsHandle();
     }
 
 
     // 3D形状を持ったコライダーを登録
     void Physics::register3d(Collider* collider)
     {
-        for (size_t i = 0; i < physicsShapes.size(); ++i)
+        if (shapeSlots->contains(collider->physicsHandle)) return; // 登録済み
+
+        // 次のステップまでクエリはすべてのShapeを調べる
+        queryDirty = true;
+
+        physicsShapes.push_back(PhysicsShape());
+        PhysicsShape& shape = physicsShapes.back();
+        shape.initialize(collider);
+        shape.handle = shapeSlots->add(int(physicsShapes.size()) - 1, dynamicGroup);
+        collider->physicsHandle = shape.handle;
+    }
+
+
+    // 3D形状を持ったコライダーの登録を解除
+    // ブロードフェーズが指しているので、Shapeは無効にしておき次のステップの始めに詰める
+    void Physics::unregister3d(Collider* collider)
+    {
+        PhysicsShape* shape = findShape(collider->physicsHandle);
+        if (shape == nullptr) return;
+
+        shape->setInvalid();
+        shapeSlots->remove(collider->physicsHandle);
+        collider->physicsHandle = PhysicsHandle();
+    }
+
+
+    // ハンドルからShapeを引く。無効なハンドルなら nullptr
+    PhysicsShape* Physics::findShape(PhysicsHandle handle)
+    {
+        const int index = shapeSlots->indexOf(handle);
+        if (index < 0) return nullptr;
+        return shapeSlots->groupOf(handle) == staticGroup ? &staticShapes[index] : &physicsShapes[index];
+    }
+
+
+    // 物理計算準備
+    void Physics::initializeSimulate(float step)
+    {
+        // Shapeの配列を詰めるので、ブロードフェーズを更新するまでクエリには使えない
+        queryDirty = true;
+
+        // Rigidbodyの更新。スリープ中のものと動かないものは積分しない
+        for (auto& act : physicsActors)
         {
-            if (!physicsShapes[i].isValid())
+            Rigidbody* rb = act.getRigidbody();
+
+            // スクリプトが Transform を直接動かしていたら取り込む（スリープ中なら起きる）
+            rb->syncFromTransform();
+
+            // スリープ中に速度を与えられたら起こす
+            if (rb->IsSleeping() && rb->linearVelocity != Vector3::zero)
             {
-                physicsShapes[i].initialize(collider);
-                return;
+                rb->WakeUp();
             }
-            if (physicsShapes[i].getCollider() == collider)
+            act.immovable = rb->IsImmovable();
+            if (!rb->IsSleeping() && !act.immovable)
             {
-                return; // 登録済み
+                rb->physicsUpdate();
             }
+            act.moving = !rb->IsSleeping() && (rb->linearVelocity != Vector3::zero || rb->getMoveVector(step) != Vector3::zero);
+            act.initCorrectBounds();
         }
 
-        // 無効化されたものがなければ追加
-        physicsShapes.push_back(PhysicsShape());
-        physicsShapes.back().initialize(collider);
+        // 動く・動かないが変わったShapeを移し替える
+        classifyShapes(step);
+
+        // 無効になっているシェイプを構造から外して詰める
+        compactShapes(physicsShapes, dynamicGroup);
+        compactShapes(staticShapes, staticGroup);
+
+        // Shapeの移動Boundsと次に当たるコライダーを初期化
+        // 形状のプールは詰め直したShapeの順に作り直す
+        spheres->clear();
+        aabbs->clear();
+        for (auto& shape : physicsShapes)
+        {
+            initializeShape(shape, step);
+        }
+        for (auto& shape : staticShapes)
+        {
+            initializeShape(shape, step);
+        }
     }
 
 
-    // 3D形状を持ったコライダーの登録を解除
-    void Physics::unregister3d(Collider* collider)
+    // Shapeの移動Boundsと次に当たるコライダーを初期化
+    void Physics::initializeShape(PhysicsShape& shape, float step)
+    {
+        shape.initOtherNew();
+
+        Bounds bounds = shape.getCollider()->getBounds();
+
+        // 形状のデータをワールド座標にしてプールに入れる
+        shape.shapeType = shape.getCollider()->getShapeType();
+        shape.geometory = -1;
+        writeGeometory(shape, bounds);
+
+        auto rb = shape.getCollider()->attachedRigidbody;
+        if (rb != nullptr)
+        {
+            bounds.Encapsulate(bounds.min() + rb->getMoveVector(step));
+            bounds.Encapsulate(bounds.max() + rb->getMoveVector(step));
+        }
+        shape.moveBounds = bounds;
+
+        // レイヤーが変わっても次のステップから反映されるよう毎回取り直す
+        const int layer = std::clamp(shape.getCollider()->layer, 0, layerCount - 1);
+        shape.layerBit = 1u << layer;
+        shape.collisionMask = layerCollisionMasks[layer];
+
+        // PhysicsActor は登録の解除で場所が変わるので毎回引き直す
+        Rigidbody* r = shape.getCollider()->attachedRigidbody;
+        const int actorIndex = r != nullptr ? actorSlots->indexOf(r->physicsHandle) : -1;
+        shape.actor = actorIndex >= 0 ? &physicsActors[actorIndex] : nullptr;
+    }
+
+
+    // 無効になっているShapeを、ブロードフェーズから外して末尾と入れ替えて詰める
+    // 移したShapeの場所は shapeSlots に記録し直す
+    void Physics::compactShapes(std::vector<PhysicsShape>& shapes, int group)
+    {
+        for (size_t i = 0; i < shapes.size();)
+        {
+            if (shapes[i].isValid())
+            {
+                ++i;
+                continue;
+            }
+
+            if (group == staticGroup) staticTree->remove(shapes[i]);
+            else broadphase->remove(shapes[i]);
+
+            if (i != shapes.size() - 1)
+            {
+                shapes[i] = std::move(shapes.back());
+                if (shapes[i].isValid()) shapeSlots->move(shapes[i].handle, int(i), group);
+            }
+            shapes.pop_back();
+        }
+    }
+
+
+    // Shapeの形状データを種類ごとのプールに書き込む。まだ番号がなければ追加する
+    // bounds はコライダーの getBounds()
+    void Physics::writeGeometory(PhysicsShape& shape, const Bounds& bounds)
+    {
+        switch (shape.shapeType)
+        {
+        case ShapeType::Sphere:
+        {
+            auto sphere = static_cast<SphereCollider*>(shape.getCollider());
+            Vector3 center = sphere->transform->TransformPoint(sphere->center);
+            if (shape.geometory < 0) shape.geometory = spheres->add(center, sphere->radius);
+            else spheres->set(shape.geometory, center, sphere->radius);
+            break;
+        }
+        case ShapeType::AABB:
+            if (shape.geometory < 0) shape.geometory = aabbs->add(bounds);
+            else aabbs->set(shape.geometory, bounds);
+            break;
+        default:
+            break;
+        }
+    }
+
+
+    // 動く・動かないが変わったShapeを反対側の配列に移す
+    // 元のShapeは無効にして、このあとの削除で構造から取り除く
+    void Physics::classifyShapes(float step)
     {
-        for (size_t i = 0; i < physicsShapes.size(); ++i)
+        const size_t staticCount = staticShapes.size();
+        for (auto& shape : physicsShapes)
+        {
+            if (shape.isValid() && isStaticShape(shape, step))
+            {
+                staticShapes.push_back(shape);
+                staticShapes.back().proxyId = -1;
+                shapeSlots->move(shape.handle, int(staticShapes.size()) - 1, staticGroup);
+                shape.setInvalid();
+            }
+        }
+        for (size_t i = 0; i < staticCount; ++i)
         {
-            if (physicsShapes[i].getCollider() == collider)
+            PhysicsShape& shape = staticShapes[i];
+            if (shape.isValid() && !isStaticShape(shape, step))
             {
-                physicsShapes[i].setInvalid();
-                return;
+                physicsShapes.push_back(shape);
+                physicsShapes.back().proxyId = -1;
+                shapeSlots->move(shape.handle, int(physicsShapes.size()) - 1, dynamicGroup);
+                shape.setInvalid();
             }
         }
     }
 
 
-    // 物理計算準備
-    void Physics::initializeSimulate(float step)
+    // 動かないShapeか
+    // Rigidbody がないか、質量が無限大または Kinematic で、このステップで動かないもの
+    // スリープ中の Rigidbody も、起きるまでは動かないShapeとして扱う
+    bool Physics::isStaticShape(const PhysicsShape& shape, float step)
+    {
+        Rigidbody* rb = shape.getCollider()->attachedRigidbody;
+        if (rb == nullptr) return true;
+        if (rb->IsSleeping()) return true;
+
+        return (rb->isKinematic || rb->mass == std::numeric_limits<float>::infinity())
+            && rb->linearVelocity == Vector3::zero
+            && rb->getMoveVector(step) == Vector3::zero;
+    }
+
+
+    // スリープできる Rigidbody か。Kinematic と質量が無限大のものは動かないShapeとして扱うので対象外
+    bool Physics::canSleep(const Rigidbody* rigidbody)
     {
-        // 無効になっているものをvectorから削除
-        for (auto it = physicsActors.begin(); it != physicsActors.end();)
+        return !rigidbody->isKinematic && rigidbody->mass != std::numeric_limits<float>::infinity();
+    }
+
+
+    // 接触でつながった Rigidbody の島ごとにスリープを決める
+    // 島の全員が静止し続けていればスリープさせ、1つでも動いていれば島全体を起こす
+    // 島に入らない Kinematic などが動いて触れていれば、その島も起こす
+    void Physics::updateSleep(float step)
+    {
+        islandActors.clear();
+        for (auto& act : physicsActors)
         {
-            if (!it->second.isValid())
+            if (canSleep(act.getRigidbody()))
             {
-                it = physicsActors.erase(it);
+                act.island = int(islandActors.size());
+                islandActors.push_back(&act);
             }
             else
             {
-                ++it;
+                act.island = -1;
+                act.getRigidbody()->WakeUp();
             }
         }
 
-        // 無効になっているシェイプを削除
-        for (vector<PhysicsShape>::iterator it = physicsShapes.begin(); it != physicsShapes.end();)
+        // 接触しているもの同士を union-find でまとめる
+        islandParent.resize(islandActors.size());
+        for (int i = 0; i < int(islandParent.size()); ++i)
+        {
+            islandParent[i] = i;
+        }
+        auto findRoot = [this](int i)
         {
-            if (!it->isValid())
+            while (islandParent[i] != i)
             {
-                it = physicsShapes.erase(it);
+                islandParent[i] = islandParent[islandParent[i]];
+                i = islandParent[i];
             }
-            else
+            return i;
+        };
+        for (auto [a, b] : contactActors)
+        {
+            if (a->island < 0 || b->island < 0) continue;
+            islandParent[findRoot(a->island)] = findRoot(b->island);
+        }
+
+        // 島の中で最も短い静止時間。スリープ中のものは島を起こさない
+        // 動いている Kinematic などに触れている島は負にして、全員を起こす
+        islandSleepTime.assign(islandActors.size(), std::numeric_limits<float>::infinity());
+        for (auto [a, b] : contactActors)
+        {
+            if ((a->island < 0) == (b->island < 0)) continue;
+            const PhysicsActor* mover = a->island < 0 ? a : b;
+            const PhysicsActor* touched = a->island < 0 ? b : a;
+            if (mover->moving) islandSleepTime[findRoot(touched->island)] = -1.0f;
+        }
+        for (int i = 0; i < int(islandActors.size()); ++i)
+        {
+            Rigidbody* rb = islandActors[i]->getRigidbody();
+            if (rb->IsSleeping()) continue;
+
+            float& time = islandSleepTime[findRoot(i)];
+            time = std::min(time, rb->updateSleepTime(step));
+        }
+
+        for (int i = 0; i < int(islandActors.size()); ++i)
+        {
+            Rigidbody* rb = islandActors[i]->getRigidbody();
+            const float time = islandSleepTime[findRoot(i)];
+            if (time < 0.0f)
             {
-                ++it;
+                // 静止時間を積み直す
+                rb->WakeUp();
+                continue;
+            }
+            const bool sleep = time >= timeToSleep;
+            if (sleep && !rb->IsSleeping())
+            {
+                rb->Sleep();
+            }
+            else if (!sleep && rb->IsSleeping())
+            {
+                rb->WakeUp();
             }
         }
+    }
+
+
+    // 連続衝突判定
+    // Continuous の Rigidbody の球を、ブロードフェーズで残った相手に対して移動の経路に沿って動かし、
+    // 最初にぶつかる位置までで移動を止める。moveBounds は移動の範囲を含むので、経路上の相手はペアに入っている
+    // 止めたあとの重なりは次の判定で接触として解く
+    void Physics::clampContinuousMotion(float step)
+    {
+        stats.continuousClamps = 0;
 
-        // Rigidbodyの更新
+        bool hasContinuous = false;
         for (auto& act : physicsActors)
         {
-            act.second.getRigidbody()->physicsUpdate();
-            act.second.initCorrectBounds();
+            act.timeOfImpact = 1.0f;
+            hasContinuous |= isContinuous_(act.getRigidbody());
         }
+        if (!hasContinuous) return;
 
-        // Shapeの移動Boundsと次に当たるコライダーを初期化
-        for (auto& shape : physicsShapes)
+        for (const auto& pair : potentialPairs)
         {
-            shape.initOtherNew();
+            sweepSphere_(pair.first, pair.second, step);
+            sweepSphere_(pair.second, pair.first, step);
+        }
 
-            Bounds bounds = shape.getCollider()->getBounds();
-            auto rb = shape.getCollider()->attachedRigidbody;
-            if (rb != nullptr)
+        for (auto& act : physicsActors)
+        {
+            if (act.timeOfImpact < 1.0f)
             {
-                bounds.Encapsulate(bounds.min() + rb->getMoveVector(step));
-                bounds.Encapsulate(bounds.max() + rb->getMoveVector(step));
+                act.getRigidbody()->clampMove(act.timeOfImpact);
+                stats.continuousClamps++;
             }
-            shape.moveBounds = bounds;
-            Rigidbody* r = shape.getCollider()->attachedRigidbody;
-            if (r != nullptr)
+        }
+    }
+
+
+    // 解いた姿勢を Transform にまとめて書き込む
+    // 親ごとに、親の逆行列と回転の逆を1回だけ求めてローカルの姿勢を直接書く
+    // 親も Rigidbody のときに先に書き終わるよう、階層の浅い順に並べる
+    void Physics::writeTransforms()
+    {
+        transformWrites.clear();
+        for (auto& act : physicsActors)
+        {
+            Rigidbody* rb = act.getRigidbody();
+            if (rb->IsSleeping() || act.immovable) continue;
+            if (!rb->needsTransformWrite(transformWriteTolerance))
             {
-                if (shape.actor == nullptr)
-                {
-                    shape.actor = &physicsActors.at(r);
-                }
+                rb->skipTransformWrite();
+                continue;
             }
-            else
+
+            Transform* parent = rb->transform->parent;
+            int depth = 0;
+            for (Transform* t = parent; t != nullptr; t = t->parent) depth++;
+            transformWrites.push_back({ depth, parent, rb });
+        }
+        std::stable_sort(transformWrites.begin(), transformWrites.end(), [](const TransformWrite& a, const TransformWrite& b)
+        {
+            return a.depth != b.depth ? a.depth < b.depth : std::less<Transform*>()(a.parent, b.parent);
+        });
+
+        Transform* parent = nullptr;
+        Matrix4x4 invParent;
+        Quaternion invParentRotation;
+        for (const auto& w : transformWrites)
+        {
+            if (w.parent != parent)
+            {
+                parent = w.parent;
+                invParent = parent->localToWorldMatrix().inverse();
+                invParentRotation = Inverse(parent->rotation);
+            }
+
+            Vector3 pos = w.rigidbody->position;
+            Quaternion rot = w.rigidbody->rotation;
+            if (parent != nullptr)
             {
-                shape.actor = nullptr;
+                pos = pos * invParent;
+                rot = rot * invParentRotation;
             }
+            w.rigidbody->transform->SetLocalPositionAndRotation(pos, rot);
+            w.rigidbody->markTransformWritten(pos, rot);
         }
+        stats.transformWrites = int(transformWrites.size());
     }
 
 
     // 位置補正法（射影法）による物理計算のシミュレート
     void Physics::simulatePositionCorrection(float step)
     {
-        auto start = std::chrono::system_clock::now(); // 開始時刻を記録
+        // 区間ごとの時間を計る
+        const auto start = std::chrono::steady_clock::now();
+        auto lapStart = start;
+        auto lap = [&lapStart](double& ms)
+        {
+            auto now = std::chrono::steady_clock::now();
+            ms = std::chrono::duration<double, std::milli>(now - lapStart).count();
+            lapStart = now;
+        };
 
         initializeSimulate(step);
-
-        static double totalTime = 0.0;
-        static double totalInsert = 0.0;
-        static int timeCount = 0;
+        lap(stats.initializeMs);
 
         // まずは当たりそうなペアをAABBで判定して抽出
         potentialPairs.clear();
         potentialPairsTrigger.clear();
 
-#if UNIDX_PHYSICS_USE_GRID
-        physicsGrid->update(physicsShapes);
-        auto insert = std::chrono::system_clock::now(); // 終了時刻を記録
-        totalInsert += std::chrono::duration_cast<std::chrono::microseconds>(insert - start).count() * 0.001;
-        physicsGrid->gatherPairs();
-#else
-        for (size_t i = 0; i < physicsShapes.size(); ++i)
+        // 動かないShapeは別の木で管理し、動くShapeとのペアだけを作る
+        broadphase->update(physicsShapes);
+        staticTree->update(staticShapes);
+        queryDirty = false;
+        lap(stats.broadphaseUpdateMs);
+
+        broadphase->gatherPairs();
+        staticTree->gatherPairs(physicsShapes);
+        lap(stats.broadphasePairsMs);
+
+        // 速く動くものはぶつかる位置で止めてから、位置を更新する
+        clampContinuousMotion(step);
+        for (auto& act : physicsActors)
         {
-            for (size_t j = i + 1; j < physicsShapes.size(); ++j)
+            if (!act.getRigidbody()->IsSleeping() && !act.immovable)
             {
-                checkBounds(&physicsShapes[i], &physicsShapes[j]);
+                act.getRigidbody()->applyMove(step);
             }
         }
-#endif
-        auto end = std::chrono::system_clock::now(); // 終了時刻を記録
-        std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        totalTime += elapsed.count() * 0.001;
-        timeCount++;
-        if (timeCount % 100 == 0)
-        {
-//            Debug::Log(totalInsert);
-//            Debug::Log(totalTime);
-            totalInsert = 0.0;
-            totalTime = 0.0;
-            timeCount = 0;
-        }
 
-        // 先に位置を更新する
+        // トリガーチェックする
+        int triggerCount = checkTriggers();
+
+        // 衝突をチェックする
+        int collisionCount = checkCollisions();
+        lap(stats.narrowphaseMs);
+
+        // 衝突で生じた補正を含めて位置と速度を解決する
+        // 動かないものは補正を受けないので Transform に書き戻さない
         for (auto& act : physicsActors)
         {
-            act.second.getRigidbody()->applyMove(step);
+            if (!act.getRigidbody()->IsSleeping() && !act.immovable)
+            {
+                act.getRigidbody()->solveCorrection(act.getCorrectPositionBounds(), act.getCorrectVelocityBounds());
+            }
         }
+        writeTransforms();
+        updateSleep(step);
+        querySynced = false;
+        lap(stats.solveMs);
 
-        // トリガーチェックする
+        // コールバックで登録が変わることがあるので、数はここで記録する
+        updateStats(collisionCount, triggerCount);
+
+        // OnTrigger～, OnCollision～等のコールバックを呼び出す
+        invokeCallbacks();
+        lap(stats.callbackMs);
+
+        stats.totalMs = std::chrono::duration<double, std::milli>(lapStart - start).count();
+        stats.steps++;
+    }
+
+    // トリガーのペアを調べて、重なっていれば登録する
+    int Physics::checkTriggers()
+    {
+        int triggerCount = 0;
         for (auto& pair : potentialPairsTrigger)
         {
             if (pair.first->getCollider()->intersects(pair.second->getCollider()))
             {
-                pair.first->addTrigger(pair.second->getCollider());
-                pair.second->addTrigger(pair.first->getCollider());
+                pair.first->addTrigger(*pair.second);
+                pair.second->addTrigger(*pair.first);
+                triggerCount++;
             }
         }
+        return triggerCount;
+    }
 
-        // 衝突をチェックする
-        for (auto& pair : potentialPairs)
+
+    // 衝突のペアを調べて、補正と衝突を登録する
+    // ペアを連続した範囲ごとのジョブに分けて並列に判定し、ジョブごとのバッファに補正と当たったペアを記録する
+    // ジョブの中では形状の組み合わせごとにまとめて判定する（NarrowphaseBatch）
+    // そのあとジョブの順に適用するので、1スレッドで回したときとビット単位で同じ結果になる
+    int Physics::checkCollisions()
+    {
+        const int pairCount = int(potentialPairs.size());
+        const int batchSize = std::max(narrowphaseBatchSize, 1);
+        const int jobCount = (pairCount + batchSize - 1) / batchSize;
+        if (int(narrowphaseJobs.size()) < jobCount)
+        {
+            narrowphaseJobs.resize(jobCount);
+        }
+        for (int job = 0; job < jobCount; ++job)
         {
-            if (pair.first->getCollider()->checkIntersect(pair.second->getCollider(), pair.first->actor, pair.second->actor))
+            if (!narrowphaseJobs[job].batch)
             {
+                narrowphaseJobs[job].batch = std::make_unique<NarrowphaseBatch>();
+            }
+        }
+
+        // Transform の行列は initializeShape() の getBounds() で更新済みなので、判定中は読むだけになる
+        auto narrowphase = [this, pairCount, batchSize](int job)
+        {
+            NarrowphaseJob& out = narrowphaseJobs[job];
+            out.corrections.clear();
+            out.hits.clear();
+
+            const int end = std::min((job + 1) * batchSize, pairCount);
+            out.batch->run(potentialPairs, job * batchSize, end, *spheres, *aabbs, out.corrections, out.hits);
+        };
+        JobSystem::parallelFor(0, jobCount, 1, narrowphase);
+
+        // ジョブの順に補正と衝突を適用する
+        int collisionCount = 0;
+        contactActors.clear();
+        for (int job = 0; job < jobCount; ++job)
+        {
+            const NarrowphaseJob& out = narrowphaseJobs[job];
+            out.corrections.apply();
+            for (int i : out.hits)
+            {
+                auto& pair = potentialPairs[i];
+
+                // Rigidbody 同士の接触はスリープ判定の島をつなぐ
+                if (pair.first->actor != nullptr && pair.second->actor != nullptr)
+                {
+                    contactActors.push_back({ pair.first->actor, pair.second->actor });
+                }
+
                 Collision ca;
                 ca.collider = pair.second->getCollider();
-                pair.first->addCollide(ca);
+                pair.first->addCollide(*pair.second, ca);
 
                 Collision cb;
                 cb.collider = pair.first->getCollider();
-                pair.second->addCollide(cb);
+                pair.second->addCollide(*pair.first, cb);
+                collisionCount++;
             }
         }
+        return collisionCount;
+    }
 
-        // 衝突で生じた補正を含めて位置と速度を解決する
-        for (auto& act : physicsActors)
+
+    // ステップの数を計測値に記録する
+    void Physics::updateStats(int collisionCount, int triggerCount)
+    {
+        stats.dynamicShapes = int(physicsShapes.size());
+        stats.staticShapes = int(staticShapes.size());
+        stats.actors = int(physicsActors.size());
+        stats.sleepingActors = 0;
+        stats.immovableActors = 0;
+        for (const auto& act : physicsActors)
         {
-            act.second.getRigidbody()->solveCorrection(act.second.getCorrectPositionBounds(), act.second.getCorrectVelocityBounds());
+            if (act.getRigidbody()->IsSleeping()) stats.sleepingActors++;
+            if (act.immovable) stats.immovableActors++;
         }
+        stats.potentialPairs = int(potentialPairs.size());
+        stats.potentialTriggerPairs = int(potentialPairsTrigger.size());
+        stats.collisions = collisionCount;
+        stats.triggers = triggerCount;
+        stats.broadphaseBytes = broadphase->getMemoryUsage() + staticTree->getMemoryUsage();
+    }
+
+
+    // OnTrigger～, OnCollision～等のコールバックを呼び出す
+    // TODO: 当たったRigidbodyがついているGameObjectでも呼び出す
+    void Physics::invokeCallbacks()
+    {
+        // スリープ中のコライダーとの接触は続いているものとして扱う
+        sleepingColliders.clear();
+        for (const auto& shape : staticShapes)
+        {
+            Rigidbody* rb = shape.isValid() ? shape.getCollider()->attachedRigidbody : nullptr;
+            if (rb != nullptr && rb->IsSleeping())
+            {
+                sleepingColliders.push_back(shape.getCollider());
+            }
+        }
+        std::sort(sleepingColliders.begin(), sleepingColliders.end());
 
-        // OnTrigger～, OnCollision～等のコールバックを呼び出す
-        // TODO: 当たったRigidbodyがついているGameObjectでも呼び出す
         for (auto& shape : physicsShapes)
         {
             if (shape.isValid())
             {
-                shape.collideCallback();
+                shape.collideCallback(sleepingColliders);
+            }
+        }
+        for (auto& shape : staticShapes)
+        {
+            if (shape.isValid())
+            {
+                shape.collideCallback(sleepingColliders);
             }
         }
     }
 
+
+    // 計測値を JSON 形式の文字列にする
+    u8string PhysicsStats::toJson() const
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(3)
+            << "{\"steps\": " << steps
+            << ", \"dynamicShapes\": " << dynamicShapes
+            << ", \"staticShapes\": " << staticShapes
+            << ", \"actors\": " << actors
+            << ", \"sleepingActors\": " << sleepingActors
+            << ", \"immovableActors\": " << immovableActors
+            << ", \"potentialPairs\": " << potentialPairs
+            << ", \"potentialTriggerPairs\": " << potentialTriggerPairs
+            << ", \"collisions\": " << collisions
+            << ", \"triggers\": " << triggers
+            << ", \"continuousClamps\": " << continuousClamps
+            << ", \"transformWrites\": " << transformWrites
+            << ", \"broadphaseBytes\": " << broadphaseBytes
+            << ", \"ms\": {\"initialize\": " << initializeMs
+            << ", \"broadphaseUpdate\": " << broadphaseUpdateMs
+            << ", \"broadphasePairs\": " << broadphasePairsMs
+            << ", \"narrowphase\": " << narrowphaseMs
+            << ", \"solve\": " << solveMs
+            << ", \"callback\": " << callbackMs
+            << ", \"total\": " << totalMs
+            << "}}";
+        return ToString(ss.str());
+    }
+
+    // layer1 と layer2 のコライダー同士の衝突を無視するか設定する
+    void Physics::IgnoreLayerCollision(int layer1, int layer2, bool ignore)
+    {
+        assert(0 <= layer1 && layer1 < layerCount && 0 <= layer2 && layer2 < layerCount);
+        if (ignore)
+        {
+            layerCollisionMasks[layer1] &= ~(1u << layer2);
+            layerCollisionMasks[layer2] &= ~(1u << layer1);
+        }
+        else
+        {
+            layerCollisionMasks[layer1] |= 1u << layer2;
+            layerCollisionMasks[layer2] |= 1u << layer1;
+        }
+    }
+
+
+    bool Physics::GetIgnoreLayerCollision(int layer1, int layer2)
+    {
+        return (layerCollisionMasks[layer1] & (1u << layer2)) == 0;
+    }
+
+
     void Physics::checkBounds(PhysicsShape* shape1, PhysicsShape* shape2)
     {
+        // 衝突しないレイヤーの組み合わせは境界を調べる前に除く
+        if (!shape1->canCollide(*shape2)) return;
+
         if (shape1->moveBounds.Intersects(shape2->moveBounds))
         {
             auto rbA = shape1->getCollider()->attachedRigidbody;
@@ -333,108 +1017,687 @@ namespace UniDx
         }
     }
 
-    // 物理計算のシミュレート（未完成）
+    // solverType に応じてシミュレートする
+    void Physics::simulateStep(float step)
+    {
+        if (solverType == SolverType::SequentialImpulse)
+        {
+            simulate(step);
+        }
+        else
+        {
+            simulatePositionCorrection(step);
+        }
+    }
+
+
+    // 逐次インパルス法による物理計算のシミュレート
+    // 接触点を作って速度の拘束を反復で解き、その速度で移動したあとにめり込みを位置で戻す
+    // 接触のインパルスは次のステップに引き継いでウォームスタートに使う
     void Physics::simulate(float step)
     {
+        // 区間ごとの時間を計る
+        const auto start = std::chrono::steady_clock::now();
+        auto lapStart = start;
+        auto lap = [&lapStart](double& ms)
+        {
+            auto now = std::chrono::steady_clock::now();
+            ms = std::chrono::duration<double, std::milli>(now - lapStart).count();
+            lapStart = now;
+        };
+
         initializeSimulate(step);
+        lap(stats.initializeMs);
 
         // まずは当たりそうなペアをAABBで判定して抽出
         potentialPairs.clear();
-        for (size_t i = 0; i < physicsShapes.size(); ++i)
+        potentialPairsTrigger.clear();
+
+        // 動かないShapeは別の木で管理し、動くShapeとのペアだけを作る
+        broadphase->update(physicsShapes);
+        staticTree->update(staticShapes);
+        queryDirty = false;
+        lap(stats.broadphaseUpdateMs);
+
+        broadphase->gatherPairs();
+        staticTree->gatherPairs(physicsShapes);
+        lap(stats.broadphasePairsMs);
+
+        // トリガーチェックする
+        int triggerCount = checkTriggers();
+
+        // 形状ごとに接触点を作る
+        gatherManifolds();
+        lap(stats.narrowphaseMs);
+
+        // 速度の拘束を解く
+        prepareSolver(step);
+        for (auto& m : manifolds)
+        {
+            warmStart(m);
+        }
+        for (int i = 0; i < velocityIterations; ++i)
         {
-            for (size_t j = i + 1; j < physicsShapes.size(); ++j)
+            for (auto& m : manifolds)
             {
-                if (physicsShapes[i].moveBounds.Intersects(physicsShapes[j].moveBounds))
-                {
-                    // 同じ Rigidbody に属しているコンパウンド同士は自己衝突なのでスキップ
-                    auto rbA = physicsShapes[i].getCollider()->attachedRigidbody;
-                    auto rbB = physicsShapes[j].getCollider()->attachedRigidbody;
-                    if (rbA && rbA == rbB) continue;
+                solveVelocityConstraint(m);
+            }
+        }
 
-                    // ペアを記憶。ここでは詳細判定しない
-                    potentialPairs.push_back({ &physicsShapes[i], &physicsShapes[j] });
-                }
+        // 解いた速度で移動する。速く動くものはぶつかる位置で止める
+        const float invStep = step > 0.0f ? 1.0f / step : 0.0f;
+        for (auto& act : physicsActors)
+        {
+            Rigidbody* rb = act.getRigidbody();
+            SolverBody& body = solverBodies[act.solverBody];
+            if (!rb->IsSleeping() && body.invMass > 0.0f)
+            {
+                rb->addSolvedVelocity(body.velocity - rb->getMoveVector(step) * invStep, step);
             }
         }
+        clampContinuousMotion(step);
+        for (auto& act : physicsActors)
+        {
+            Rigidbody* rb = act.getRigidbody();
+            if (rb->IsSleeping() || act.immovable) continue;
 
-        // 形状ごとに実衝突を確定する
+            SolverBody& body = solverBodies[act.solverBody];
+            if (body.invMass > 0.0f)
+            {
+                body.move = rb->getMoveVector(step);
+            }
+            rb->applyMove(step);
+        }
+
+        // 残っためり込みを位置で戻す。速度は変えない
+        for (int i = 0; i < positionIterations; ++i)
+        {
+            for (const auto& m : manifolds)
+            {
+                solvePositionConstraint(m);
+            }
+        }
+        for (auto& act : physicsActors)
+        {
+            Rigidbody* rb = act.getRigidbody();
+            if (rb->IsSleeping() || act.immovable) continue;
+
+            act.addCorrectPosition(solverBodies[act.solverBody].correction);
+            rb->solveCorrection(act.getCorrectPositionBounds(), act.getCorrectVelocityBounds());
+        }
+        writeTransforms();
+
+        // 触れている接触を衝突として登録する。離れたまま近づいただけのものは除く
+        int collisionCount = 0;
+        contactActors.clear();
+        for (const auto& m : manifolds)
+        {
+            bool touching = false;
+            for (int i = 0; i < m.numContacts; ++i)
+            {
+                touching |= m.contacts[i].penetration >= 0.0f || m.contacts[i].normalImpulse > 0.0f;
+            }
+            if (!touching) continue;
+
+            // Rigidbody 同士の接触はスリープ判定の島をつなぐ
+            if (m.a->actor != nullptr && m.b->actor != nullptr)
+            {
+                contactActors.push_back({ m.a->actor, m.b->actor });
+            }
+
+            // 法線は自分が押される向きにする
+            Collision ca;
+            ca.collider = m.colliderB;
+            Collision cb;
+            cb.collider = m.colliderA;
+            for (int i = 0; i < m.numContacts; ++i)
+            {
+                ca.contacts.push_back({ m.contacts[i].point, -m.contacts[i].normal });
+                cb.contacts.push_back({ m.contacts[i].point, m.contacts[i].normal });
+            }
+            m.a->addCollide(*m.b, ca);
+            m.b->addCollide(*m.a, cb);
+            collisionCount++;
+        }
+
+        updateSleep(step);
+        querySynced = false;
+
+        // 次のステップのウォームスタートのために残す
+        std::swap(manifolds, prevManifolds);
+        lap(stats.solveMs);
+
+        // コールバックで登録が変わることがあるので、数はここで記録する
+        updateStats(collisionCount, triggerCount);
+
+        // OnTrigger～, OnCollision～等のコールバックを呼び出す
+        invokeCallbacks();
+        lap(stats.callbackMs);
+
+        stats.totalMs = std::chrono::duration<double, std::milli>(lapStart - start).count();
+        stats.steps++;
+    }
+
+
+    // 衝突のペアから接触点を作る。前のステップに同じペアの接触があればインパルスを引き継ぐ
+    void Physics::gatherManifolds()
+    {
         manifolds.clear();
         for (auto& pair : potentialPairs)
         {
+            // ハンドルの順にそろえて、ステップをまたいでも同じキーになるようにする
+            PhysicsShape* a = pair.first;
+            PhysicsShape* b = pair.second;
+            if (b->handle < a->handle) std::swap(a, b);
+
             ContactManifold m;
-            //        if (intersectShapes(*pair.first, *pair.second, &m)) {  // ← ここが Narrow-phase
-            //            manifolds.push_back(m);
-            //        }
+            m.a = a;
+            m.b = b;
+            m.colliderA = a->getCollider();
+            m.colliderB = b->getCollider();
+            m.handleA = a->handle;
+            m.handleB = b->handle;
+            if (m.colliderA->generateContacts(m.colliderB, contactOffset, m))
+            {
+                manifolds.push_back(m);
+            }
         }
 
-        // ソルバ
+        // キーの順に並べ、前のステップの接触と並行して進めて突き合わせる
+        // ハンドルは登録の順に決まるので、ブロードフェーズの種類や実行によらず解く順番が決まる
+        // 消えたコライダーの番号を使い回しても世代が違うので、古いインパルスは引き継がない
+        auto less = [](const ContactManifold& lhs, const ContactManifold& rhs)
+        {
+            return std::tie(lhs.handleA, lhs.handleB) < std::tie(rhs.handleA, rhs.handleB);
+        };
+        std::sort(manifolds.begin(), manifolds.end(), less);
+        if (!warmStarting) return;
+
+        auto prev = prevManifolds.cbegin();
         for (auto& m : manifolds)
         {
-            Rigidbody* rbA = m.a->getCollider()->attachedRigidbody;
-            Rigidbody* rbB = m.b->getCollider()->attachedRigidbody;
+            while (prev != prevManifolds.cend() && less(*prev, m)) ++prev;
+            if (prev == prevManifolds.cend()) break;
+            if (less(m, *prev) || prev->numContacts != m.numContacts) continue;
 
-            // 速度レベルの反発インパルス (Impulses) をかける
-            solveVelocityConstraint(rbA, rbB, m);
+            // 法線が大きく変わった接触は別物として解き直す
+            for (int i = 0; i < m.numContacts; ++i)
+            {
+                const Contact& old = prev->contacts[i];
+                Contact& c = m.contacts[i];
+                if (Dot(old.normal, c.normal) < 0.95f) continue;
 
-            // 位置のめり込みを少し戻す (Baumgarte / Position correction)
-            solvePositionConstraint(rbA, rbB, m);
+                c.normalImpulse = old.normalImpulse;
+                c.tangentImpulse = old.tangentImpulse - c.normal * Dot(old.tangentImpulse, c.normal);
+            }
         }
     }
 
 
-    void Physics::solveVelocityConstraint(Rigidbody* A, Rigidbody* B, const ContactManifold& m)
+    // ソルバで使う剛体と、接触ごとの目標の速度を用意する
+    void Physics::prepareSolver(float step)
     {
-        const float restitution = 0.2f;   // 反発係数
+        const float invStep = step > 0.0f ? 1.0f / step : 0.0f;
+
+        // 0番は Rigidbody のないShape用の動かない剛体
+        solverBodies.clear();
+        solverBodies.push_back({ Vector3::zero, Vector3::zero, Vector3::zero, 0.0f });
+        for (auto& act : physicsActors)
+        {
+            Rigidbody* rb = act.getRigidbody();
+
+            // 動かないものは動かない剛体（0番）を共有する
+            if (act.immovable)
+            {
+                act.solverBody = 0;
+                continue;
+            }
+            SolverBody body{ Vector3::zero, Vector3::zero, Vector3::zero, 0.0f };
+
+            // スリープ中のものは起きるまで動かない剛体として扱う
+            // Kinematic や質量が無限大のものは、押されずに自分の移動量で動く
+            if (!rb->IsSleeping())
+            {
+                body.move = rb->getMoveVector(step);
+                body.velocity = body.move * invStep;
+                if (!rb->isKinematic && rb->mass != std::numeric_limits<float>::infinity())
+                {
+                    body.invMass = 1.0f / (rb->mass > 0.0f ? rb->mass : 1.0f);
+                }
+            }
+            act.solverBody = int(solverBodies.size());
+            solverBodies.push_back(body);
+        }
 
+        for (auto& m : manifolds)
+        {
+            m.bodyA = m.a->actor != nullptr ? m.a->actor->solverBody : 0;
+            m.bodyB = m.b->actor != nullptr ? m.b->actor->solverBody : 0;
+            m.friction = (m.colliderA->friction + m.colliderB->friction) * 0.5f;
+
+            const SolverBody& A = solverBodies[m.bodyA];
+            const SolverBody& B = solverBodies[m.bodyB];
+            const float bounce = m.colliderA->bounciness * m.colliderB->bounciness;
+            for (int i = 0; i < m.numContacts; ++i)
+            {
+                Contact& c = m.contacts[i];
+                const float separation = -c.penetration;
+                const float relVelN = Dot(B.velocity - A.velocity, c.normal);
+
+                // 離れていれば、このステップでちょうど触れるところまでは近づいてよい
+                c.velocityBias = separation > 0.0f ? -separation * invStep : 0.0f;
+
+                // 速くぶつかるときは跳ね返す
+                if (relVelN < -bounceThreshold && relVelN * step + separation <= 0.0f)
+                {
+                    c.velocityBias = std::max(c.velocityBias, -bounce * relVelN);
+                }
+            }
+        }
+    }
+
+
+    // 前のステップのインパルスを先にかけておく
+    void Physics::warmStart(ContactManifold& m)
+    {
+        SolverBody& A = solverBodies[m.bodyA];
+        SolverBody& B = solverBodies[m.bodyB];
         for (int i = 0; i < m.numContacts; ++i)
         {
+            const Contact& c = m.contacts[i];
+            Vector3 impulse = c.normal * c.normalImpulse + c.tangentImpulse;
+            A.velocity -= impulse * A.invMass;
+            B.velocity += impulse * B.invMass;
         }
     }
 
 
-    void Physics::solvePositionConstraint(Rigidbody* A, Rigidbody* B, const ContactManifold& m)
+    // 速度レベルの反発と摩擦のインパルスをかける
+    // インパルスは累積した値でクランプし、反復のたびに差分だけをかける
+    void Physics::solveVelocityConstraint(ContactManifold& m)
     {
+        SolverBody& A = solverBodies[m.bodyA];
+        SolverBody& B = solverBodies[m.bodyB];
+        const float invMassSum = A.invMass + B.invMass;
+        if (invMassSum <= 0.0f) return;
 
+        for (int i = 0; i < m.numContacts; ++i)
+        {
+            Contact& c = m.contacts[i];
+
+            // 法線方向。押し返す向きのインパルスだけにする
+            float relVelN = Dot(B.velocity - A.velocity, c.normal);
+            float normalImpulse = std::max(c.normalImpulse + (c.velocityBias - relVelN) / invMassSum, 0.0f);
+            Vector3 impulse = c.normal * (normalImpulse - c.normalImpulse);
+            c.normalImpulse = normalImpulse;
+            A.velocity -= impulse * A.invMass;
+            B.velocity += impulse * B.invMass;
+
+            // 摩擦。接線方向の相対速度を消し、大きさを摩擦係数×法線方向のインパルスまでに抑える
+            Vector3 relVel = B.velocity - A.velocity;
+            Vector3 relVelT = relVel - c.normal * Dot(relVel, c.normal);
+            Vector3 tangentImpulse = c.tangentImpulse - relVelT / invMassSum;
+            const float maxFriction = m.friction * c.normalImpulse;
+            const float sqrLength = tangentImpulse.sqrMagnitude();
+            if (sqrLength > maxFriction * maxFriction)
+            {
+                tangentImpulse *= maxFriction / std::sqrt(sqrLength);
+            }
+            impulse = tangentImpulse - c.tangentImpulse;
+            c.tangentImpulse = tangentImpulse;
+            A.velocity -= impulse * A.invMass;
+            B.velocity += impulse * B.invMass;
+        }
+    }
+
+
+    // 位置のめり込みを少し戻す (Baumgarte / Position correction)
+    // 移動と補正を含めた今の距離を接触の法線で見積もる
+    void Physics::solvePositionConstraint(const ContactManifold& m)
+    {
+        SolverBody& A = solverBodies[m.bodyA];
+        SolverBody& B = solverBodies[m.bodyB];
+        const float invMassSum = A.invMass + B.invMass;
+        if (invMassSum <= 0.0f) return;
+
+        for (int i = 0; i < m.numContacts; ++i)
+        {
+            const Contact& c = m.contacts[i];
+            float separation = -c.penetration + Dot(c.normal, (B.move + B.correction) - (A.move + A.correction));
+
+            // 少しのめり込みは残して接触を保つ
+            float correction = std::clamp(baumgarte * (separation + linearSlop), -maxLinearCorrection, 0.0f);
+            Vector3 push = c.normal * (-correction / invMassSum);
+            A.correction -= push * A.invMass;
+            B.correction += push * B.invMass;
+        }
     }
 
+    // 太らせたレイと重なる可能性のあるShapeを、動くShape・動かないShapeの順に近いものから func に渡す
+    // ステップ後にShapeの配列が変わっていれば、構造を使わずにすべてのShapeを渡す
+    void Physics::raycastShapes(Vector3 origin, Vector3 direction, float radius, float maxDistance,
+        const std::function<float(PhysicsShape*, float, float)>& func)
+    {
+        if (queryDirty)
+        {
+            for (auto* shapes : { &physicsShapes, &staticShapes })
+            for (auto& shape : *shapes)
+            {
+                maxDistance = std::min(maxDistance, func(&shape, 0.0f, maxDistance));
+            }
+            return;
+        }
+
+        // 動くShapeで見つかった距離で、動かないShapeの探索を打ち切る
+        Broadphase::RaycastFunc clip = [&](PhysicsShape* shape, float enter, float distance)
+        {
+            maxDistance = std::min(distance, func(shape, enter, distance));
+            return maxDistance;
+        };
+        broadphase->raycast(origin, direction, radius, maxDistance, clip);
+        staticTree->raycast(origin, direction, radius, maxDistance, clip);
+    }
+
+
+    // クエリ用にブロードフェーズの境界を今のコライダーの位置に合わせる
+    // 位置補正で押し出されたShapeは moveBounds の外に出ていることがあるため
+    void Physics::SyncTransforms()
+    {
+        // 並列のフェーズではほかのスレッドがクエリで読んでいる。PlayerLoop がフェーズの前に合わせておく
+        assert(!ParallelCommandBuffer::isRecording());
+        querySynced = true;
+
+        // 形状のプールはレイキャストで読むので、ステップ後に登録されたShapeも含めて書き込む
+        for (auto* shapes : { &physicsShapes, &staticShapes })
+        for (auto& shape : *shapes)
+        {
+            if (shape.isValid())
+            {
+                shape.moveBounds = shape.getCollider()->getBounds();
+                shape.shapeType = shape.getCollider()->getShapeType();
+                writeGeometory(shape, shape.moveBounds);
+            }
+        }
+        if (queryDirty) return; // すべてのShapeを調べるので構造を合わせる必要はない
+
+        broadphase->update(physicsShapes);
+        staticTree->update(staticShapes);
+    }
+
+
     // Raycast
+    // ブロードフェーズを近い順にたどり、当たった距離より遠い候補は調べない
     bool Physics::Raycast(Vector3 origin, Vector3 direction, float maxDistance,
-        RaycastHit* hitInfo, std::function<bool(const Collider*)> filter)
+        RaycastHit* hitInfo, ColliderFilter filter)
     {
-        // 無効な方向や負の距離はヒットしない
-        const float eps = 1e-6f;
-        if (maxDistance <= 0.0f) return false;
-        if (fabs(direction.x) < eps && fabs(direction.y) < eps && fabs(direction.z) < eps) return false;
+        if (!isValidRay_(direction, maxDistance)) return false;
+        syncTransformsIfNeeded();
+
+        bool hitAny = false;
+        RaycastHit best;
+        best.distance = std::numeric_limits<float>::infinity();
+        raycastShapes(origin, direction, 0.0f, maxDistance, [&](PhysicsShape* shape, float, float distance)
+        {
+            if (raycastShape_(*spheres, *aabbs, shape, origin, direction, distance, filter, best)) hitAny = true;
+            return best.distance;
+        });
+
+        if (hitAny && hitInfo != nullptr)
+        {
+            *hitInfo = best;
+        }
+        return hitAny;
+    }
+
+
+    // レイが当たるすべてのコライダーを近い順に返す
+    std::vector<RaycastHit> Physics::RaycastAll(Vector3 origin, Vector3 direction, float maxDistance, ColliderFilter filter)
+    {
+        std::vector<RaycastHit> hits;
+        if (!isValidRay_(direction, maxDistance)) return hits;
+        syncTransformsIfNeeded();
+
+        raycastShapes(origin, direction, 0.0f, maxDistance, [&](PhysicsShape* shape, float, float distance)
+        {
+            Collider* col = shape->getCollider();
+            if (col == nullptr || (filter && !filter(col))) return distance;
+
+            RaycastHit hit;
+            if (raycastGeometory_(*spheres, *aabbs, shape, origin, direction, distance, hit))
+            {
+                hits.push_back(hit);
+            }
+            return distance;
+        });
+
+        std::sort(hits.begin(), hits.end(), [](const RaycastHit& a, const RaycastHit& b) { return a.distance < b.distance; });
+        return hits;
+    }
+
+
+    // 半径 radius の球を動かして最初に当たるコライダーを調べる
+    bool Physics::SphereCast(Vector3 origin, float radius, Vector3 direction, float maxDistance,
+        RaycastHit* hitInfo, ColliderFilter filter)
+    {
+        if (!isValidRay_(direction, maxDistance)) return false;
+        syncTransformsIfNeeded();
+
+        bool hitAny = false;
+        RaycastHit best;
+        best.distance = std::numeric_limits<float>::infinity();
+        raycastShapes(origin, direction, radius, maxDistance, [&](PhysicsShape* shape, float, float distance)
+        {
+            Collider* col = shape->getCollider();
+            if (col == nullptr || (filter && !filter(col))) return distance;
+
+            RaycastHit hit;
+            if (col->SphereCast(origin, radius, direction, distance, &hit) && hit.distance < best.distance)
+            {
+                best = hit;
+                hitAny = true;
+            }
+            return best.distance;
+        });
+
+        if (hitAny && hitInfo != nullptr)
+        {
+            *hitInfo = best;
+        }
+        return hitAny;
+    }
+
+
+    // カプセルを動かして最初に当たるコライダーを調べる
+    // ブロードフェーズはカプセルを囲む球で絞り、候補のコライダーには軸に沿って並べた球を動かす
+    bool Physics::CapsuleCast(Vector3 point1, Vector3 point2, float radius, Vector3 direction, float maxDistance,
+        RaycastHit* hitInfo, ColliderFilter filter)
+    {
+        if (!isValidRay_(direction, maxDistance)) return false;
+        syncTransformsIfNeeded();
+
+        const Vector3 center = (point1 + point2) * 0.5f;
+        const float halfLength = (point2 - point1).magnitude() * 0.5f;
 
         bool hitAny = false;
-        float bestT = std::numeric_limits<float>::infinity();
+        RaycastHit best;
+        best.distance = std::numeric_limits<float>::infinity();
+        raycastShapes(center, direction, radius + halfLength, maxDistance, [&](PhysicsShape* shape, float, float distance)
+        {
+            Collider* col = shape->getCollider();
+            if (col == nullptr || (filter && !filter(col))) return distance;
 
-        // 各 Collider の実装された Raycast を呼ぶ（Collider 側で始点内部は除外される）
-        for (const auto& shape : physicsShapes)
+            RaycastHit hit;
+            if (capsuleCast_(col, point1, point2, radius, direction, std::min(distance, best.distance), hit))
+            {
+                best = hit;
+                hitAny = true;
+            }
+            return best.distance;
+        });
+
+        if (hitAny && hitInfo != nullptr)
         {
-            if (!shape.isValid()) continue;
-            Collider* col = shape.getCollider();
-            if (!col) continue;
+            *hitInfo = best;
+        }
+        return hitAny;
+    }
 
-            if (filter && !filter(col)) continue; // フィルタで除外
 
-            RaycastHit localHit;
-            if (col->Raycast(origin, direction, maxDistance, &localHit))
+    // まとめてレイキャスト
+    // 1. 各レイの候補を並列に集める（ブロードフェーズは読むだけ）
+    // 2. 候補の Transform の行列を1スレッドで更新しておく（行列は読み出し時に更新されるため）
+    // 3. 各レイの候補を近い順に並列に判定する
+    int Physics::RaycastBatch(std::span<const Ray> rays, std::span<RaycastHit> hits, float maxDistance, ColliderFilter filter)
+    {
+        assert(hits.size() >= rays.size());
+        const size_t count = std::min(rays.size(), hits.size());
+        syncTransformsIfNeeded();
+
+        // 少ないときや候補を絞れないときは1本ずつ
+        if (int(count) < raycastBatchThreshold || queryDirty)
+        {
+            int hitCount = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                hits[i] = RaycastHit();
+                if (Raycast(rays[i].origin, rays[i].direction, maxDistance, &hits[i], filter)) hitCount++;
+            }
+            return hitCount;
+        }
+
+        if (batchCandidates.size() < count) batchCandidates.resize(count);
+
+        JobSystem::parallelFor(0, int(count), 0, [&](int i)
+        {
+            auto& candidates = batchCandidates[i];
+            candidates.clear();
+            if (!isValidRay_(rays[i].direction, maxDistance)) return;
+
+            raycastShapes(rays[i].origin, rays[i].direction, 0.0f, maxDistance, [&candidates](PhysicsShape* shape, float enter, float distance)
+            {
+                if (shape->isValid()) candidates.emplace_back(enter, shape);
+                return distance;
+            });
+            std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        });
+
+        // プールにない形状は Collider の Raycast で Transform を読むので、並行して読む前に行列を更新しておく
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (const auto& candidate : batchCandidates[i])
+            {
+                if (candidate.second->geometory < 0) candidate.second->getCollider()->getBounds();
+            }
+        }
+
+        JobSystem::parallelFor(0, int(count), 0, [&](int i)
+        {
+            RaycastHit best;
+            best.distance = std::numeric_limits<float>::infinity();
+            bool hitAny = false;
+            float distance = maxDistance;
+            for (const auto& [enter, shape] : batchCandidates[i])
             {
-                // closest を選択（t を比較）
-                if (localHit.distance < bestT)
+                if (enter > distance) break;
+                if (raycastShape_(*spheres, *aabbs, shape, rays[i].origin, rays[i].direction, distance, filter, best))
                 {
-                    bestT = localHit.distance;
-                    if (hitInfo != nullptr)
-                    {
-                        *hitInfo = localHit;
-                    }
                     hitAny = true;
+                    distance = best.distance;
                 }
             }
+            hits[i] = hitAny ? best : RaycastHit();
+        });
+
+        int hitCount = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (hits[i].collider != nullptr) hitCount++;
         }
+        return hitCount;
+    }
 
-        return hitAny;
+
+    // bounds で絞った候補のうち、filter と test を満たすコライダーを output に渡す
+    // output が false を返したらそこで打ち切る
+    void Physics::overlapColliders(const Bounds& bounds, const ColliderFilter& filter,
+        const std::function<bool(Collider*)>& test, const std::function<bool(Collider*)>& output)
+    {
+        syncTransformsIfNeeded();
+
+        Broadphase::QueryFunc func = [&](PhysicsShape* shape)
+        {
+            Collider* col = shape->getCollider();
+            if (col == nullptr) return true;
+            if (filter && !filter(col)) return true; // フィルタで除外
+            if (!test(col)) return true;
+            return output(col);
+        };
+
+        if (queryDirty)
+        {
+            // ステップ後にShapeの配列が変わっていれば、すべてのShapeを調べる
+            for (auto* shapes : { &physicsShapes, &staticShapes })
+            for (auto& shape : *shapes)
+            {
+                if (!func(&shape)) return;
+            }
+            return;
+        }
+
+        if (!broadphase->query(bounds, func)) return;
+        staticTree->query(bounds, func);
+    }
+
+
+    // center から radius 以内に重なるコライダーを返す
+    std::vector<Collider*> Physics::OverlapSphere(Vector3 center, float radius, ColliderFilter filter)
+    {
+        std::vector<Collider*> results;
+        if (!(radius >= 0.0f)) return results;
+
+        overlapColliders(Bounds(center, Vector3(radius, radius, radius)), filter,
+            [&](Collider* col) { return col->intersectsSphere(center, radius); },
+            [&](Collider* col) { results.push_back(col); return true; });
+        return results;
+    }
+
+
+    // OverlapSphere の結果を results に書き込み、書き込んだ数を返す
+    int Physics::OverlapSphereNonAlloc(Vector3 center, float radius, std::span<Collider*> results, ColliderFilter filter)
+    {
+        int count = 0;
+        if (!(radius >= 0.0f) || results.empty()) return count;
+
+        overlapColliders(Bounds(center, Vector3(radius, radius, radius)), filter,
+            [&](Collider* col) { return col->intersectsSphere(center, radius); },
+            [&](Collider* col) { results[count++] = col; return count < int(results.size()); });
+        return count;
+    }
+
+
+    // 回転しない箱と重なるコライダーを返す
+    std::vector<Collider*> Physics::OverlapBox(Vector3 center, Vector3 halfExtents, ColliderFilter filter)
+    {
+        std::vector<Collider*> results;
+        const Bounds box(center, halfExtents);
+        overlapColliders(box, filter,
+            [&](Collider* col) { return col->intersectsBox(box); },
+            [&](Collider* col) { results.push_back(col); return true; });
+        return results;
+    }
+
+
+    // OverlapBox の結果を results に書き込み、書き込んだ数を返す
+    int Physics::OverlapBoxNonAlloc(Vector3 center, Vector3 halfExtents, std::span<Collider*> results, ColliderFilter filter)
+    {
+        int count = 0;
+        if (results.empty()) return count;
+
+        const Bounds box(center, halfExtents);
+        overlapColliders(box, filter,
+            [&](Collider* col) { return col->intersectsBox(box); },
+            [&](Collider* col) { results[count++] = col; return count < int(results.size()); });
+        return count;
     }
 
 } // UniDx
@@ -0,0 +1,205 @@
+﻿#include "pch.h"
+#include <PhysicsGeometory.h>
+
+#include <limits>
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    void SpheresGeometory::clear()
+    {
+        cx.clear(); cy.clear(); cz.clear();
+        r.clear();
+    }
+
+    int SpheresGeometory::add(Vector3 center, float radius)
+    {
+        cx.push_back(center.x); cy.push_back(center.y); cz.push_back(center.z);
+        r.push_back(radius);
+        return size() - 1;
+    }
+
+    void SpheresGeometory::set(int index, Vector3 center, float radius)
+    {
+        cx[index] = center.x; cy[index] = center.y; cz[index] = center.z;
+        r[index] = radius;
+    }
+
+
+    // 球へのレイキャスト。始点が内部のときは当たらない
+    bool SpheresGeometory::raycast(Vector3 centerWorld, float radius, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        const float eps = 1e-6f;
+
+        // origin が内部にある場合は無視
+        float distSqr = SqrDistance(origin, centerWorld);
+        if (distSqr <= radius * radius)
+        {
+            return false;
+        }
+
+        // 二次方程式: (d·d)t^2 + 2(d·oc)t + (oc·oc - r^2) = 0
+        Vector3 oc = origin - centerWorld;
+        float a = Dot(direction, direction);
+        float b = 2.0f * Dot(direction, oc);
+        float c = Dot(oc, oc) - radius * radius;
+
+        float disc = b * b - 4.0f * a * c;
+        if (disc < 0.0f) return false;
+
+        float sqrtD = std::sqrt(disc);
+        float t0 = (-b - sqrtD) / (2.0f * a);
+        float t1 = (-b + sqrtD) / (2.0f * a);
+
+        float t = std::numeric_limits<float>::infinity();
+        if (t0 >= 0.0f) t = t0;
+        else if (t1 >= 0.0f) t = t1; // origin 内部なら除外済みなので通常はこちらは有効になることは少ない
+
+        if (!(t >= 0.0f) || t > maxDistance) return false;
+
+        if (hitInfo)
+        {
+            Vector3 hitPoint = origin + direction * t;
+            Vector3 normal = hitPoint - centerWorld;
+            float len = normal.magnitude();
+            if (len > eps) normal /= len;
+            else normal = Vector3(1, 0, 0);
+
+            hitInfo->point = hitPoint;
+            hitInfo->normal = normal;
+            hitInfo->distance = t;
+        }
+
+        return true;
+    }
+
+
+    void AABBGeometory::clear()
+    {
+        minX.clear(); minY.clear(); minZ.clear();
+        maxX.clear(); maxY.clear(); maxZ.clear();
+    }
+
+    int AABBGeometory::add(const Bounds& bounds)
+    {
+        Vector3 mn = bounds.min();
+        Vector3 mx = bounds.max();
+        minX.push_back(mn.x); minY.push_back(mn.y); minZ.push_back(mn.z);
+        maxX.push_back(mx.x); maxY.push_back(mx.y); maxZ.push_back(mx.z);
+        return size() - 1;
+    }
+
+    void AABBGeometory::set(int index, const Bounds& bounds)
+    {
+        Vector3 mn = bounds.min();
+        Vector3 mx = bounds.max();
+        minX[index] = mn.x; minY[index] = mn.y; minZ[index] = mn.z;
+        maxX[index] = mx.x; maxY[index] = mx.y; maxZ[index] = mx.z;
+    }
+
+
+    // 箱へのレイキャスト。始点が内部のときは当たらない
+    bool AABBGeometory::raycast(Vector3 bmin, Vector3 bmax, Vector3 origin, Vector3 direction, float maxDistance, RaycastHit* hitInfo)
+    {
+        const float eps = 1e-6f;
+
+        // origin が内部にある場合は Unity と同様に無視する
+        Vector3 closest(
+            std::max(bmin.x, std::min(origin.x, bmax.x)),
+            std::max(bmin.y, std::min(origin.y, bmax.y)),
+            std::max(bmin.z, std::min(origin.z, bmax.z)));
+        if ((closest - origin).sqrMagnitude() <= eps * eps)
+        {
+            return false;
+        }
+
+        float tmin = 0.0f;
+        float tmax = maxDistance;
+
+        // X axis
+        if (fabs(direction.x) < eps)
+        {
+            if (origin.x < bmin.x || origin.x > bmax.x) return false;
+        }
+        else
+        {
+            float inv = 1.0f / direction.x;
+            float t1 = (bmin.x - origin.x) * inv;
+            float t2 = (bmax.x - origin.x) * inv;
+            float tn = std::min(t1, t2);
+            float tf = std::max(t1, t2);
+            tmin = std::max(tmin, tn);
+            tmax = std::min(tmax, tf);
+            if (tmin > tmax) return false;
+        }
+
+        // Y axis
+        if (fabs(direction.y) < eps)
+        {
+            if (origin.y < bmin.y || origin.y > bmax.y) return false;
+        }
+        else
+        {
+            float inv = 1.0f / direction.y;
+            float t1 = (bmin.y - origin.y) * inv;
+            float t2 = (bmax.y - origin.y) * inv;
+            float tn = std::min(t1, t2);
+            float tf = std::max(t1, t2);
+            tmin = std::max(tmin, tn);
+            tmax = std::min(tmax, tf);
+            if (tmin > tmax) return false;
+        }
+
+        // Z axis
+        if (fabs(direction.z) < eps)
+        {
+            if (origin.z < bmin.z || origin.z > bmax.z) return false;
+        }
+        else
+        {
+            float inv = 1.0f / direction.z;
+            float t1 = (bmin.z - origin.z) * inv;
+            float t2 = (bmax.z - origin.z) * inv;
+            float tn = std::min(t1, t2);
+            float tf = std::max(t1, t2);
+            tmin = std::max(tmin, tn);
+            tmax = std::min(tmax, tf);
+            if (tmin > tmax) return false;
+        }
+
+        float tHit = tmin;
+        if (tHit < 0.0f) tHit = 0.0f;
+
+        if (tHit <= maxDistance)
+        {
+            if (hitInfo)
+            {
+                Vector3 hitPoint = origin + direction * tHit;
+
+                Vector3 normal = Vector3::zero;
+                const float normEps = 1e-3f;
+                if (fabs(hitPoint.x - bmin.x) < normEps) normal = Vector3(-1, 0, 0);
+                else if (fabs(hitPoint.x - bmax.x) < normEps) normal = Vector3(1, 0, 0);
+                else if (fabs(hitPoint.y - bmin.y) < normEps) normal = Vector3(0, -1, 0);
+                else if (fabs(hitPoint.y - bmax.y) < normEps) normal = Vector3(0, 1, 0);
+                else if (fabs(hitPoint.z - bmin.z) < normEps) normal = Vector3(0, 0, -1);
+                else if (fabs(hitPoint.z - bmax.z) < normEps) normal = Vector3(0, 0, 1);
+                else
+                {
+                    Vector3 invDir = -direction;
+                    float len = std::sqrt(invDir.x * invDir.x + invDir.y * invDir.y + invDir.z * invDir.z);
+                    if (len > eps) normal = invDir / len;
+                }
+
+                hitInfo->point = hitPoint;
+                hitInfo->normal = normal;
+                hitInfo->distance = tHit;
+            }
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -3,6 +3,40 @@
 
 #include <algorithm>
 
+#include <UniDx/JobSystem.h>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    // outer が inner を完全に含むか
+    bool contains(const Bounds& outer, const Bounds& inner)
+    {
+        Vector3 omin = outer.min(), omax = outer.max();
+        Vector3 imin = inner.min(), imax = inner.max();
+        return omin.x <= imin.x && omin.y <= imin.y && omin.z <= imin.z
+            && imax.x <= omax.x && imax.y <= omax.y && imax.z <= omax.z;
+    }
+
+    // bounds が点を含むか
+    bool contains(const Bounds& bounds, Vector3 point)
+    {
+        Vector3 bmin = bounds.min(), bmax = bounds.max();
+        return bmin.x <= point.x && bmin.y <= point.y && bmin.z <= point.z
+            && point.x <= bmax.x && point.y <= bmax.y && point.z <= bmax.z;
+    }
+
+    // 近隣セルのうちインデクスが前になる13方向。ペアを片側からだけ見つけるために使う
+    constexpr std::array<std::array<int, 3>, 13> lowerNeighborOffsets = { {
+        {-1, -1, -1}, { 0, -1, -1}, { 1, -1, -1},
+        {-1,  0, -1}, { 0,  0, -1}, { 1,  0, -1},
+        {-1,  1, -1}, { 0,  1, -1}, { 1,  1, -1},
+        {-1, -1,  0}, { 0, -1,  0}, { 1, -1,  0},
+        {-1,  0,  0},
+    } };
+}
+
 
 namespace UniDx
 {
@@ -10,24 +44,264 @@ namespace UniDx
 
     PhysicsGrid::PhysicsGrid(
         CheckBoundFunc checkBoundFunc)
-        : gridNodeSize(0), checkBoundF(checkBoundFunc)
+        : Broadphase(checkBoundFunc), gridNodeSize(0), reinsertCount(0), rebuilt(false)
     {
         // GridNodesはできるだけ再利用し、最初にある程度の数を予約
         gridNodes.resize(64);
-        traverseAncestorShapes.reserve(4);
-        traverseNeighborGrids.reserve(28);
     }
 
     // グリッドに登録するShapeを更新
     void PhysicsGrid::update(std::span<PhysicsShape> shapes)
     {
+        reinsertCount = 0;
+        rebuilt = !incremental || gridNodeSize == 0;
+
+        // プロキシにShapeを結び付ける。vectorの再確保でアドレスが変わるので毎回張り直す
+        for (auto& shape : shapes)
+        {
+            if (shape.proxyId < 0)
+            {
+                if (freeProxies.empty())
+                {
+                    shape.proxyId = int(proxies.size());
+                    proxies.emplace_back();
+                }
+                else
+                {
+                    shape.proxyId = freeProxies.back();
+                    freeProxies.pop_back();
+                }
+                proxies[shape.proxyId].node = nullptr;
+            }
+            proxies[shape.proxyId].shape = &shape;
+
+            // ルートの外に出たものがあればルートを広げて作り直す
+            if (!rebuilt && !contains(gridNodes[0].bounds, shape.moveBounds))
+            {
+                rebuilt = true;
+            }
+        }
+
+        if (rebuilt)
+        {
+            rebuild(shapes);
+            return;
+        }
+
+        // セルを出たShapeだけ入れ直す
+        GridNode* rootGrid = &gridNodes[0];
+        for (auto& shape : shapes)
+        {
+            Proxy& proxy = proxies[shape.proxyId];
+            if (proxy.node != nullptr && isInPlace(proxy, shape.moveBounds)) continue;
+
+            if (proxy.node != nullptr)
+            {
+                removeFromNode(shape.proxyId);
+            }
+            insertShape(rootGrid, shape.proxyId, shapeMin);
+            reinsertCount++;
+        }
+
+        // 出ていったShapeや縮んだShapeの分が残らないよう、シェープを含む境界を今の位置で作り直す
+        refitShapeBounds();
+    }
+
+    // Shapeをグリッドから取り除く
+    void PhysicsGrid::remove(PhysicsShape& shape)
+    {
+        if (shape.proxyId < 0) return;
+
+        if (proxies[shape.proxyId].node != nullptr)
+        {
+            removeFromNode(shape.proxyId);
+        }
+        proxies[shape.proxyId].shape = nullptr;
+        freeProxies.push_back(shape.proxyId);
+        shape.proxyId = -1;
+    }
+
+    // 衝突する可能性のあるペアを集める
+    // ルート直下の子セルごとに巡回を分けて並列に処理し、結果はセルの順に渡す
+    void PhysicsGrid::gatherPairs()
+    {
+        if (gridNodeSize == 0) return;
+
+        GridNode* rootGrid = &gridNodes[0];
+
+        // ルートに置かれた大きなShape同士
+        for (int i = 0; i < rootGrid->shapes.size(); ++i)
+        {
+            for (int j = i + 1; j < rootGrid->shapes.size(); ++j)
+            {
+                checkBoundF(proxies[rootGrid->shapes[i]].shape, proxies[rootGrid->shapes[j]].shape);
+            }
+        }
+        if (rootGrid->isLeaf()) return;
+
+        // 子セルごとのタスクを作る
+        traverseTasks.clear();
+        for (int z = 0; z < rootGrid->childZ; ++z)
+        {
+            for (int y = 0; y < rootGrid->childY; ++y)
+            {
+                for (int x = 0; x < rootGrid->childX; ++x)
+                {
+                    if (rootGrid->getChild(x, y, z) != nullptr)
+                    {
+                        traverseTasks.push_back({ x, y, z });
+                    }
+                }
+            }
+        }
+        if (traverseContexts.size() < traverseTasks.size())
+        {
+            traverseContexts.resize(traverseTasks.size());
+        }
+
+        auto traverseTask = [this, rootGrid](size_t i)
+        {
+            const auto& task = traverseTasks[i];
+            TraverseContext& context = traverseContexts[i];
+            context.pairs.clear();
+            context.ancestorShapes.clear();
+            context.neighbor.clear();
+
+            context.ancestorShapes.push_back(rootGrid->shapes);
+            for (const auto& o : lowerNeighborOffsets)
+            {
+                context.neighbor.push_back(rootGrid->getChild(task[0] + o[0], task[1] + o[1], task[2] + o[2]));
+            }
+            traverseNode(rootGrid->getChild(task[0], task[1], task[2]), context);
+        };
+
+        // タスクの分け方はスレッド数によらないので、ペアの並びは常に同じになる
+        const int shapeCount = int(proxies.size() - freeProxies.size());
+        if (multithread && shapeCount >= parallelThreshold && traverseTasks.size() > 1)
+        {
+            JobSystem::parallelFor(0, int(traverseTasks.size()), 1, traverseTask);
+        }
+        else
+        {
+            for (size_t i = 0; i < traverseTasks.size(); ++i)
+            {
+                traverseTask(i);
+            }
+        }
+
+        // タスクの順にまとめる
+        for (size_t i = 0; i < traverseTasks.size(); ++i)
+        {
+            for (const auto& pair : traverseContexts[i].pairs)
+            {
+                checkBoundF(pair.first, pair.second);
+            }
+        }
+    }
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    // 子セルは shapeBounds に入る距離の遠い順に積み、近いセルから取り出す
+    void PhysicsGrid::raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const
+    {
+        if (gridNodeSize == 0) return;
+
+        std::vector<std::pair<float, const GridNode*>> stack;
+        stack.reserve(64);
+        stack.emplace_back(0.0f, &gridNodes[0]);
+        while (!stack.empty())
+        {
+            auto [t, node] = stack.back();
+            stack.pop_back();
+            if (t > maxDistance) continue;
+
+            for (int id : node->shapes)
+            {
+                PhysicsShape* shape = proxies[id].shape;
+                float enter;
+                if (RayOverlapsBounds(origin, direction, radius, maxDistance, shape->moveBounds, enter))
+                {
+                    maxDistance = std::min(maxDistance, func(shape, enter, maxDistance));
+                }
+            }
+
+            const size_t base = stack.size();
+            for (const GridNode* child : node->children)
+            {
+                float enter;
+                if (child != nullptr && RayOverlapsBounds(origin, direction, radius, maxDistance, child->shapeBounds, enter))
+                {
+                    stack.emplace_back(enter, child);
+                }
+            }
+            std::sort(stack.begin() + base, stack.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        }
+    }
+
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool PhysicsGrid::query(const Bounds& bounds, const QueryFunc& func) const
+    {
+        if (gridNodeSize == 0) return true;
+
+        std::vector<const GridNode*> stack;
+        stack.reserve(64);
+        stack.push_back(&gridNodes[0]);
+        while (!stack.empty())
+        {
+            const GridNode* node = stack.back();
+            stack.pop_back();
+
+            for (int id : node->shapes)
+            {
+                PhysicsShape* shape = proxies[id].shape;
+                if (shape->moveBounds.Intersects(bounds) && !func(shape)) return false;
+            }
+            for (const GridNode* child : node->children)
+            {
+                if (child != nullptr && MayIntersect(child->shapeBounds, bounds))
+                {
+                    stack.push_back(child);
+                }
+            }
+        }
+        return true;
+    }
+
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t PhysicsGrid::getMemoryUsage() const
+    {
+        size_t bytes = gridNodes.size() * sizeof(GridNode) + CapacityBytes(proxies) + CapacityBytes(freeProxies) + CapacityBytes(traverseTasks);
+        for (const auto& node : gridNodes)
+        {
+            bytes += CapacityBytes(node.shapes) + CapacityBytes(node.children);
+        }
+        for (const auto& context : traverseContexts)
+        {
+            bytes += sizeof(TraverseContext) + CapacityBytes(context.ancestorShapes) + CapacityBytes(context.neighbor) + CapacityBytes(context.pairs);
+        }
+        return bytes;
+    }
+
+    // グリッド全体を作り直す
+    void PhysicsGrid::rebuild(std::span<PhysicsShape> shapes)
+    {
+        // 差分更新のときは外に出たShapeを含めたうえで余裕を持たせ、作り直しの回数を減らす
+        const bool growRoot = incremental && gridNodeSize > 0;
+
         gridNodeSize = 0;
 
         // ルートグリッド作成
-        GridNode* rootGrid = addGridNode();
-        if (shapes.size() == 0) return;
+        GridNode* rootGrid = addGridNode(nullptr);
+        if (shapes.size() == 0)
+        {
+            gridNodeSize = 0;
+            return;
+        }
 
-        Vector3 shapeMin = Vector3::positiveInfinity;
+        // ノードは使い回すので、前の範囲を引き継がないように今のShapeだけから作る
+        rootGrid->bounds.SetMinMax(shapes[0].moveBounds.min(), shapes[0].moveBounds.max());
+        shapeMin = Vector3::positiveInfinity;
         Vector3 shapeAve;
         for (auto& shape : shapes)
         {
@@ -40,33 +314,92 @@ namespace UniDx
         Vector3 cellMin = Max(shapeAve, shapeMin * 2);
         // 最小セルは平均Shapeサイズにする。ただし最小コライダーがすれ違えない大きさより小さくしない
 
+        if (growRoot)
+        {
+            rootGrid->bounds.Expand(rootGrid->bounds.size() * 0.25f);
+        }
+
         rootGrid->setLeafCellSize(nodeDivide, cellMin);
         subdivide(rootGrid, shapeMin);
 
         // グリッドに登録
         for (auto& shape : shapes)
         {
-            insertShape(rootGrid, &shape, shapeMin);
+            insertShape(rootGrid, shape.proxyId, shapeMin);
         }
+        reinsertCount = int(shapes.size());
+    }
 
+    // 各ノードのシェープを含む境界を、ノードのShapeと子の境界から作り直す
+    // 子ノードは必ず親より後ろに作られるので、後ろから順に親へ広げていけば1回で済む
+    void PhysicsGrid::refitShapeBounds()
+    {
+        for (int i = 0; i < gridNodeSize; ++i)
+        {
+            gridNodes[i].shapeBounds.extents = Vector3::negativeInfinity;
+        }
+        for (int i = gridNodeSize - 1; i > 0; --i)
+        {
+            GridNode& node = gridNodes[i];
+            for (int id : node.shapes)
+            {
+                node.shapeBounds.Encapsulate(proxies[id].shape->moveBounds);
+            }
+            // Shapeのないノードの境界は空のまま。親に広げると無限大になるので飛ばす
+            if (node.shapeBounds.extents.x < 0.0f) continue;
+            node.parent->shapeBounds.Encapsulate(node.shapeBounds);
+        }
     }
 
-    // 衝突する可能性のあるペアを集める
-    void PhysicsGrid::gatherPairs()
+    // 登録済みのセルに今の位置とサイズで留まれるか
+    bool PhysicsGrid::isInPlace(const Proxy& proxy, const Bounds& moveBounds) const
+    {
+        const GridNode* node = proxy.node;
+        Vector3 size = moveBounds.size();
+
+        // 親の階層に置くべき大きさになった
+        if (node->parent != nullptr)
+        {
+            if (node->parent->isTooBig(size)) return false;
+            if (!contains(node->bounds, moveBounds.Center)) return false;
+        }
+
+        // 葉に置いたものは小さいまま、この階層に置いたものは大きいままであること
+        return proxy.small ? !node->isTooBig(size) : node->isTooBig(size);
+    }
+
+    // ノードにプロキシを追加
+    void PhysicsGrid::addToNode(GridNode* node, int proxyId, bool small)
+    {
+        Proxy& proxy = proxies[proxyId];
+        proxy.node = node;
+        proxy.slot = int(node->shapes.size());
+        proxy.small = small;
+        node->shapes.push_back(proxyId);
+        if (small) node->smallShapeSize++;
+    }
+
+    // 所属ノードからプロキシを外す。末尾と入れ替えて詰める
+    void PhysicsGrid::removeFromNode(int proxyId)
     {
-        traverseAncestorShapes.clear();
-        traverseNeighborGrids.clear();
-        traverseNode(&gridNodes[0], traverseAncestorShapes, traverseNeighborGrids);
+        Proxy& proxy = proxies[proxyId];
+        GridNode* node = proxy.node;
+        int last = node->shapes.back();
+        node->shapes[proxy.slot] = last;
+        proxies[last].slot = proxy.slot;
+        node->shapes.pop_back();
+        if (proxy.small) node->smallShapeSize--;
+        proxy.node = nullptr;
     }
 
     // 新しいグリッドノードを作成する（内部では再利用する）
-    PhysicsGrid::GridNode* PhysicsGrid::addGridNode()
+    PhysicsGrid::GridNode* PhysicsGrid::addGridNode(GridNode* parent)
     {
         if (gridNodeSize == gridNodes.size())
         {
             gridNodes.emplace_back();
         }
-        return &gridNodes[gridNodeSize++].initialize();
+        return &gridNodes[gridNodeSize++].initialize(parent);
     }
 
     // 子ノードを作ってセルを分割
@@ -74,24 +407,27 @@ namespace UniDx
     {
         node->makeChildren(); // 子ノードのポインタ配列のみ作成
 
-        // 子の中で小さいものを振り分ける
-        for(auto it = node->shapes.begin(); it != node->shapes.end(); )
+        // 子の中で小さいものを振り分ける。大きいものは順序を保ってこの階層に残す
+        auto smallBegin = std::stable_partition(node->shapes.begin(), node->shapes.end(),
+            [this, node](int id) { return node->isTooBig(proxies[id].shape->moveBounds.size()); });
+        for (auto it = smallBegin; it != node->shapes.end(); ++it)
         {
-            if(node->isTooBig((*it)->moveBounds.size()))
-            {
-                ++it;
-            }
-            else
-            {
-                insertShapeToChild(node, *it, cellMin);
-                it = node->shapes.erase(it);
-            }
+            insertShapeToChild(node, *it, cellMin);
+        }
+        node->shapes.erase(smallBegin, node->shapes.end());
+        node->smallShapeSize = 0;
+
+        for (int i = 0; i < node->shapes.size(); ++i)
+        {
+            proxies[node->shapes[i]].slot = i;
+            proxies[node->shapes[i]].small = false;
         }
     }
 
     // shapeの位置に該当する子グリッドに挿入
-    void PhysicsGrid::insertShapeToChild(GridNode* node, PhysicsShape* shape, Vector3 cellMin)
+    void PhysicsGrid::insertShapeToChild(GridNode* node, int proxyId, Vector3 cellMin)
     {
+        PhysicsShape* shape = proxies[proxyId].shape;
         auto offset = shape->moveBounds.Center - node->bounds.min();
         auto indexVec = offset / node->stride;
  
@@ -103,7 +439,7 @@ namespace UniDx
         if (childNode == nullptr)
         {
             // 子ノードを作って境界を計算
-            childNode = addGridNode();
+            childNode = addGridNode(node);
             auto boundsMin = node->bounds.min() + node->stride * Vector3(float(ix), float(iy), float(iz));
             auto boundsMax = boundsMin + node->stride;
             childNode->bounds.SetMinMax(boundsMin, boundsMax);
@@ -115,26 +451,25 @@ namespace UniDx
         childNode->shapeBounds.Encapsulate(shape->moveBounds);
 
         // Shapeを挿入（呼び出し元の再帰）
-        insertShape(childNode, shape, cellMin);
+        insertShape(childNode, proxyId, cellMin);
     }
 
     // グリッドにshapeを挿入
-    void PhysicsGrid::insertShape(GridNode* node, PhysicsShape* shape, Vector3 cellMin)
+    void PhysicsGrid::insertShape(GridNode* node, int proxyId, Vector3 cellMin)
     {
         // この階層のセルサイズと比べて大きすぎるかどうか
         // セルサイズの２つ隣まで及ぶ可能性があるもの
-        const bool tooBig = node->isTooBig(shape->moveBounds.size());
+        const bool tooBig = node->isTooBig(proxies[proxyId].shape->moveBounds.size());
         if (tooBig)
         {
-            node->shapes.push_back(shape);
+            addToNode(node, proxyId, false);
             return; // 小さなセルには置かない
         }
 
         if (node->isLeaf())
         {
             // まだ分割されていない葉であれば、この階層に置く
-            node->shapes.push_back(shape);
-            node->smallShapeSize++;
+            addToNode(node, proxyId, true);
 
             // 数が多すぎ＆まだ十分セルを小さくできるなら subdivide
             if (node->smallShapeSize > maxPerCell && node->childX * node->childY * node->childZ >= 8)
@@ -145,17 +480,17 @@ namespace UniDx
         else
         {
             // 子にShapeを挿入
-            insertShapeToChild(node, shape, cellMin);
+            insertShapeToChild(node, proxyId, cellMin);
         }
     }
 
     // 指定したshapeとノードに登録されたshapeの境界を調べて衝突可能性ペアを作る
-    void PhysicsGrid::checkBounds(GridNode* node, PhysicsShape* shape)
+    void PhysicsGrid::checkBounds(GridNode* node, PhysicsShape* shape, TraverseContext& context)
     {
         // グリッドに直接登録されているものをチェック
-        for (auto& nodeShape : node->shapes)
+        for (int id : node->shapes)
         {
-            checkBoundF(shape, nodeShape);
+            addPair(shape, proxies[id].shape, context);
         }
 
         if (node->isLeaf()) return;
@@ -165,8 +500,8 @@ namespace UniDx
         auto indexVecMin = offsetMin / node->stride;
         auto indexVecMax = offsetMax / node->stride;
 
-        // 相手の最大半サイズ広げてチェックする
-        auto extend = node->leafCellSize * 0.5f;
+        // 子に置かれるShapeはセルより小さいので、インデクスで半セル広げてチェックする
+        const Vector3 extend(0.5f, 0.5f, 0.5f);
         int sx = std::max(int(indexVecMin.x - extend.x), 0);
         int sy = std::max(int(indexVecMin.y - extend.y), 0);
         int sz = std::max(int(indexVecMin.z - extend.z), 0);
@@ -180,26 +515,39 @@ namespace UniDx
                 for (int x = sx; x < ex; ++x)
                 {
                     auto* childGrid = node->getChild(x, y, z);
-                    if (childGrid != nullptr && childGrid->shapeBounds.Intersects(shape->moveBounds))
+                    if (childGrid != nullptr && MayIntersect(childGrid->shapeBounds, shape->moveBounds))
                     {
-                        checkBounds(childGrid, shape);
+                        checkBounds(childGrid, shape, context);
                     }
                 }
             }
         }
     }
 
+    // 境界が重なっていればタスクのペアに加える
+    void PhysicsGrid::addPair(PhysicsShape* shape1, PhysicsShape* shape2, TraverseContext& context)
+    {
+        if (shape1->canCollide(*shape2) && shape1->moveBounds.Intersects(shape2->moveBounds))
+        {
+            context.pairs.push_back({ shape1, shape2 });
+        }
+    }
+
     // 指定したノードを巡って、衝突可能性のあるペアを作る
-    void PhysicsGrid::traverseNode(GridNode* node, std::vector<std::span<PhysicsShape*>>& ancestorShapes, std::vector<GridNode*>& neighbor)
+    void PhysicsGrid::traverseNode(GridNode* node, TraverseContext& context)
     {
+        auto& ancestorShapes = context.ancestorShapes;
+        auto& neighbor = context.neighbor;
+
         // 上の階層に属するShapeとこの階層のShape
         for (auto& shapes : ancestorShapes)
         {
-            for (auto a : shapes)
+            for (int a : shapes)
             {
-                for (auto* s : node->shapes)
+                if (!MayIntersect(node->shapeBounds, proxies[a].shape->moveBounds)) continue;
+                for (int s : node->shapes)
                 {
-                    checkBoundF(a, s);
+                    addPair(proxies[a].shape, proxies[s].shape, context);
                 }
             }
         }
@@ -209,17 +557,24 @@ namespace UniDx
         {
             for (int j = i + 1; j < node->shapes.size(); ++j)
             {
-                checkBoundF(node->shapes[i], node->shapes[j]);
+                addPair(proxies[node->shapes[i]].shape, proxies[node->shapes[j]].shape, context);
             }
         }
 
         // この階層と近隣グリッド
-        for (auto* n : neighbor)
+        if (!node->shapes.empty())
         {
-            if (n == nullptr) continue;
-            for (auto* s : node->shapes)
+            for (auto* n : neighbor)
             {
-                checkBounds(n, s);
+                if (n == nullptr || !MayIntersect(n->shapeBounds, node->shapeBounds)) continue;
+                for (int s : node->shapes)
+                {
+                    PhysicsShape* shape = proxies[s].shape;
+                    if (MayIntersect(n->shapeBounds, shape->moveBounds))
+                    {
+                        checkBounds(n, shape, context);
+                    }
+                }
             }
         }
 
@@ -239,15 +594,12 @@ namespace UniDx
                 {
                     auto c = node->getChild(x, y, z);
                     if (c == nullptr) continue;
-                    neighbor.push_back(node->getChild(x-1, y-1, z-1));
-                    neighbor.push_back(node->getChild(x-1, y-1, z));
-                    neighbor.push_back(node->getChild(x-1, y, z-1));
-                    neighbor.push_back(node->getChild(x-1, y, z));
-                    neighbor.push_back(node->getChild(x, y-1, z-1));
-                    neighbor.push_back(node->getChild(x, y-1, z));
-                    neighbor.push_back(node->getChild(x, y, z-1));
-                    traverseNode(c, ancestorShapes, neighbor);
-                    neighbor.resize(neighbor.size()-7);
+                    for (const auto& o : lowerNeighborOffsets)
+                    {
+                        neighbor.push_back(node->getChild(x + o[0], y + o[1], z + o[2]));
+                    }
+                    traverseNode(c, context);
+                    neighbor.resize(neighbor.size() - lowerNeighborOffsets.size());
                 }
             }
         }
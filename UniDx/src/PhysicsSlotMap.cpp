@@ -0,0 +1,54 @@
+﻿#include "pch.h"
+#include <PhysicsSlotMap.h>
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    // 配列の group 番目の index に入れたものを登録してハンドルを返す
+    PhysicsHandle PhysicsSlotMap::add(int index, int group)
+    {
+        uint32_t slot;
+        if (freeList >= 0)
+        {
+            slot = uint32_t(freeList);
+            freeList = slots[slot].group;
+        }
+        else
+        {
+            slot = uint32_t(slots.size());
+            slots.push_back({ -1, 0, -1 });
+        }
+        slots[slot].index = index;
+        slots[slot].group = group;
+
+        PhysicsHandle handle;
+        handle.index = slot;
+        handle.generation = slots[slot].generation;
+        return handle;
+    }
+
+
+    // 登録を解除する。以後 handle は無効になる
+    void PhysicsSlotMap::remove(PhysicsHandle handle)
+    {
+        if (!contains(handle)) return;
+
+        Slot& slot = slots[handle.index];
+        slot.index = -1;
+        slot.generation++;
+        slot.group = freeList;
+        freeList = int(handle.index);
+    }
+
+
+    // 要素を別の場所に移した
+    void PhysicsSlotMap::move(PhysicsHandle handle, int index, int group)
+    {
+        if (!contains(handle)) return;
+
+        slots[handle.index].index = index;
+        slots[handle.index].group = group;
+    }
+}
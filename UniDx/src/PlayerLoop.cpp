@@ -10,6 +10,9 @@
 #include <UniDx/LightManager.h>
 #include <UniDx/Input.h>
 #include <UniDx/Canvas.h>
+#include <UniDx/JobSystem.h>
+#include <UniDx/ParallelBehaviour.h>
+#include <UniDx/ParallelCommandBuffer.h>
 
 using namespace std;
 using namespace UniDx;
@@ -31,6 +34,9 @@ void PlayerLoop::Initialize(HWND hWnd)
     // 入力の初期化
     Input::initialize();
 
+    // ジョブシステムのインスタンス作成。物理エンジンなどが並列処理に使う
+    JobSystem::create();
+
     // 物理エンジンのインスタンス作成
     Physics::create();
 
@@ -121,6 +127,9 @@ int PlayerLoop::MainLoop()
         // 入力更新
         input();
 
+        // 並列更新処理
+        parallelUpdate();
+
         // 更新処理
         update();
 
@@ -182,7 +191,7 @@ void PlayerLoop::fixedUpdate()
 // 物理計算
 void PlayerLoop::physics()
 {
-    Physics::getInstance()->simulatePositionCorrection(Time::fixedDeltaTime);
+    Physics::getInstance()->simulateStep(Time::fixedDeltaTime);
 }
 
 
@@ -193,6 +202,36 @@ void PlayerLoop::input()
 }
 
 
+// 並列更新処理
+// Update() の前に、ParallelBehaviour の ParallelUpdate() をワーカースレッドでまとめて呼ぶ
+// 中で行われた AddComponent() や Destroy() は記録しておき、全部終わってから呼んだ順に適用する
+// Transform の行列とクエリ用の境界は先に更新しておき、フェーズの中では読むだけにする
+// ParallelBehaviour がひとつもなければ、階層を巡らずに戻る
+void PlayerLoop::parallelUpdate()
+{
+    if (ParallelBehaviour::getInstanceCount() == 0) return;
+
+    auto* scene = SceneManager::getInstance()->GetActiveScene();
+
+    parallelBehaviours_.clear();
+    for (auto& root : scene->GetRootGameObjects())
+    {
+        collectParallelBehaviours(&*root);
+    }
+    if (parallelBehaviours_.empty()) return;
+
+    Physics::getInstance()->syncTransformsIfNeeded();
+
+    ParallelCommandBuffer::begin();
+    JobSystem::parallelFor(0, int(parallelBehaviours_.size()), 0, [this](int i)
+        {
+            ParallelCommandBuffer::setOrder(i);
+            parallelBehaviours_[i]->ParallelUpdate();
+        });
+    ParallelCommandBuffer::end();
+}
+
+
 //  更新処理
 // Update()中にGameObjectやComponentが追加されるとvectorが再確保されるため、
 // イテレータではなくインデックスで巡回する。
@@ -288,6 +327,7 @@ void PlayerLoop::finalize()
     SceneManager::destroy();
     LightManager::destroy();
     Physics::destroy();
+    JobSystem::destroy();
     D3DManager::destroy();
 }
 
@@ -340,6 +380,28 @@ void PlayerLoop::checkStart(GameObject* object)
 }
 
 
+// ParallelUpdate() を呼ぶ Behaviour を update(GameObject*) と同じ順に集める
+// Transform のゲッターは行列を遅れて計算して書き込むので、親から順にここで計算しておく
+void PlayerLoop::collectParallelBehaviours(GameObject* object)
+{
+    object->transform->localToWorldMatrix();
+
+    for (auto& component : object->GetComponents())
+    {
+        auto behaviour = dynamic_cast<ParallelBehaviour*>(component.get());
+        if (behaviour != nullptr && behaviour->enabled && behaviour->didStart())
+        {
+            parallelBehaviours_.push_back(behaviour);
+        }
+    }
+
+    for (auto& child : object->transform->getChildGameObjects())
+    {
+        collectParallelBehaviours(&*child);
+    }
+}
+
+
 void PlayerLoop::update(GameObject* object)
 {
     // アタッチされている各コンポーネントのUpdateを呼ぶ
@@ -0,0 +1,386 @@
+﻿#include "pch.h"
+#include <StaticAABBTree.h>
+
+#include <algorithm>
+#include <bit>
+
+#include <UniDx/Physics.h>
+
+
+namespace
+{
+    using namespace UniDx;
+
+    float axisOf(Vector3 v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+}
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    StaticAABBTree::StaticAABBTree(
+        CheckBoundFunc checkBoundFunc)
+        : checkBoundF(checkBoundFunc), deadItems(0), presentLayers(0), dirty(false), rebuilt(false)
+    {
+        layerRoots.fill(-1);
+        traverseStack.reserve(64);
+        overlapIndices.reserve(16);
+    }
+
+
+    // 静的なShapeを更新。追加・削除・移動は保留リストに回し、溜まったら木を作り直す
+    void StaticAABBTree::update(std::span<PhysicsShape> staticShapes)
+    {
+        for (auto& shape : staticShapes)
+        {
+            if (shape.proxyId < 0)
+            {
+                if (freeProxies.empty())
+                {
+                    shape.proxyId = int(proxies.size());
+                    proxies.emplace_back();
+                }
+                else
+                {
+                    shape.proxyId = freeProxies.back();
+                    freeProxies.pop_back();
+                }
+                Proxy& added = proxies[shape.proxyId];
+                added.bounds = shape.moveBounds;
+                added.layerBit = shape.layerBit;
+                added.item = -1;
+                pending.push_back(shape.proxyId);
+                dirty = true;
+            }
+
+            // vectorの再確保でアドレスが変わるので毎回張り直す
+            Proxy& proxy = proxies[shape.proxyId];
+            proxy.shape = &shape;
+            if (proxy.bounds.Center != shape.moveBounds.Center || proxy.bounds.extents != shape.moveBounds.extents
+                || proxy.layerBit != shape.layerBit)
+            {
+                // 木に入っていたものは外して保留リストに移す
+                if (proxy.item >= 0)
+                {
+                    detach(shape.proxyId);
+                    pending.push_back(shape.proxyId);
+                }
+                proxy.bounds = shape.moveBounds;
+                proxy.layerBit = shape.layerBit;
+                dirty = true;
+            }
+        }
+
+        const int changes = int(pending.size()) + deadItems;
+        rebuilt = changes > std::max(minRebuildChanges, int(float(int(items.size()) - deadItems) * rebuildRatio));
+        if (rebuilt)
+        {
+            rebuild();
+        }
+        else if (dirty)
+        {
+            pendingBounds.clear();
+            for (int id : pending)
+            {
+                pendingBounds.push_back(proxies[id].bounds);
+            }
+        }
+        dirty = false;
+    }
+
+
+    // Shapeを取り除く
+    void StaticAABBTree::remove(PhysicsShape& shape)
+    {
+        if (shape.proxyId < 0) return;
+
+        Proxy& proxy = proxies[shape.proxyId];
+        if (proxy.item >= 0)
+        {
+            detach(shape.proxyId);
+        }
+        else
+        {
+            pending.erase(std::find(pending.begin(), pending.end(), shape.proxyId));
+            dirty = true;
+        }
+        proxy.shape = nullptr;
+        freeProxies.push_back(shape.proxyId);
+        shape.proxyId = -1;
+    }
+
+
+    // 木の葉からプロキシを外す。葉の並びは変えずに -1 にしておき、作り直すまで飛ばす
+    void StaticAABBTree::detach(int proxyId)
+    {
+        Proxy& proxy = proxies[proxyId];
+        items[proxy.item] = -1;
+        proxy.item = -1;
+        deadItems++;
+    }
+
+
+    // 動くShapeと静的なShapeのペアを集める
+    void StaticAABBTree::gatherPairs(std::span<PhysicsShape> dynamicShapes)
+    {
+        if (nodes.empty() && pending.empty()) return;
+
+        for (auto& shape : dynamicShapes)
+        {
+            // 衝突するレイヤーの木だけをたどる
+            traverseStack.clear();
+            for (uint32_t mask = shape.collisionMask & presentLayers; mask != 0; mask &= mask - 1)
+            {
+                traverseStack.push_back(layerRoots[std::countr_zero(mask)]);
+            }
+            while (!traverseStack.empty())
+            {
+                const TreeNode& node = nodes[traverseStack.back()];
+                traverseStack.pop_back();
+                if (!node.bounds.Intersects(shape.moveBounds)) continue;
+
+                if (node.count > 0)
+                {
+                    overlapIndices.clear();
+                    itemBounds.gatherOverlaps(shape.moveBounds, node.first, node.first + node.count, overlapIndices);
+                    for (int i : overlapIndices)
+                    {
+                        if (items[i] >= 0) checkBoundF(&shape, proxies[items[i]].shape);
+                    }
+                }
+                else
+                {
+                    traverseStack.push_back(node.first + 1);
+                    traverseStack.push_back(node.first);
+                }
+            }
+
+            // 保留中のShapeは木を通さずにまとめて判定する
+            if (pending.empty()) continue;
+            overlapIndices.clear();
+            pendingBounds.gatherOverlaps(shape.moveBounds, 0, pendingBounds.size(), overlapIndices);
+            for (int i : overlapIndices)
+            {
+                const Proxy& proxy = proxies[pending[i]];
+                if (shape.collisionMask & proxy.layerBit) checkBoundF(&shape, proxy.shape);
+            }
+        }
+    }
+
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    void StaticAABBTree::raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const Broadphase::RaycastFunc& func) const
+    {
+        // 保留中のShapeは -1 - 保留リストの位置で積み、木のノードと同じく近い順に取り出す
+        std::vector<std::pair<float, int>> stack;
+        stack.reserve(32);
+        for (uint32_t mask = presentLayers; mask != 0; mask &= mask - 1)
+        {
+            const int root = layerRoots[std::countr_zero(mask)];
+            float enter;
+            if (RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[root].bounds, enter))
+            {
+                stack.emplace_back(enter, root);
+            }
+        }
+        for (int i = 0; i < int(pending.size()); ++i)
+        {
+            float enter;
+            if (RayOverlapsBounds(origin, direction, radius, maxDistance, proxies[pending[i]].bounds, enter))
+            {
+                stack.emplace_back(enter, -1 - i);
+            }
+        }
+        std::sort(stack.begin(), stack.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        while (!stack.empty())
+        {
+            auto [t, index] = stack.back();
+            stack.pop_back();
+            if (t > maxDistance) continue;
+
+            if (index < 0)
+            {
+                const Proxy& proxy = proxies[pending[-1 - index]];
+                maxDistance = std::min(maxDistance, func(proxy.shape, t, maxDistance));
+                continue;
+            }
+
+            const TreeNode& node = nodes[index];
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    if (items[i] < 0) continue;
+                    const Proxy& proxy = proxies[items[i]];
+                    float t1;
+                    if (RayOverlapsBounds(origin, direction, radius, maxDistance, proxy.bounds, t1))
+                    {
+                        maxDistance = std::min(maxDistance, func(proxy.shape, t1, maxDistance));
+                    }
+                }
+                continue;
+            }
+
+            // 近い子を後に積む
+            float t1, t2;
+            const bool hit1 = RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[node.first].bounds, t1);
+            const bool hit2 = RayOverlapsBounds(origin, direction, radius, maxDistance, nodes[node.first + 1].bounds, t2);
+            if (hit1 && hit2 && t2 < t1)
+            {
+                stack.emplace_back(t1, node.first);
+                stack.emplace_back(t2, node.first + 1);
+            }
+            else
+            {
+                if (hit2) stack.emplace_back(t2, node.first + 1);
+                if (hit1) stack.emplace_back(t1, node.first);
+            }
+        }
+    }
+
+
+    // 境界が bounds と重なるShapeを func に渡す。葉の中は BoundsSoA でまとめて判定する
+    bool StaticAABBTree::query(const Bounds& bounds, const Broadphase::QueryFunc& func) const
+    {
+        std::vector<int> stack;
+        std::vector<int> overlaps;
+        stack.reserve(32);
+        for (uint32_t mask = presentLayers; mask != 0; mask &= mask - 1)
+        {
+            stack.push_back(layerRoots[std::countr_zero(mask)]);
+        }
+        while (!stack.empty())
+        {
+            const TreeNode& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!MayIntersect(node.bounds, bounds)) continue;
+
+            if (node.count > 0)
+            {
+                overlaps.clear();
+                itemBounds.gatherOverlaps(bounds, node.first, node.first + node.count, overlaps);
+                for (int i : overlaps)
+                {
+                    if (items[i] >= 0 && !func(proxies[items[i]].shape)) return false;
+                }
+            }
+            else
+            {
+                stack.push_back(node.first + 1);
+                stack.push_back(node.first);
+            }
+        }
+
+        overlaps.clear();
+        pendingBounds.gatherOverlaps(bounds, 0, pendingBounds.size(), overlaps);
+        for (int i : overlaps)
+        {
+            if (!func(proxies[pending[i]].shape)) return false;
+        }
+        return true;
+    }
+
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t StaticAABBTree::getMemoryUsage() const
+    {
+        return CapacityBytes(proxies) + CapacityBytes(freeProxies) + CapacityBytes(items) + itemBounds.getMemoryUsage()
+            + CapacityBytes(pending) + pendingBounds.getMemoryUsage()
+            + CapacityBytes(overlapIndices) + CapacityBytes(nodes) + CapacityBytes(traverseStack);
+    }
+
+
+    // 全体を作り直す。保留中のShapeも木に入れる
+    void StaticAABBTree::rebuild()
+    {
+        items.clear();
+        for (int id = 0; id < int(proxies.size()); ++id)
+        {
+            if (proxies[id].shape != nullptr) items.push_back(id);
+        }
+        deadItems = 0;
+        pending.clear();
+        pendingBounds.clear();
+
+        nodes.clear();
+        layerRoots.fill(-1);
+        presentLayers = 0;
+        if (items.empty()) return;
+
+        // レイヤーの順に並べ、レイヤーごとに木を作る
+        auto layerOf = [this](int id) { return std::countr_zero(proxies[id].layerBit); };
+        std::stable_sort(items.begin(), items.end(), [&](int a, int b) { return layerOf(a) < layerOf(b); });
+
+        nodes.reserve(items.size() * 2);
+        for (int begin = 0; begin < int(items.size());)
+        {
+            const int layer = layerOf(items[begin]);
+            int end = begin + 1;
+            while (end < int(items.size()) && layerOf(items[end]) == layer) ++end;
+
+            layerRoots[layer] = int(nodes.size());
+            presentLayers |= 1u << layer;
+            nodes.emplace_back();
+            buildNode(layerRoots[layer], begin, end);
+            begin = end;
+        }
+
+        itemBounds.clear();
+        itemBounds.reserve(items.size());
+        for (int i = 0; i < int(items.size()); ++i)
+        {
+            proxies[items[i]].item = i;
+            itemBounds.push_back(proxies[items[i]].bounds);
+        }
+    }
+
+
+    // items[begin, end) を含むノードを作る。中心の並びの中央で最も長い軸を分ける
+    void StaticAABBTree::buildNode(int nodeIndex, int begin, int end)
+    {
+        Vector3 bmin = Vector3::positiveInfinity;
+        Vector3 bmax = Vector3::negativeInfinity;
+        Vector3 cmin = Vector3::positiveInfinity;
+        Vector3 cmax = Vector3::negativeInfinity;
+        for (int i = begin; i < end; ++i)
+        {
+            const Bounds& b = proxies[items[i]].bounds;
+            bmin = Min(bmin, b.min());
+            bmax = Max(bmax, b.max());
+            cmin = Min(cmin, b.Center);
+            cmax = Max(cmax, b.Center);
+        }
+
+        // Center と extents に直したときの丸めで小さくならないよう、少しだけ広げておく
+        Bounds bounds;
+        bounds.SetMinMax(bmin, bmax);
+        bounds.Expand((bounds.size() + Vector3::one) * 1e-4f);
+        nodes[nodeIndex].bounds = bounds;
+
+        const int count = end - begin;
+        if (count <= maxPerLeaf)
+        {
+            nodes[nodeIndex].first = begin;
+            nodes[nodeIndex].count = count;
+            return;
+        }
+
+        Vector3 spread = cmax - cmin;
+        int axis = 0;
+        if (spread.y > spread.x) axis = 1;
+        if (spread.z > axisOf(spread, axis)) axis = 2;
+
+        const int mid = begin + count / 2;
+        std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end,
+            [this, axis](int a, int b) { return axisOf(proxies[a].bounds.Center, axis) < axisOf(proxies[b].bounds.Center, axis); });
+
+        const int child = int(nodes.size());
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[nodeIndex].first = child;
+        nodes[nodeIndex].count = 0;
+        buildNode(child, begin, mid);
+        buildNode(child + 1, mid, end);
+    }
+}
@@ -0,0 +1,357 @@
+﻿#include "pch.h"
+#include <SweepAndPrune.h>
+
+#include <algorithm>
+
+#include <UniDx/Physics.h>
+
+
+namespace UniDx
+{
+    using namespace std;
+
+    SweepAndPrune::SweepAndPrune(
+        CheckBoundFunc checkBoundFunc)
+        : Broadphase(checkBoundFunc), swapCount(0)
+    {
+        // 毎回クリアされるデータはできるだけ再利用する
+        pairs.reserve(128);
+        addedPairs.reserve(64);
+        removedPairs.reserve(64);
+    }
+
+
+    // 登録するShapeを更新して、重なりペアを差分で更新する
+    void SweepAndPrune::update(std::span<PhysicsShape> shapes)
+    {
+        addedPairs.clear();
+        removedPairs.clear();
+        changedPairs.clear();
+        swapCount = 0;
+
+        // 取り除かれたShapeの端点とペアを先に片付けてから、番号を再利用する
+        flushRemoved();
+
+        newProxies.clear();
+        for (auto& shape : shapes)
+        {
+            if (shape.proxyId < 0)
+            {
+                if (freeProxies.empty())
+                {
+                    shape.proxyId = int(proxies.size());
+                    proxies.emplace_back();
+                }
+                else
+                {
+                    shape.proxyId = freeProxies.back();
+                    freeProxies.pop_back();
+                }
+                proxies[shape.proxyId].alive = true;
+                newProxies.push_back(shape.proxyId);
+            }
+
+            // vectorの再確保でアドレスが変わるので毎回張り直す
+            Proxy& proxy = proxies[shape.proxyId];
+            proxy.shape = &shape;
+            Vector3 bmin = shape.moveBounds.min();
+            Vector3 bmax = shape.moveBounds.max();
+            proxy.min[0] = bmin.x; proxy.min[1] = bmin.y; proxy.min[2] = bmin.z;
+            proxy.max[0] = bmax.x; proxy.max[1] = bmax.y; proxy.max[2] = bmax.z;
+        }
+
+        // 一度にたくさん増えたときは挿入ソートより作り直したほうが速い
+        const int newCount = int(newProxies.size());
+        if (newCount > rebuildThreshold && newCount * 4 > int(shapes.size()))
+        {
+            rebuild();
+        }
+        else
+        {
+            // 新しいShapeの端点は末尾に足して、ソートで正しい位置まで動かす
+            for (int id : newProxies)
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    axes[axis].push_back({ proxies[id].min[axis], id, true });
+                    axes[axis].push_back({ proxies[id].max[axis], id, false });
+                }
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                sortAxis(axis);
+            }
+        }
+
+        resolveDeltas();
+    }
+
+
+    // Shapeを取り除く。端点とペアは次の update() でまとめて片付ける
+    void SweepAndPrune::remove(PhysicsShape& shape)
+    {
+        if (shape.proxyId < 0) return;
+
+        proxies[shape.proxyId].alive = false;
+        proxies[shape.proxyId].shape = nullptr;
+        removedProxies.push_back(shape.proxyId);
+        shape.proxyId = -1;
+    }
+
+
+    // 保持している重なりペアを渡す
+    void SweepAndPrune::gatherPairs()
+    {
+        for (const auto& pair : pairs)
+        {
+            checkBoundF(proxies[pair.first].shape, proxies[pair.second].shape);
+        }
+    }
+
+
+    // 太らせたレイと重なるShapeを近い順に func に渡す
+    // 端点の並びはレイの向きと関係がないので、生きているプロキシを全て調べて近い順に並べる
+    void SweepAndPrune::raycast(Vector3 origin, Vector3 direction, float radius, float maxDistance, const RaycastFunc& func) const
+    {
+        std::vector<std::pair<float, PhysicsShape*>> hits;
+        for (const auto& proxy : proxies)
+        {
+            if (!proxy.alive) continue;
+
+            float enter;
+            if (RayOverlapsBox(origin, direction, radius, maxDistance,
+                Vector3(proxy.min[0], proxy.min[1], proxy.min[2]), Vector3(proxy.max[0], proxy.max[1], proxy.max[2]), enter))
+            {
+                hits.emplace_back(enter, proxy.shape);
+            }
+        }
+
+        std::sort(hits.begin(), hits.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (const auto& [t, shape] : hits)
+        {
+            if (t > maxDistance) break;
+            maxDistance = std::min(maxDistance, func(shape, t, maxDistance));
+        }
+    }
+
+
+    // 境界が bounds と重なるShapeを func に渡す
+    bool SweepAndPrune::query(const Bounds& bounds, const QueryFunc& func) const
+    {
+        const Vector3 bmin = bounds.min();
+        const Vector3 bmax = bounds.max();
+        const float qmin[3] = { bmin.x, bmin.y, bmin.z };
+        const float qmax[3] = { bmax.x, bmax.y, bmax.z };
+        for (const auto& proxy : proxies)
+        {
+            if (!proxy.alive) continue;
+
+            bool overlap = true;
+            for (int axis = 0; axis < 3 && overlap; ++axis)
+            {
+                overlap = !(proxy.max[axis] < qmin[axis] || qmax[axis] < proxy.min[axis]);
+            }
+            if (overlap && !func(proxy.shape)) return false;
+        }
+        return true;
+    }
+
+
+    // 確保しているメモリのおおよそのバイト数
+    size_t SweepAndPrune::getMemoryUsage() const
+    {
+        size_t bytes = CapacityBytes(proxies) + CapacityBytes(freeProxies) + CapacityBytes(removedProxies) + CapacityBytes(newProxies)
+            + CapacityBytes(pairs) + CapacityBytes(pairIndex) + CapacityBytes(changedPairs)
+            + CapacityBytes(addedPairs) + CapacityBytes(removedPairs) + CapacityBytes(sweepActive);
+        for (const auto& endpoints : axes)
+        {
+            bytes += CapacityBytes(endpoints);
+        }
+        return bytes;
+    }
+
+
+    // ペアを表すキー。小さい番号を下位に置く
+    uint64_t SweepAndPrune::pairKey(int a, int b)
+    {
+        if (a > b) std::swap(a, b);
+        return (uint64_t(uint32_t(b)) << 32) | uint32_t(a);
+    }
+
+
+    // 2つのプロキシが3軸すべてで重なっているか
+    bool SweepAndPrune::overlaps(int a, int b) const
+    {
+        const Proxy& pa = proxies[a];
+        const Proxy& pb = proxies[b];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (pa.max[axis] < pb.min[axis] || pb.max[axis] < pa.min[axis]) return false;
+        }
+        return true;
+    }
+
+
+    // ペアを追加
+    void SweepAndPrune::addPair(int a, int b)
+    {
+        const uint64_t key = pairKey(a, b);
+        auto [it, inserted] = pairIndex.try_emplace(key, int(pairs.size()));
+        if (!inserted) return;
+
+        changedPairs.try_emplace(key, false);
+        pairs.push_back({ std::min(a, b), std::max(a, b) });
+    }
+
+
+    // ペアを削除。末尾と入れ替えて詰める
+    void SweepAndPrune::removePair(int a, int b)
+    {
+        const uint64_t key = pairKey(a, b);
+        auto it = pairIndex.find(key);
+        if (it == pairIndex.end()) return;
+
+        changedPairs.try_emplace(key, true);
+        const int index = it->second;
+        pairIndex.erase(it);
+        if (index != int(pairs.size()) - 1)
+        {
+            pairs[index] = pairs.back();
+            pairIndex[pairKey(pairs[index].first, pairs[index].second)] = index;
+        }
+        pairs.pop_back();
+    }
+
+
+    // 取り除かれたプロキシの端点とペアを片付ける
+    void SweepAndPrune::flushRemoved()
+    {
+        if (removedProxies.empty()) return;
+
+        for (auto& endpoints : axes)
+        {
+            std::erase_if(endpoints, [this](const Endpoint& e) { return !proxies[e.proxyId].alive; });
+        }
+        for (int i = 0; i < int(pairs.size()); )
+        {
+            const ProxyPair pair = pairs[i];
+            if (proxies[pair.first].alive && proxies[pair.second].alive)
+            {
+                ++i;
+            }
+            else
+            {
+                removePair(pair.first, pair.second); // 末尾が i に来るので進めない
+            }
+        }
+
+        freeProxies.insert(freeProxies.end(), removedProxies.begin(), removedProxies.end());
+        removedProxies.clear();
+    }
+
+
+    // 端点をソートし直し、x軸の掃き出しで重なりペアを作り直す
+    void SweepAndPrune::rebuild()
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            auto& endpoints = axes[axis];
+            endpoints.clear();
+            for (int id = 0; id < int(proxies.size()); ++id)
+            {
+                if (!proxies[id].alive) continue;
+                endpoints.push_back({ proxies[id].min[axis], id, true });
+                endpoints.push_back({ proxies[id].max[axis], id, false });
+            }
+            std::sort(endpoints.begin(), endpoints.end());
+        }
+
+        // 今までのペアはいったん外し、差分は resolveDeltas() で求める
+        while (!pairs.empty())
+        {
+            removePair(pairs.back().first, pairs.back().second);
+        }
+
+        sweepActive.clear();
+        for (const auto& e : axes[0])
+        {
+            if (e.isMin)
+            {
+                for (int other : sweepActive)
+                {
+                    if (overlaps(e.proxyId, other))
+                    {
+                        addPair(e.proxyId, other);
+                    }
+                }
+                sweepActive.push_back(e.proxyId);
+            }
+            else
+            {
+                auto it = std::ranges::find(sweepActive, e.proxyId);
+                *it = sweepActive.back();
+                sweepActive.pop_back();
+            }
+        }
+    }
+
+
+    // 端点の値を更新して挿入ソートする
+    // min が相手の max を追い越したら重なり始め、max が相手の min を追い越したら離れる
+    void SweepAndPrune::sortAxis(int axis)
+    {
+        auto& endpoints = axes[axis];
+        for (auto& e : endpoints)
+        {
+            const Proxy& proxy = proxies[e.proxyId];
+            e.value = e.isMin ? proxy.min[axis] : proxy.max[axis];
+        }
+
+        for (int i = 1; i < int(endpoints.size()); ++i)
+        {
+            const Endpoint e = endpoints[i];
+            int j = i - 1;
+            while (j >= 0 && e < endpoints[j])
+            {
+                const Endpoint& passed = endpoints[j];
+                if (e.isMin && !passed.isMin)
+                {
+                    // 他の軸でも重なっていればペアになる
+                    if (overlaps(e.proxyId, passed.proxyId))
+                    {
+                        addPair(e.proxyId, passed.proxyId);
+                    }
+                }
+                else if (!e.isMin && passed.isMin)
+                {
+                    removePair(e.proxyId, passed.proxyId);
+                }
+                endpoints[j + 1] = passed;
+                --j;
+                swapCount++;
+            }
+            endpoints[j + 1] = e;
+        }
+    }
+
+
+    // この update() で触ったペアを、前後の状態から増えた・減ったに振り分ける
+    void SweepAndPrune::resolveDeltas()
+    {
+        for (const auto& [key, wasPaired] : changedPairs)
+        {
+            const bool isPaired = pairIndex.contains(key);
+            if (isPaired == wasPaired) continue;
+
+            const ProxyPair pair(int(uint32_t(key)), int(uint32_t(key >> 32)));
+            if (isPaired)
+            {
+                addedPairs.push_back(pair);
+            }
+            else
+            {
+                removedPairs.push_back(pair);
+            }
+        }
+    }
+}
@@ -191,6 +191,12 @@ GameObject* Transform::SetParent(Transform * newParent)
         abort();
         return nullptr;
     }
+    if (ParallelCommandBuffer::isRecording())
+    {
+        // ParallelUpdate() の中では記録だけして、並列のフェーズが終わってから付け替える
+        ParallelCommandBuffer::setParent(this, newParent);
+        return gameObject;
+    }
     auto& siblings = parent->children;
 
     // 以前の親からGameObjectのスマートポインタを所有権ごと移動
@@ -232,6 +238,13 @@ void Transform::SetParent(unique_ptr<GameObject> gameObjectPtr, Transform* newPa
         abort();
         return;
     }
+    if (ParallelCommandBuffer::isRecording() && newParent != nullptr && IsConnectedToActiveScene(newParent->gameObject))
+    {
+        // ParallelUpdate() の中でシーンにつなぐときは記録だけして、並列のフェーズが終わってからつなぐ（Instantiate() もここを通る）
+        // シーンにつながっていない階層は組み立てているスレッドだけが触るので、複製の子などはその場でつなぐ
+        ParallelCommandBuffer::setParent(std::move(gameObjectPtr), newParent);
+        return;
+    }
 
     // 新しい親を設定
     gameObjectPtr->transform->parent = newParent;
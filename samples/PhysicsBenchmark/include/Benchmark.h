@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <UniDx.h>
+
+#include "SceneGenerator.h"
+
+
+// ブロードフェーズとソルバの名前
+const char* BroadphaseName(UniDx::BroadphaseType type);
+const char* SolverName(UniDx::SolverType type);
+bool ParseBroadphase(std::string_view name, UniDx::BroadphaseType& out);
+bool ParseSolver(std::string_view name, UniDx::SolverType& out);
+
+
+// --------------------
+// Benchmark
+// --------------------
+// シーンを作って Physics を回し、結果を JSON のオブジェクト1つの文字列で返す
+// 実行ごとに Physics を作り直すので、前の実行の状態は残らない
+class Benchmark
+{
+public:
+    int warmupSteps = 10;   // 計測の前に回して捨てるステップ数
+
+    // params のシーンを steps ステップ回し、区間ごとの平均時間と最後のステップの計測値を返す
+    std::string runStep(const SceneParams& params, UniDx::BroadphaseType broadphase, UniDx::SolverType solver, int steps);
+
+    // params のシーンを、movingRatio の割合の Shape だけが動くようにして PhysicsGrid で回す
+    // incremental を切り替えて、ブロードフェーズの更新時間と1ステップあたりの再挿入の数を返す
+    std::string runIncrementalGrid(const SceneParams& params, float movingRatio, bool incremental, int steps);
+
+    // count 個の箱の総当たりを、1組ずつ Physics::checkBounds に渡す経路と BoundsSoA でまとめて判定する経路で比べる
+    std::string runBoundsKernel(int count, unsigned int seed);
+
+    // params のシーンに queries 回ずつ OverlapSphere と OverlapBox をして、全コライダーの総当たりと時間と結果を比べる
+    std::string runOverlap(const SceneParams& params, UniDx::BroadphaseType broadphase, int queries);
+
+    // height 個の球か箱を積んで steps ステップ回し、一番上の沈みと最大のめり込みを返す
+    std::string runStack(int height, SceneShapes shapes, UniDx::SolverType solver, int velocityIterations, bool warmStarting, int steps);
+
+private:
+    SceneGenerator generator;
+
+    void resetPhysics(UniDx::BroadphaseType broadphase, UniDx::SolverType solver);
+};
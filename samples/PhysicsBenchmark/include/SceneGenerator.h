@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <string_view>
+
+#include <UniDx.h>
+
+
+// シーンの Shape の置き方
+enum class SceneDistribution
+{
+    Uniform,    // 範囲全体に一様に置く
+    Clustered,  // いくつかの塊のまわりに集めて置く
+};
+
+// シーンの Shape の種類
+enum class SceneShapes
+{
+    Spheres,
+    Boxes,
+    Mixed,      // 半分ずつ
+};
+
+
+// ベンチマーク用の乱数
+// 標準ライブラリの分布はライブラリごとに結果が違うので、mt19937 の出力から直接作る
+class SceneRandom
+{
+public:
+    explicit SceneRandom(unsigned int seed) : engine(seed) {}
+
+    // [0, 1)
+    float value() { return float(engine() >> 8) * (1.0f / 16777216.0f); }
+
+    // [min, max)
+    float range(float min, float max) { return min + (max - min) * value(); }
+
+    // 各軸 -halfSize～halfSize
+    UniDx::Vector3 insideBox(UniDx::Vector3 halfSize)
+    {
+        return UniDx::Vector3(range(-halfSize.x, halfSize.x), range(-halfSize.y, halfSize.y), range(-halfSize.z, halfSize.z));
+    }
+
+private:
+    std::mt19937 engine;
+};
+
+
+// ベンチマーク用のシーンの設定
+// 同じ設定と seed からは、いつも同じシーンができる
+struct SceneParams
+{
+    int count = 5000;                   // Shape の数
+    SceneDistribution distribution = SceneDistribution::Uniform;
+    SceneShapes shapes = SceneShapes::Mixed;
+    float extent = 100.0f;              // 置く範囲の半分の幅（縦は 1/5）
+    float size = 1.0f;                  // Shape の基本の大きさ
+    float sizeVariance = 0.0f;          // 大きさのばらつき。0 ならそろえ、1 なら基本の 0.25～4 倍
+    float staticRatio = 0.0f;           // Rigidbody を付けない Shape の割合
+    float speed = 5.0f;                 // 動く Shape の初速の最大
+    float gravityScale = 0.0f;          // 動く Shape の重力
+    int clusterCount = 8;               // Clustered のときの塊の数
+    float clusterRadius = 10.0f;        // Clustered のときの塊の半径
+    unsigned int seed = 1;
+
+    // JSON 形式の文字列にする
+    std::string toJson() const;
+};
+
+
+// --------------------
+// SceneGenerator
+// --------------------
+// 設定からベンチマーク用の GameObject を作り、Physics に登録する
+// D3D のデバイスは使わない。作った GameObject は generator を破棄すると登録を解除して消える
+class SceneGenerator
+{
+public:
+    // params のシーンを作る。前に作ったものは先に消す
+    void generate(const SceneParams& params);
+
+    // 縦に重ねた列を作る。一番下は動かない床に置く
+    // shapes が Spheres なら球、それ以外は箱を重ねる
+    void generateStack(int height, float size, SceneShapes shapes);
+
+    // 作ったものをすべて消す
+    void clear() { objects.clear(); }
+
+    const std::vector<std::unique_ptr<UniDx::GameObject>>& getObjects() const { return objects; }
+
+    // 作ったコライダーをすべて返す
+    std::vector<UniDx::Collider*> getColliders() const;
+
+private:
+    std::vector<std::unique_ptr<UniDx::GameObject>> objects;
+
+    void add(std::unique_ptr<UniDx::GameObject> object);
+};
+
+
+// 名前から置き方、種類を引く。知らない名前なら false
+bool ParseDistribution(std::string_view name, SceneDistribution& out);
+bool ParseShapes(std::string_view name, SceneShapes& out);
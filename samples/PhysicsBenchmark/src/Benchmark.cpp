@@ -0,0 +1,437 @@
+﻿#include "Benchmark.h"
+
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <BoundsSoA.h>
+#include <Broadphase.h>
+#include <PhysicsGrid.h>
+
+using namespace std;
+using namespace UniDx;
+
+
+namespace
+{
+    double elapsedMs(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    string toString(const u8string& s)
+    {
+        return string(s.begin(), s.end());
+    }
+
+    // 区間ごとの時間の合計
+    struct PhaseTotals
+    {
+        double initialize = 0.0;
+        double broadphaseUpdate = 0.0;
+        double broadphasePairs = 0.0;
+        double narrowphase = 0.0;
+        double solve = 0.0;
+        double callback = 0.0;
+        double total = 0.0;
+
+        void add(const PhysicsStats& s)
+        {
+            initialize += s.initializeMs;
+            broadphaseUpdate += s.broadphaseUpdateMs;
+            broadphasePairs += s.broadphasePairsMs;
+            narrowphase += s.narrowphaseMs;
+            solve += s.solveMs;
+            callback += s.callbackMs;
+            total += s.totalMs;
+        }
+
+        // steps で割った平均を JSON にする
+        string toJson(int steps) const
+        {
+            const double d = max(steps, 1);
+            ostringstream ss;
+            ss << fixed << setprecision(4)
+                << "{\"initialize\": " << initialize / d
+                << ", \"broadphaseUpdate\": " << broadphaseUpdate / d
+                << ", \"broadphasePairs\": " << broadphasePairs / d
+                << ", \"narrowphase\": " << narrowphase / d
+                << ", \"solve\": " << solve / d
+                << ", \"callback\": " << callback / d
+                << ", \"total\": " << total / d
+                << "}";
+            return ss.str();
+        }
+    };
+}
+
+
+const char* BroadphaseName(BroadphaseType type)
+{
+    switch (type)
+    {
+    case BroadphaseType::BruteForce: return "bruteforce";
+    case BroadphaseType::Grid: return "grid";
+    case BroadphaseType::AABBTree: return "aabbtree";
+    case BroadphaseType::SweepAndPrune: return "sap";
+    }
+    return "unknown";
+}
+
+
+const char* SolverName(SolverType type)
+{
+    return type == SolverType::SequentialImpulse ? "si" : "pc";
+}
+
+
+bool ParseBroadphase(string_view name, BroadphaseType& out)
+{
+    for (auto type : { BroadphaseType::BruteForce, BroadphaseType::Grid, BroadphaseType::AABBTree, BroadphaseType::SweepAndPrune })
+    {
+        if (name == BroadphaseName(type))
+        {
+            out = type;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool ParseSolver(string_view name, SolverType& out)
+{
+    if (name == "pc") out = SolverType::PositionCorrection;
+    else if (name == "si") out = SolverType::SequentialImpulse;
+    else return false;
+    return true;
+}
+
+
+// Physics を作り直す。前のシーンは Physics があるうちに消して登録を解除する
+void Benchmark::resetPhysics(BroadphaseType broadphase, SolverType solver)
+{
+    generator.clear();
+    Physics::destroy();
+    Physics::create();
+    Physics::getInstance()->setBroadphaseType(broadphase);
+    Physics::getInstance()->solverType = solver;
+}
+
+
+// params のシーンを steps ステップ回す
+std::string Benchmark::runStep(const SceneParams& params, BroadphaseType broadphase, SolverType solver, int steps)
+{
+    resetPhysics(broadphase, solver);
+    auto physics = Physics::getInstance();
+    generator.generate(params);
+
+    for (int i = 0; i < warmupSteps; ++i)
+    {
+        physics->simulateStep(Time::fixedDeltaTime);
+    }
+
+    PhaseTotals totals;
+    for (int i = 0; i < steps; ++i)
+    {
+        physics->simulateStep(Time::fixedDeltaTime);
+        totals.add(physics->getStats());
+    }
+
+    ostringstream ss;
+    ss << "{\"scenario\": \"step\""
+        << ", \"broadphase\": \"" << BroadphaseName(broadphase) << "\""
+        << ", \"solver\": \"" << SolverName(solver) << "\""
+        << ", \"steps\": " << steps
+        << ", \"scene\": " << params.toJson()
+        << ", \"averageMs\": " << totals.toJson(steps)
+        << ", \"last\": " << toString(physics->getStats().toJson())
+        << "}";
+    generator.clear();
+    return ss.str();
+}
+
+
+// 動かない Shape の多いシーンで PhysicsGrid を回す
+// Rigidbody のない Shape やスリープ中の Shape は動かない Shape の木に移ってグリッドに残らないので、
+// すべてに Rigidbody を付けてスリープさせず、movingRatio の割合だけに初速を与える
+std::string Benchmark::runIncrementalGrid(const SceneParams& params, float movingRatio, bool incremental, int steps)
+{
+    resetPhysics(BroadphaseType::Grid, SolverType::PositionCorrection);
+    auto physics = Physics::getInstance();
+    auto grid = static_cast<PhysicsGrid*>(physics->getBroadphase());
+    grid->incremental = incremental;
+
+    SceneParams scene = params;
+    scene.staticRatio = 0.0f;
+    scene.gravityScale = 0.0f;
+    generator.generate(scene);
+
+    SceneRandom random(params.seed + 2);
+    int moving = 0;
+    for (auto& object : generator.getObjects())
+    {
+        auto rb = object->GetComponent<Rigidbody>();
+        rb->sleepThreshold = -1.0f;     // 止まっていてもスリープしない
+        if (random.value() < movingRatio)
+        {
+            moving++;
+        }
+        else
+        {
+            rb->linearVelocity = Vector3::zero;
+        }
+    }
+
+    // 最初に重なっていたものが押し出されて落ち着くまで回す
+    for (int i = 0; i < warmupSteps; ++i)
+    {
+        physics->simulateStep(Time::fixedDeltaTime);
+    }
+
+    PhaseTotals totals;
+    long long reinserts = 0;
+    int rebuilds = 0;
+    for (int i = 0; i < steps; ++i)
+    {
+        physics->simulateStep(Time::fixedDeltaTime);
+        totals.add(physics->getStats());
+        reinserts += grid->getReinsertCount();
+        rebuilds += grid->isRebuilt() ? 1 : 0;
+    }
+
+    ostringstream ss;
+    ss << fixed << setprecision(2)
+        << "{\"scenario\": \"incremental-grid\""
+        << ", \"incremental\": " << (incremental ? "true" : "false")
+        << ", \"movingRatio\": " << movingRatio
+        << ", \"movingShapes\": " << moving
+        << ", \"steps\": " << steps
+        << ", \"scene\": " << scene.toJson()
+        << ", \"reinsertsPerStep\": " << double(reinserts) / max(steps, 1)
+        << ", \"rebuilds\": " << rebuilds
+        << ", \"averageMs\": " << totals.toJson(steps)
+        << "}";
+    generator.clear();
+    return ss.str();
+}
+
+
+// count 個の箱の総当たり
+// どちらもブロードフェーズと同じく、重なりうるペアを Broadphase::CheckBoundFunc で Physics::checkBounds に渡す
+// 1組ずつ渡して checkBounds で判定するのが元の経路、BoundsSoA でまとめて判定して重なったものだけ渡すのが新しい経路
+std::string Benchmark::runBoundsKernel(int count, unsigned int seed)
+{
+    resetPhysics(BroadphaseType::BruteForce, SolverType::PositionCorrection);
+    auto physics = Physics::getInstance();
+
+    // checkBounds は相手のコライダーを見るので、動かない箱を本当に作ってつなぐ
+    SceneParams params;
+    params.count = count;
+    params.shapes = SceneShapes::Boxes;
+    params.staticRatio = 1.0f;
+    params.seed = seed;
+    generator.generate(params);
+    const auto colliders = generator.getColliders();
+
+    SceneRandom random(seed);
+    vector<PhysicsShape> shapes(count);
+    for (int i = 0; i < count; ++i)
+    {
+        // 1組あたりおよそ 0.1% が重なる密度
+        shapes[i].initialize(colliders[i]);
+        shapes[i].moveBounds = Bounds(random.insideBox(Vector3::one * 50.0f), Vector3::one * random.range(0.5f, 4.0f));
+    }
+    const Broadphase::CheckBoundFunc checkBound = MakeMemberAction(physics, &Physics::checkBounds);
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        for (int j = i + 1; j < count; ++j)
+        {
+            checkBound(&shapes[i], &shapes[j]);
+        }
+    }
+    const double scalarMs = elapsedMs(start);
+
+    BoundsSoA soa;
+    soa.reserve(count);
+    for (const auto& shape : shapes) soa.push_back(shape.moveBounds);
+    vector<int> overlaps;
+    long long soaHits = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        overlaps.clear();
+        soa.gatherOverlaps(shapes[i].moveBounds, i + 1, count, overlaps);
+        for (int j : overlaps)
+        {
+            checkBound(&shapes[i], &shapes[j]);
+        }
+        soaHits += overlaps.size();
+    }
+    const double soaMs = elapsedMs(start);
+
+    // 計測の外で、1組ずつの判定と数が合うか確かめる
+    long long scalarHits = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        for (int j = i + 1; j < count; ++j)
+        {
+            if (shapes[i].moveBounds.Intersects(shapes[j].moveBounds)) scalarHits++;
+        }
+    }
+
+    const double pairs = double(count) * double(count - 1) * 0.5;
+    ostringstream ss;
+    ss << fixed << setprecision(3)
+        << "{\"scenario\": \"bounds\""
+        << ", \"count\": " << count
+        << ", \"seed\": " << seed
+        << ", \"kernel\": \"" << BoundsSoA::kernelName() << "\""
+        << ", \"pairs\": " << (long long)pairs
+        << ", \"hits\": {\"scalar\": " << scalarHits << ", \"soa\": " << soaHits << "}"
+        << ", \"ms\": {\"scalar\": " << scalarMs << ", \"soa\": " << soaMs << "}"
+        << ", \"gigaPairsPerSecond\": {\"scalar\": " << pairs / (scalarMs * 1e6)
+        << ", \"soa\": " << pairs / (soaMs * 1e6) << "}"
+        << "}";
+
+    // checkBounds が集めたペアはこの shapes を指すので、次のステップの前に Physics ごと作り直す
+    resetPhysics(BroadphaseType::BruteForce, SolverType::PositionCorrection);
+    return ss.str();
+}
+
+
+// OverlapSphere と OverlapBox を、全コライダーの総当たりと比べる
+// 総当たりもクエリと同じ正確な判定を使うので、結果は一致するはず
+std::string Benchmark::runOverlap(const SceneParams& params, BroadphaseType broadphase, int queries)
+{
+    resetPhysics(broadphase, SolverType::PositionCorrection);
+    auto physics = Physics::getInstance();
+    generator.generate(params);
+    physics->simulateStep(Time::fixedDeltaTime);
+    physics->SyncTransforms();
+    const auto colliders = generator.getColliders();
+
+    // 問い合わせの位置と大きさを先に決めておく
+    SceneRandom random(params.seed + 1);
+    struct Query
+    {
+        Vector3 center;
+        float radius;
+        Vector3 halfExtents;
+    };
+    vector<Query> qs(queries);
+    const Vector3 area(params.extent, params.extent * 0.2f, params.extent);
+    for (auto& q : qs)
+    {
+        q.center = random.insideBox(area);
+        q.radius = random.range(1.0f, 8.0f) * params.size;
+        q.halfExtents = Vector3(random.range(1.0f, 8.0f), random.range(1.0f, 8.0f), random.range(1.0f, 8.0f)) * params.size;
+    }
+
+    vector<vector<Collider*>> found(queries * 2);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; ++i)
+    {
+        found[i * 2] = physics->OverlapSphere(qs[i].center, qs[i].radius);
+        found[i * 2 + 1] = physics->OverlapBox(qs[i].center, qs[i].halfExtents);
+    }
+    const double queryMs = elapsedMs(start);
+
+    vector<vector<Collider*>> expected(queries * 2);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; ++i)
+    {
+        const Bounds box(qs[i].center, qs[i].halfExtents);
+        for (auto col : colliders)
+        {
+            if (col->intersectsSphere(qs[i].center, qs[i].radius)) expected[i * 2].push_back(col);
+            if (col->intersectsBox(box)) expected[i * 2 + 1].push_back(col);
+        }
+    }
+    const double bruteMs = elapsedMs(start);
+
+    int mismatches = 0;
+    long long hits = 0;
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        sort(found[i].begin(), found[i].end());
+        sort(expected[i].begin(), expected[i].end());
+        if (found[i] != expected[i]) mismatches++;
+        hits += found[i].size();
+    }
+
+    ostringstream ss;
+    ss << fixed << setprecision(3)
+        << "{\"scenario\": \"overlap\""
+        << ", \"broadphase\": \"" << BroadphaseName(broadphase) << "\""
+        << ", \"queries\": {\"sphere\": " << queries << ", \"box\": " << queries << "}"
+        << ", \"scene\": " << params.toJson()
+        << ", \"hits\": " << hits
+        << ", \"mismatches\": " << mismatches
+        << ", \"ms\": {\"query\": " << queryMs << ", \"bruteForce\": " << bruteMs << "}"
+        << ", \"speedup\": " << (queryMs > 0.0 ? bruteMs / queryMs : 0.0)
+        << "}";
+    generator.clear();
+    return ss.str();
+}
+
+
+// height 個の球か箱を積んで回す
+// 沈みは一番上の最初の高さとの差、めり込みは隣り合うものの間隔が大きさに足りない分の最大
+std::string Benchmark::runStack(int height, SceneShapes shapes, SolverType solver, int velocityIterations, bool warmStarting, int steps)
+{
+    const int savedIterations = Physics::velocityIterations;
+    const bool savedWarmStarting = Physics::warmStarting;
+    Physics::velocityIterations = velocityIterations;
+    Physics::warmStarting = warmStarting;
+
+    resetPhysics(BroadphaseType::Grid, solver);
+    auto physics = Physics::getInstance();
+    const float size = 1.0f;
+    generator.generateStack(height, size, shapes);
+    const auto& objects = generator.getObjects();
+    const float topStart = objects.back()->transform->position.get().y;
+
+    double totalMs = 0.0;
+    for (int i = 0; i < steps; ++i)
+    {
+        physics->simulateStep(Time::fixedDeltaTime);
+        totalMs += physics->getStats().totalMs;
+    }
+
+    // objects[0] は床
+    float maxPenetration = 0.0f;
+    float maxDrift = 0.0f;
+    float below = 0.0f;
+    for (size_t i = 1; i < objects.size(); ++i)
+    {
+        const Vector3 p = objects[i]->transform->position;
+        maxPenetration = max(maxPenetration, size - (p.y - below) - (i == 1 ? size * 0.5f : 0.0f));
+        maxDrift = max(maxDrift, Vector3(p.x, 0.0f, p.z).magnitude());
+        below = p.y;
+    }
+    const float topEnd = objects.back()->transform->position.get().y;
+
+    ostringstream ss;
+    ss << fixed << setprecision(4)
+        << "{\"scenario\": \"stack\""
+        << ", \"solver\": \"" << SolverName(solver) << "\""
+        << ", \"shapes\": \"" << (shapes == SceneShapes::Spheres ? "spheres" : "boxes") << "\""
+        << ", \"height\": " << height
+        << ", \"velocityIterations\": " << velocityIterations
+        << ", \"warmStarting\": " << (warmStarting ? "true" : "false")
+        << ", \"steps\": " << steps
+        << ", \"topSink\": " << topStart - topEnd
+        << ", \"maxPenetration\": " << maxPenetration
+        << ", \"maxHorizontalDrift\": " << maxDrift
+        << ", \"averageStepMs\": " << totalMs / max(steps, 1)
+        << "}";
+
+    generator.clear();
+    Physics::velocityIterations = savedIterations;
+    Physics::warmStarting = savedWarmStarting;
+    return ss.str();
+}
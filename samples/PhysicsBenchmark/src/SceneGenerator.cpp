@@ -0,0 +1,165 @@
+﻿#include "SceneGenerator.h"
+
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+using namespace UniDx;
+
+
+namespace
+{
+    const char* distributionName(SceneDistribution d)
+    {
+        return d == SceneDistribution::Clustered ? "clustered" : "uniform";
+    }
+
+    const char* shapesName(SceneShapes s)
+    {
+        switch (s)
+        {
+        case SceneShapes::Spheres: return "spheres";
+        case SceneShapes::Boxes: return "boxes";
+        default: return "mixed";
+        }
+    }
+}
+
+
+// 設定を JSON 形式の文字列にする
+string SceneParams::toJson() const
+{
+    ostringstream ss;
+    ss << fixed << setprecision(3)
+        << "{\"count\": " << count
+        << ", \"distribution\": \"" << distributionName(distribution) << "\""
+        << ", \"shapes\": \"" << shapesName(shapes) << "\""
+        << ", \"extent\": " << extent
+        << ", \"size\": " << size
+        << ", \"sizeVariance\": " << sizeVariance
+        << ", \"staticRatio\": " << staticRatio
+        << ", \"speed\": " << speed
+        << ", \"gravityScale\": " << gravityScale
+        << ", \"clusterCount\": " << clusterCount
+        << ", \"clusterRadius\": " << clusterRadius
+        << ", \"seed\": " << seed
+        << "}";
+    return ss.str();
+}
+
+
+// params のシーンを作る
+// 乱数は Shape ごとに決まった順に引くので、同じ設定ならいつも同じ位置と大きさになる
+void SceneGenerator::generate(const SceneParams& params)
+{
+    clear();
+    objects.reserve(params.count);
+
+    SceneRandom random(params.seed);
+    const Vector3 area(params.extent, params.extent * 0.2f, params.extent);
+
+    vector<Vector3> clusters;
+    if (params.distribution == SceneDistribution::Clustered)
+    {
+        for (int i = 0; i < max(params.clusterCount, 1); ++i)
+        {
+            clusters.push_back(random.insideBox(area));
+        }
+    }
+
+    for (int i = 0; i < params.count; ++i)
+    {
+        Vector3 position = clusters.empty()
+            ? random.insideBox(area)
+            : clusters[i % clusters.size()] + random.insideBox(Vector3::one * params.clusterRadius);
+
+        // 0.25～4 倍を対数で一様に
+        const float scale = params.size * std::pow(4.0f, params.sizeVariance * random.range(-1.0f, 1.0f));
+        const bool sphere = params.shapes == SceneShapes::Spheres
+            || (params.shapes == SceneShapes::Mixed && i % 2 == 0);
+        const bool isStatic = random.value() < params.staticRatio;
+        const Vector3 velocity = random.insideBox(Vector3::one * params.speed);
+
+        unique_ptr<Collider> collider;
+        if (sphere) collider = make_unique<SphereCollider>(Vector3::zero, 0.5f * scale);
+        else collider = make_unique<AABBCollider>();
+
+        auto object = make_unique<GameObject>(sphere ? u8"Sphere" : u8"Box", move(collider));
+        object->transform->position = position;
+        if (!sphere) object->transform->localScale = Vector3::one * scale;
+        if (!isStatic)
+        {
+            auto rb = object->AddComponent<Rigidbody>();
+            rb->gravityScale = params.gravityScale;
+            rb->linearVelocity = velocity;
+        }
+        add(move(object));
+    }
+}
+
+
+// 縦に重ねた列を作る
+// 球は直径、箱は辺が size で、すき間なく接するように置く
+void SceneGenerator::generateStack(int height, float size, SceneShapes shapes)
+{
+    clear();
+
+    auto floor = make_unique<GameObject>(u8"Floor", make_unique<AABBCollider>());
+    floor->transform->localScale = Vector3(size * 20.0f, size, size * 20.0f);
+    floor->transform->position = Vector3(0, -size * 0.5f, 0);
+    add(move(floor));
+
+    const bool sphere = shapes == SceneShapes::Spheres;
+    for (int i = 0; i < height; ++i)
+    {
+        unique_ptr<Collider> collider;
+        if (sphere) collider = make_unique<SphereCollider>(Vector3::zero, 0.5f * size);
+        else collider = make_unique<AABBCollider>();
+        collider->bounciness = 0.0f;
+
+        auto object = make_unique<GameObject>(sphere ? u8"Sphere" : u8"Box", move(collider), make_unique<Rigidbody>());
+        if (!sphere) object->transform->localScale = Vector3::one * size;
+        object->transform->position = Vector3(0, size * (float(i) + 0.5f), 0);
+        add(move(object));
+    }
+}
+
+
+// 作ったコライダーをすべて返す
+vector<Collider*> SceneGenerator::getColliders() const
+{
+    vector<Collider*> colliders;
+    colliders.reserve(objects.size());
+    for (auto& object : objects)
+    {
+        colliders.push_back(object->GetComponent<Collider>());
+    }
+    return colliders;
+}
+
+
+// シーンに置かずに Awake()/OnEnable() を呼び、Physics に登録する
+void SceneGenerator::add(unique_ptr<GameObject> object)
+{
+    object->checkAwake();
+    objects.push_back(move(object));
+}
+
+
+bool ParseDistribution(string_view name, SceneDistribution& out)
+{
+    if (name == "uniform") out = SceneDistribution::Uniform;
+    else if (name == "clustered") out = SceneDistribution::Clustered;
+    else return false;
+    return true;
+}
+
+
+bool ParseShapes(string_view name, SceneShapes& out)
+{
+    if (name == "spheres") out = SceneShapes::Spheres;
+    else if (name == "boxes") out = SceneShapes::Boxes;
+    else if (name == "mixed") out = SceneShapes::Mixed;
+    else return false;
+    return true;
+}
@@ -0,0 +1,242 @@
+﻿// main.cpp : ウィンドウを作らずに Physics のベンチマークを回し、結果を JSON で書き出す
+//
+// PhysicsBenchmark [シナリオ] [オプション]
+//   シナリオ
+//     suite         以下をひととおり（省略時）
+//     step          1つのシーンをブロードフェーズごとに回す
+//     static-ratio  動かない Shape の割合を 0, 0.5, 0.9, 0.99 に変えて回す
+//     incremental-grid  --moving-ratio の割合だけが動くシーンを PhysicsGrid の差分更新なしとありで回す
+//     bounds        Bounds の総当たりを 1組ずつと BoundsSoA で比べる
+//     overlap       OverlapSphere / OverlapBox を総当たりと比べる
+//     stack         球と箱を積んでソルバの沈みとめり込みを見る
+//   オプション
+//     --count N  --distribution uniform|clustered  --shapes spheres|boxes|mixed
+//     --size-variance F  --static-ratio F  --moving-ratio F  --steps N  --queries N  --height N
+//     --broadphase bruteforce|grid|aabbtree|sap|all  --solver pc|si
+//     --seed N  --threads N  --out ファイル名
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+#include <UniDx.h>
+#include <UniDx/Scene.h>
+#include <UniDx/SceneManager.h>
+#include <UniDx/JobSystem.h>
+#include <BoundsSoA.h>
+
+#include "Benchmark.h"
+
+using namespace std;
+using namespace UniDx;
+
+
+// UniDx.lib の SceneManager が参照する。ベンチマークではシーンを使わない
+unique_ptr<Scene> CreateDefaultScene()
+{
+    return nullptr;
+}
+
+void DestroyDefaultScene()
+{
+}
+
+
+namespace
+{
+    struct Options
+    {
+        string scenario = "suite";
+        SceneParams scene;
+        vector<BroadphaseType> broadphases = { BroadphaseType::BruteForce, BroadphaseType::Grid, BroadphaseType::AABBTree, BroadphaseType::SweepAndPrune };
+        SolverType solver = SolverType::PositionCorrection;
+        int steps = 100;
+        int queries = 1000;
+        int height = 10;
+        float movingRatio = 0.01f;
+        int threads = 0;
+        string out;
+    };
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        int i = 1;
+        if (i < argc && argv[i][0] != '-')
+        {
+            options.scenario = argv[i++];
+        }
+        for (; i < argc; ++i)
+        {
+            const string_view key = argv[i];
+            if (i + 1 >= argc)
+            {
+                cerr << "missing value: " << key << endl;
+                return false;
+            }
+            const char* value = argv[++i];
+
+            bool ok = true;
+            if (key == "--count") options.scene.count = atoi(value);
+            else if (key == "--distribution") ok = ParseDistribution(value, options.scene.distribution);
+            else if (key == "--shapes") ok = ParseShapes(value, options.scene.shapes);
+            else if (key == "--size-variance") options.scene.sizeVariance = float(atof(value));
+            else if (key == "--static-ratio") options.scene.staticRatio = float(atof(value));
+            else if (key == "--steps") options.steps = atoi(value);
+            else if (key == "--queries") options.queries = atoi(value);
+            else if (key == "--height") options.height = atoi(value);
+            else if (key == "--moving-ratio") options.movingRatio = float(atof(value));
+            else if (key == "--seed") options.scene.seed = unsigned(atoi(value));
+            else if (key == "--threads") options.threads = atoi(value);
+            else if (key == "--out") options.out = value;
+            else if (key == "--solver") ok = ParseSolver(value, options.solver);
+            else if (key == "--broadphase")
+            {
+                BroadphaseType type;
+                if (string_view(value) != "all")
+                {
+                    ok = ParseBroadphase(value, type);
+                    options.broadphases = { type };
+                }
+            }
+            else ok = false;
+
+            if (!ok)
+            {
+                cerr << "unknown option: " << key << " " << value << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void runStep(Benchmark& bench, const Options& options, const SceneParams& scene, vector<string>& results)
+    {
+        for (auto type : options.broadphases)
+        {
+            results.push_back(bench.runStep(scene, type, options.solver, options.steps));
+        }
+    }
+
+    void runStaticRatio(Benchmark& bench, const Options& options, vector<string>& results)
+    {
+        SceneParams scene = options.scene;
+        for (float ratio : { 0.0f, 0.5f, 0.9f, 0.99f })
+        {
+            scene.staticRatio = ratio;
+            runStep(bench, options, scene, results);
+        }
+    }
+
+    void runIncrementalGrid(Benchmark& bench, const Options& options, vector<string>& results)
+    {
+        for (bool incremental : { false, true })
+        {
+            results.push_back(bench.runIncrementalGrid(options.scene, options.movingRatio, incremental, options.steps));
+        }
+    }
+
+    void runOverlap(Benchmark& bench, const Options& options, vector<string>& results)
+    {
+        for (auto type : options.broadphases)
+        {
+            results.push_back(bench.runOverlap(options.scene, type, options.queries));
+        }
+    }
+
+    // 位置補正法は箱同士を扱わないので、箱の列は逐次インパルス法だけで回す
+    void runStack(Benchmark& bench, const Options& options, vector<string>& results)
+    {
+        for (auto shapes : { SceneShapes::Spheres, SceneShapes::Boxes })
+        {
+            if (shapes == SceneShapes::Spheres)
+            {
+                results.push_back(bench.runStack(options.height, shapes, SolverType::PositionCorrection, Physics::velocityIterations, true, options.steps));
+            }
+            for (int iterations : { 2, 6, 10 })
+            {
+                for (bool warmStarting : { false, true })
+                {
+                    results.push_back(bench.runStack(options.height, shapes, SolverType::SequentialImpulse, iterations, warmStarting, options.steps));
+                }
+            }
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    JobSystem::workerThreadCount = options.threads;
+    JobSystem::create();
+
+    Benchmark bench;
+    vector<string> results;
+    const auto& s = options.scenario;
+    if (s == "step") runStep(bench, options, options.scene, results);
+    else if (s == "static-ratio") runStaticRatio(bench, options, results);
+    else if (s == "incremental-grid") runIncrementalGrid(bench, options, results);
+    else if (s == "bounds") results.push_back(bench.runBoundsKernel(options.scene.count, options.scene.seed));
+    else if (s == "overlap") runOverlap(bench, options, results);
+    else if (s == "stack") runStack(bench, options, results);
+    else if (s == "suite")
+    {
+        results.push_back(bench.runBoundsKernel(4000, options.scene.seed));
+        runStep(bench, options, options.scene, results);
+
+        Options clustered = options;
+        clustered.scene.distribution = SceneDistribution::Clustered;
+        clustered.scene.sizeVariance = 1.0f;
+        runStep(bench, clustered, clustered.scene, results);
+
+        Options large = options;
+        large.scene.count = 10000;
+        large.broadphases = { BroadphaseType::Grid, BroadphaseType::AABBTree, BroadphaseType::SweepAndPrune };
+        runStaticRatio(bench, large, results);
+        runIncrementalGrid(bench, large, results);
+
+        runOverlap(bench, options, results);
+        runStack(bench, options, results);
+    }
+    else
+    {
+        cerr << "unknown scenario: " << s << endl;
+        return 1;
+    }
+
+    ostringstream ss;
+    ss << "{\"benchmark\": \"PhysicsBenchmark\""
+        << ", \"scenario\": \"" << s << "\""
+        << ", \"kernel\": \"" << BoundsSoA::kernelName() << "\""
+        << ", \"threads\": " << JobSystem::getInstance()->getWorkerCount() + 1
+        << ", \"fixedDeltaTime\": " << Time::fixedDeltaTime
+        << ", \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        ss << "  " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    ss << "]}\n";
+
+    if (options.out.empty())
+    {
+        cout << ss.str();
+    }
+    else
+    {
+        ofstream file(options.out);
+        file << ss.str();
+    }
+
+    Physics::destroy();
+    JobSystem::destroy();
+    return 0;
+}
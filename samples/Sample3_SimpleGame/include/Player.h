@@ -1,7 +1,7 @@
 #pragma once
 
 #include <UniDx.h>
-#include <UniDx/Rigidbody.h>
+#include <UniDx/CharacterController.h>
 
 using namespace UniDx;
 
@@ -16,8 +16,9 @@ public:
     virtual void OnCollisionEnter(const Collision& collision) override;
     virtual void OnCollisionStay(const Collision& collision) override;
     virtual void OnCollisionExit(const Collision& collision) override;
+    virtual void OnControllerColliderHit(const ControllerColliderHit& hit) override;
 
-    UniDx::Rigidbody* rb = nullptr;
+    UniDx::CharacterController* controller = nullptr;
 
 private:
     std::vector<UniDx::Transform*> bones;
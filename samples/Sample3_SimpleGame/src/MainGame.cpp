@@ -51,8 +51,29 @@ void MainGame::createMap()
     wallTex->Load(u8"resource/wall.png");
     wallMat->AddTexture(std::move(wallTex));
 
+    const int width = MapData::getInstance()->getWidth();
+    const int height = MapData::getInstance()->getHeight();
+
+    // 壁のコリジョン。マップ全体で1つのコライダーにする
+    // マップの行 j は奥から手前へ並ぶので、セルの z は height - 1 - j になる
+    auto wallCollider = make_unique<TilemapCollider>(
+        Vector3(-float(width / 2) * 2 - 1, -1, -float(height - 1) * 2 + float(height / 2) * 2 - 1),
+        Vector3(2, 2, 2));
+    wallCollider->resize(width, height);
+    auto wallTiles = wallCollider.get();
+
+    // 床のコリジョン。床のブロックを並べた範囲をすべて埋める
+    const int floorWidth = width + width % 2;
+    const int floorHeight = height + height % 2;
+    auto floorCollider = make_unique<TilemapCollider>(
+        Vector3(-float(width / 2) * 2 - 1, -2, -float(floorHeight - 1) * 2 + float(height / 2) * 2 - 1),
+        Vector3(2, 1, 2));
+    floorCollider->resize(floorWidth, floorHeight, true);
+
     // マップ作成
-    auto map = make_unique<GameObject>();
+    auto map = make_unique<GameObject>(u8"マップ",
+        move(wallCollider),
+        move(floorCollider));
 
     // 各ブロック作成
     for (int i = 0; i < MapData::getInstance()->getWidth(); i++)
@@ -63,15 +84,11 @@ void MainGame::createMap()
             {
             case '#':
             {
-                auto rb = make_unique<Rigidbody>();
-                rb->gravityScale = 0;
-                rb->mass = numeric_limits<float>::infinity();
+                wallTiles->setTile(i, height - 1 - j, true);
 
-                // 壁オブジェクトを作成
+                // 壁オブジェクトを作成。コリジョンはマップの TilemapCollider が受け持つ
                 auto wall = make_unique<GameObject>(u8"壁",
-                    CubeRenderer::create<VertexPNT>(wallMat),
-                    move(rb),
-                    make_unique<AABBCollider>());
+                    CubeRenderer::create<VertexPNT>(wallMat));
                 wall->transform->localScale = Vector3(2, 2, 2);
                 wall->transform->localPosition = Vector3(
                     i * 2 - float(MapData::getInstance()->getWidth() / 2) * 2,
@@ -116,13 +133,8 @@ void MainGame::createMap()
             // 床
             if (i % 2 == 0 && j % 2 == 0)
             {
-                auto rb = make_unique<Rigidbody>();
-                rb->gravityScale = 0;
-                rb->mass = numeric_limits<float>::infinity();
                 auto floor = make_unique<GameObject>(u8"床",
-                    CubeRenderer::create<VertexPNT>(floorMat),
-                    move(rb),
-                    make_unique<AABBCollider>());
+                    CubeRenderer::create<VertexPNT>(floorMat));
                 floor->transform->localScale = Vector3(4, 1, 4);
                 floor->transform->localPosition = Vector3(
                     i * 2 - float(MapData::getInstance()->getWidth() / 2) * 2 + 1.0f,
@@ -145,8 +157,9 @@ unique_ptr<UniDx::Scene> MainGame::CreateScene()
     // -- プレイヤー --
     auto playerObj = make_unique<GameObject>(u8"プレイヤー",
         make_unique<GltfModel>(),
+        make_unique<CharacterController>(Vector3(0, 0.5f, 0), 1.5f, 0.5f),
         make_unique<Rigidbody>(),
-        make_unique<SphereCollider>(Vector3(0, 0.25f, 0)),
+        make_unique<SphereCollider>(Vector3(0, 0.5f, 0), 0.5f),
         make_unique<Player>()
         );
     auto model = playerObj->GetComponent<GltfModel>();
@@ -46,11 +46,14 @@ namespace
 
 void Player::OnEnable()
 {
-    rb = GetComponent<Rigidbody>();
-    assert(rb != nullptr);
+    controller = GetComponent<CharacterController>();
+    assert(controller != nullptr);
 
-    rb->gravityScale = 1.5f;
-    GetComponent<Collider>()->bounciness = 0.0f;
+    // 動かすのはコントローラーなので、Rigidbody はほかの Rigidbody やトリガーに見せるためだけに使う
+    auto rb = GetComponent<Rigidbody>();
+    assert(rb != nullptr);
+    rb->isKinematic = true;
+    rb->gravityScale = 0.0f;
 
     // アニメーションさせるボーンを検索し、初期姿勢の回転を記録
     bones.resize(BoneMax);
@@ -107,10 +110,10 @@ void Player::Update()
     Vector3 velocity = cont * moveSpeed * Quaternion::AngleAxis(camAngle, Vector3::up);
     float vAngle = std::atan2(velocity.x, velocity.z) * UniDx::Rad2Deg;
 
-    rb->linearVelocity = velocity;
+    controller->SimpleMove(velocity);
     if (cont != Vector3::zero)
     {
-        rb->rotation = Quaternion::Euler(0, vAngle, 0);
+        transform->rotation = Quaternion::Euler(0, vAngle, 0);
     }
 
     // プログラムアニメ
@@ -146,14 +149,8 @@ void Player::OnTriggerExit(Collider* other)
 }
 
 
-// コライダーに当たったときのコールバック
 void Player::OnCollisionEnter(const Collision& collision)
 {
-    if (collision.collider->name == CoinName)
-    {
-        MainGame::getInstance()->AddScore(1);
-        Destroy(collision.collider->gameObject);
-    }
 }
 
 
@@ -165,3 +162,16 @@ void Player::OnCollisionExit(const Collision& collision)
 {
 }
 
+
+// 移動中にコライダーに当たったときのコールバック
+void Player::OnControllerColliderHit(const ControllerColliderHit& hit)
+{
+    // 1回の移動で同じコインに何度か当たることがあるので、取ったらすぐにコライダーを止める
+    if (hit.collider->name == CoinName && hit.collider->enabled)
+    {
+        MainGame::getInstance()->AddScore(1);
+        hit.collider->enabled = false;
+        Destroy(hit.collider->gameObject);
+    }
+}
+